@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vulkan/vulkan.h>
+
+#include "buffers.h"
+
+VkResult 
+find_memory_type(VkPhysicalDevice physicalDevice, 
+		 uint32_t typeBits, 
+		 VkMemoryPropertyFlags properties, 
+		 uint32_t* pTypeIndex) 
+{
+	VkPhysicalDeviceMemoryProperties memProperties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+	for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i) {
+		if ((typeBits & (1u << i)) && 
+			(memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+			*pTypeIndex = i;
+			return VK_SUCCESS;
+		}
+	}
+
+	return VK_ERROR_FEATURE_NOT_PRESENT;
+}
+
+VkResult 
+create_buffer(VkPhysicalDevice physicalDevice, 
+	      VkDevice device, 
+	      VkDeviceSize size, 
+	      VkBufferUsageFlags usage, 
+	      VkMemoryPropertyFlags properties, 
+	      VkBuffer* pBuffer, 
+	      VkDeviceMemory* pMemory) 
+{
+	VkBufferCreateInfo bufferInfo = { };
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, pBuffer) != VK_SUCCESS) {
+		fputs("Buffers: failed to create a buffer.\n", stderr);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, *pBuffer, &memRequirements);
+
+	VkMemoryAllocateInfo allocInfo = { };
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memRequirements.size;
+	if (find_memory_type(physicalDevice, 
+			      memRequirements.memoryTypeBits, 
+			      properties, 
+			      &allocInfo.memoryTypeIndex) != VK_SUCCESS) {
+		fputs("Buffers: no suitable memory type for a buffer.\n", stderr);
+		vkDestroyBuffer(device, *pBuffer, nullptr);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	if (vkAllocateMemory(device, &allocInfo, nullptr, pMemory) != VK_SUCCESS) {
+		fputs("Buffers: failed to allocate buffer memory.\n", stderr);
+		vkDestroyBuffer(device, *pBuffer, nullptr);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+	vkBindBufferMemory(device, *pBuffer, *pMemory, 0);
+
+	return VK_SUCCESS;
+}
+
+VkResult 
+create_image(VkPhysicalDevice physicalDevice, 
+	     VkDevice device, 
+	     VkExtent2D extent, 
+	     VkFormat format, 
+	     VkImageUsageFlags usage, 
+	     VkImage* pImage, 
+	     VkDeviceMemory* pMemory) 
+{
+	VkImageCreateInfo imageInfo = { };
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = format;
+	imageInfo.extent.width = extent.width;
+	imageInfo.extent.height = extent.height;
+	imageInfo.extent.depth = 1;
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = usage;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	if (vkCreateImage(device, &imageInfo, nullptr, pImage) != VK_SUCCESS) {
+		fputs("Buffers: failed to create an image.\n", stderr);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetImageMemoryRequirements(device, *pImage, &memRequirements);
+
+	VkMemoryAllocateInfo allocInfo = { };
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memRequirements.size;
+	if (find_memory_type(physicalDevice, 
+			      memRequirements.memoryTypeBits, 
+			      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 
+			      &allocInfo.memoryTypeIndex) != VK_SUCCESS && 
+		find_memory_type(physicalDevice, 
+				  memRequirements.memoryTypeBits, 
+				  0, 
+				  &allocInfo.memoryTypeIndex) != VK_SUCCESS) {
+		fputs("Buffers: no suitable memory type for an image.\n", stderr);
+		vkDestroyImage(device, *pImage, nullptr);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	if (vkAllocateMemory(device, &allocInfo, nullptr, pMemory) != VK_SUCCESS) {
+		fputs("Buffers: failed to allocate image memory.\n", stderr);
+		vkDestroyImage(device, *pImage, nullptr);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+	vkBindImageMemory(device, *pImage, *pMemory, 0);
+
+	return VK_SUCCESS;
+}
@@ -0,0 +1,30 @@
+#ifndef	BUFFERS_H
+#define	BUFFERS_H
+
+#include <vulkan/vulkan.h>
+
+VkResult 
+find_memory_type(VkPhysicalDevice physicalDevice, 
+		 uint32_t typeBits, 
+		 VkMemoryPropertyFlags properties, 
+		 uint32_t* pTypeIndex);
+
+VkResult 
+create_buffer(VkPhysicalDevice physicalDevice, 
+	      VkDevice device, 
+	      VkDeviceSize size, 
+	      VkBufferUsageFlags usage, 
+	      VkMemoryPropertyFlags properties, 
+	      VkBuffer* pBuffer, 
+	      VkDeviceMemory* pMemory);
+
+VkResult 
+create_image(VkPhysicalDevice physicalDevice, 
+	     VkDevice device, 
+	     VkExtent2D extent, 
+	     VkFormat format, 
+	     VkImageUsageFlags usage, 
+	     VkImage* pImage, 
+	     VkDeviceMemory* pMemory);
+
+#endif	/* BUFFERS_H */
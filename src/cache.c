@@ -0,0 +1,97 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+
+static int 
+make_directories(char* path) 
+{
+	for (char* p = path + 1; *p; ++p) {
+		if (*p != '/') { continue; }
+
+		*p = '\0';
+		int ret = mkdir(path, 0700);
+		*p = '/';
+		if (ret == -1 && errno != EEXIST) { return EXIT_FAILURE; }
+	}
+
+	if (mkdir(path, 0700) == -1 && errno != EEXIST) { return EXIT_FAILURE; }
+
+	return EXIT_SUCCESS;
+}
+
+/* Builds $XDG_CACHE_HOME/DEVideo/<subdir>/<name>, creating the directories. */
+int 
+get_cache_path(const char* subdir, const char* name, char* path, size_t size) 
+{
+	const char* base = getenv("XDG_CACHE_HOME");
+	const char* suffix = "";
+	if (!base || base[0] != '/') {
+		base = getenv("HOME");
+		suffix = "/.cache";
+		if (!base) { return EXIT_FAILURE; }
+	}
+
+	int len = snprintf(path, size, "%s%s/DEVideo/%s", base, suffix, subdir);
+	if (len < 0 || (size_t) len >= size) { return EXIT_FAILURE; }
+	if (make_directories(path) != EXIT_SUCCESS) { return EXIT_FAILURE; }
+
+	size_t used = (size_t) len;
+	len = snprintf(path + used, size - used, "/%s", name);
+	if (len < 0 || (size_t) len >= size - used) { return EXIT_FAILURE; }
+
+	return EXIT_SUCCESS;
+}
+
+int 
+read_cache_file(const char* path, uint8_t** pData, size_t* pSize) 
+{
+	int ret = EXIT_FAILURE;
+
+	struct stat st;
+	if (stat(path, &st) == -1 || st.st_size <= 0) { return ret; }
+
+	FILE* file = fopen(path, "rb");
+	if (!file) { return ret; }
+
+	*pData = malloc(st.st_size);
+	if (!*pData) { goto out; }
+
+	*pSize = fread(*pData, 1, st.st_size, file);
+	if (*pSize != (size_t) st.st_size) {
+		free(*pData);
+		*pData = nullptr;
+		*pSize = 0;
+		goto out;
+	}
+
+	ret = EXIT_SUCCESS;
+out:
+	fclose(file);
+	return ret;
+}
+
+/* Writes to a temporary file first, so readers never see a partial cache. */
+int 
+write_cache_file(const char* path, const void* pData, size_t size) 
+{
+	char tmpPath[4096];
+	int len = snprintf(tmpPath, sizeof(tmpPath), "%s.%ld.tmp", path, (long) getpid());
+	if (len < 0 || (size_t) len >= sizeof(tmpPath)) { return EXIT_FAILURE; }
+
+	FILE* file = fopen(tmpPath, "wb");
+	if (!file) { return EXIT_FAILURE; }
+
+	bool written = fwrite(pData, 1, size, file) == size;
+	if (fclose(file) != 0 || !written || rename(tmpPath, path) == -1) {
+		unlink(tmpPath);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
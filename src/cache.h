@@ -0,0 +1,16 @@
+#ifndef	CACHE_H
+#define	CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+int 
+get_cache_path(const char* subdir, const char* name, char* path, size_t size);
+
+int 
+read_cache_file(const char* path, uint8_t** pData, size_t* pSize);
+
+int 
+write_cache_file(const char* path, const void* pData, size_t size);
+
+#endif	/* CACHE_H */
@@ -1,8 +1,10 @@
 #include <assert.h>
+#include <errno.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <wayland-client.h>
 #include <sys/mman.h>
@@ -10,9 +12,26 @@
 #include <xkbcommon/xkbcommon.h>
 
 #include "client.h"
+#include "profiler.h"
 #include "renderer.h"
+#include "scheduler.h"
+#include "shm.h"
+#include "presentation-time-client-protocol.h"
 #include "xdg-shell-client-protocol.h"
 
+#define MAX_PENDING_FEEDBACK	8
+#define DEFAULT_WIDTH		800
+#define DEFAULT_HEIGHT		600
+#define SEEK_STEP_NS		10000000000ll
+
+/* Presentation feedback requested for a single frame */
+typedef struct FeedbackSlot {
+	struct wp_presentation_feedback*	pFeedback;
+	uint64_t				frameId;
+	uint64_t				submitNs;
+	uint64_t				requestNs;	/* When the redraw was asked for */
+} FeedbackSlot;
+
 /* Wayland client state */
 typedef struct WLState {
 	/* Globals */
@@ -21,18 +40,213 @@ typedef struct WLState {
 	struct wl_compositor*	pCompositor;
 	struct xdg_wm_base*	pXDGwmBase;
 	struct wl_seat*		pSeat;
+	struct wp_presentation*	pPresentation;
+	struct wl_shm*		pShm;
 	/* Objects */
 	struct wl_surface*	pSurface;
 	struct xdg_surface*	pXDGsurface;
 	struct xdg_toplevel*	pXDGtoplevel;
 	struct wl_keyboard*	pKeyboard;
+	struct wl_callback*	pFrameCallback;
+	FeedbackSlot		feedback[MAX_PENDING_FEEDBACK];
 	/* State */
 	struct xkb_state*	pXKBstate;
 	struct xkb_context*	pXKBcontext;
 	struct xkb_keymap*	pXKBkeymap;
+	bool			running;
+	bool			redraw;
+	bool			frameReady;
+	bool			rendererReady;
+	bool			software;	/* wl_shm buffers instead of Vulkan */
+	int32_t			width;
+	int32_t			height;
+	int32_t			pendingWidth;
+	int32_t			pendingHeight;
+	/* Frame timing */
+	clockid_t		presentClock;
+	uint64_t		frameCount;
+	uint64_t		lastMsc;
+	uint64_t		lastPresentNs;
+	uint64_t		redrawNs;	/* When the pending redraw was asked for */
+	FrameTiming		lastTiming;
+	FrameTimingHandler	timingHandler;
+	void*			pTimingData;
 } wlState;
 static wlState state;
 
+static uint64_t 
+clock_now_ns(clockid_t clock) 
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/* Remembers when a redraw was first asked for, so an idle window is not charged
+ * with missed frames. */
+static void 
+mark_redraw(wlState* pState) 
+{
+	if (!pState->redraw) { pState->redrawNs = clock_now_ns(pState->presentClock); }
+	pState->redraw = true;
+}
+
+/* Vblanks skipped before this presentation while the frame was wanted */
+static uint32_t 
+count_missed_frames(const wlState* pState, const FeedbackSlot* pSlot, const FrameTiming* pTiming) 
+{
+	if (!pState->lastMsc || pTiming->msc <= pState->lastMsc + 1) { return 0; }
+
+	uint64_t gap = pTiming->msc - pState->lastMsc - 1;
+	if (!pTiming->refreshNs) { return pSlot->requestNs <= pState->lastPresentNs ? (uint32_t) gap : 0; }
+
+	uint64_t since = pState->lastPresentNs;
+	if (pSlot->requestNs > since) { since = pSlot->requestNs; }
+	if (since >= pTiming->presentNs) { return 0; }
+
+	uint64_t wanted = (pTiming->presentNs - since) / pTiming->refreshNs;
+	return (uint32_t) (wanted < gap ? wanted : gap);
+}
+
+static void 
+wl_frame_done(void* pData, struct wl_callback* pCallback, uint32_t time) 
+{
+	wlState* pState = pData;
+
+	wl_callback_destroy(pCallback);
+	pState->pFrameCallback = nullptr;
+	pState->frameReady = true;
+}
+
+static const struct wl_callback_listener 
+wl_frame_listener = {
+	.done = wl_frame_done, 
+};
+
+static void 
+report_frame_timing(wlState* pState, const FrameTiming* pTiming) 
+{
+	pState->lastTiming = *pTiming;
+	if (pState->timingHandler) { pState->timingHandler(pTiming, pState->pTimingData); }
+}
+
+static void 
+wp_feedback_sync_output(void* pData, 
+			struct wp_presentation_feedback* pFeedback, 
+			struct wl_output* pOutput) 
+{
+	/* This space deliberately left blank. */
+}
+
+static void 
+wp_feedback_presented(void* pData, 
+		      struct wp_presentation_feedback* pFeedback, 
+		      uint32_t tv_sec_hi, 
+		      uint32_t tv_sec_lo, 
+		      uint32_t tv_nsec, 
+		      uint32_t refresh, 
+		      uint32_t seq_hi, 
+		      uint32_t seq_lo, 
+		      uint32_t flags) 
+{
+	FeedbackSlot* pSlot = pData;
+	uint64_t seconds = ((uint64_t) tv_sec_hi << 32) | tv_sec_lo;
+	uint64_t msc = ((uint64_t) seq_hi << 32) | seq_lo;
+
+	FrameTiming timing = { };
+	timing.frameId = pSlot->frameId;
+	timing.submitNs = pSlot->submitNs;
+	timing.presentNs = seconds * 1000000000ull + tv_nsec;
+	timing.refreshNs = refresh;
+	timing.msc = msc;
+	timing.flags = flags;
+	timing.missedFrames = count_missed_frames(&state, pSlot, &timing);
+	state.lastMsc = msc;
+	state.lastPresentNs = timing.presentNs;
+
+	wp_presentation_feedback_destroy(pFeedback);
+	pSlot->pFeedback = nullptr;
+
+	report_frame_timing(&state, &timing);
+}
+
+static void 
+wp_feedback_discarded(void* pData, struct wp_presentation_feedback* pFeedback) 
+{
+	FeedbackSlot* pSlot = pData;
+
+	FrameTiming timing = { };
+	timing.frameId = pSlot->frameId;
+	timing.submitNs = pSlot->submitNs;
+	timing.refreshNs = state.lastTiming.refreshNs;
+	timing.discarded = true;
+
+	wp_presentation_feedback_destroy(pFeedback);
+	pSlot->pFeedback = nullptr;
+
+	report_frame_timing(&state, &timing);
+}
+
+static const struct wp_presentation_feedback_listener 
+wp_feedback_listener = {
+	.sync_output = wp_feedback_sync_output, 
+	.presented = wp_feedback_presented, 
+	.discarded = wp_feedback_discarded, 
+};
+
+static void 
+wp_presentation_clock_id(void* pData, 
+			 struct wp_presentation* pPresentation, 
+			 uint32_t clk_id) 
+{
+	wlState* pState = pData;
+	pState->presentClock = clk_id;
+}
+
+static const struct wp_presentation_listener 
+wp_presentation_listener = {
+	.clock_id = wp_presentation_clock_id, 
+};
+
+static void 
+request_frame_feedback(wlState* pState) 
+{
+	pState->pFrameCallback = wl_surface_frame(pState->pSurface);
+	wl_callback_add_listener(pState->pFrameCallback, &wl_frame_listener, pState);
+	pState->frameReady = false;
+
+	++pState->frameCount;
+	if (!pState->pPresentation) { return; }
+
+	/* The oldest slot is reused if the compositor never answered it. */
+	FeedbackSlot* pSlot = &pState->feedback[pState->frameCount % MAX_PENDING_FEEDBACK];
+	if (pSlot->pFeedback) { wp_presentation_feedback_destroy(pSlot->pFeedback); }
+
+	pSlot->frameId = pState->frameCount;
+	pSlot->submitNs = clock_now_ns(pState->presentClock);
+	pSlot->requestNs = pState->redrawNs;
+	pSlot->pFeedback = wp_presentation_feedback(pState->pPresentation, pState->pSurface);
+	wp_presentation_feedback_add_listener(pSlot->pFeedback, &wp_feedback_listener, pSlot);
+}
+
+static void 
+cancel_frame_feedback(wlState* pState) 
+{
+	if (pState->pFrameCallback) {
+		wl_callback_destroy(pState->pFrameCallback);
+		pState->pFrameCallback = nullptr;
+	}
+	pState->frameReady = true;
+
+	if (!pState->pPresentation) { return; }
+
+	FeedbackSlot* pSlot = &pState->feedback[pState->frameCount % MAX_PENDING_FEEDBACK];
+	if (pSlot->pFeedback) {
+		wp_presentation_feedback_destroy(pSlot->pFeedback);
+		pSlot->pFeedback = nullptr;
+	}
+}
+
 static void 
 xdg_surface_configure(void* pData, 
 		      struct xdg_surface* pXDG_surface, 
@@ -41,7 +255,21 @@ xdg_surface_configure(void* pData,
 	wlState* pState = pData;
 
 	xdg_surface_ack_configure(pXDG_surface, serial);
-	wl_surface_commit(pState->pSurface);
+
+	bool resized = pState->pendingWidth != pState->width || 
+			pState->pendingHeight != pState->height;
+	if (pState->pendingWidth > 0 && pState->pendingHeight > 0 && resized) {
+		pState->width = pState->pendingWidth;
+		pState->height = pState->pendingHeight;
+		if (pState->rendererReady && pState->software) {
+			resize_shm_presenter(pState->width, pState->height);
+		} else if (pState->rendererReady) {
+			resize_renderer(pState->width, pState->height);
+		}
+	}
+
+	if (!pState->rendererReady) { wl_surface_commit(pState->pSurface); }
+	mark_redraw(pState);
 }
 
 static const struct xdg_surface_listener 
@@ -49,6 +277,60 @@ xdg_surface_listener = {
 	.configure = xdg_surface_configure, 
 };
 
+static void 
+xdg_toplevel_configure(void* pData, 
+		       struct xdg_toplevel* pXDG_toplevel, 
+		       int32_t width, 
+		       int32_t height, 
+		       struct wl_array* states) 
+{
+	wlState* pState = pData;
+
+	/* Zero means the client picks its own size; keep the current one. */
+	pState->pendingWidth = width ? width : pState->width;
+	pState->pendingHeight = height ? height : pState->height;
+}
+
+static void 
+xdg_toplevel_close(void* pData, struct xdg_toplevel* pXDG_toplevel) 
+{
+	wlState* pState = pData;
+	pState->running = false;
+}
+
+#ifdef	XDG_TOPLEVEL_CONFIGURE_BOUNDS_SINCE_VERSION
+static void 
+xdg_toplevel_configure_bounds(void* pData, 
+			      struct xdg_toplevel* pXDG_toplevel, 
+			      int32_t width, 
+			      int32_t height) 
+{
+	/* This space deliberately left blank. */
+}
+#endif
+
+#ifdef	XDG_TOPLEVEL_WM_CAPABILITIES_SINCE_VERSION
+static void 
+xdg_toplevel_wm_capabilities(void* pData, 
+			     struct xdg_toplevel* pXDG_toplevel, 
+			     struct wl_array* capabilities) 
+{
+	/* This space deliberately left blank. */
+}
+#endif
+
+static const struct xdg_toplevel_listener 
+xdg_toplevel_listener = {
+	.configure = xdg_toplevel_configure, 
+	.close = xdg_toplevel_close, 
+#ifdef	XDG_TOPLEVEL_CONFIGURE_BOUNDS_SINCE_VERSION
+	.configure_bounds = xdg_toplevel_configure_bounds, 
+#endif
+#ifdef	XDG_TOPLEVEL_WM_CAPABILITIES_SINCE_VERSION
+	.wm_capabilities = xdg_toplevel_wm_capabilities, 
+#endif
+};
+
 static void 
 xdg_wm_base_ping(void* pData, struct xdg_wm_base* pXDG_wm_base, uint32_t serial) 
 {
@@ -112,7 +394,13 @@ wl_keyboard_key(void* pData,
 	uint32_t keycode = key + 8;
 	xkb_keysym_t sym = xkb_state_key_get_one_sym(pState->pXKBstate, keycode);
 	if (sym == XKB_KEY_q) {
-		close_client();
+		pState->running = false;
+	}
+
+	if (state != WL_KEYBOARD_KEY_STATE_PRESSED) { return; }
+	if (sym == XKB_KEY_Left || sym == XKB_KEY_Right) {
+		seek_relative(sym == XKB_KEY_Left ? -SEEK_STEP_NS : SEEK_STEP_NS);
+		request_redraw();
 	}
 }
 
@@ -221,6 +509,16 @@ registry_handle_global(void* pData,
 						   &wl_seat_interface, 
 						   version);
 		wl_seat_add_listener(pState->pSeat, &wl_seat_listener, pState);
+	} else if (strcmp(pInterface, wp_presentation_interface.name) == 0) {
+		pState->pPresentation = wl_registry_bind(pRegistry, 
+							   name, 
+							   &wp_presentation_interface, 
+							   1);
+		wp_presentation_add_listener(pState->pPresentation, 
+					       &wp_presentation_listener, 
+					       pState);
+	} else if (strcmp(pInterface, wl_shm_interface.name) == 0) {
+		pState->pShm = wl_registry_bind(pRegistry, name, &wl_shm_interface, 1);
 	}
 }
 
@@ -239,20 +537,27 @@ registry_listener = {
 };
 
 int 
-init_client(void) 
+init_client(bool software) 
 {
 	/* Display */
+	int span = profile_begin("wl_display_connect");
 	state.pDisplay = wl_display_connect(nullptr);
+	profile_end(span);
 	if (!state.pDisplay) {
 		fputs("Failed to connect to a Wayland display.\n", stderr);
 		return EXIT_FAILURE;
 	}
 
 	/* Registry */
+	state.presentClock = CLOCK_MONOTONIC;
+	state.width = state.pendingWidth = DEFAULT_WIDTH;
+	state.height = state.pendingHeight = DEFAULT_HEIGHT;
 	state.pRegistry = wl_display_get_registry(state.pDisplay);
 	state.pXKBcontext = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
 	wl_registry_add_listener(state.pRegistry, &registry_listener, &state);
+	span = profile_begin("registry roundtrip");
 	wl_display_roundtrip(state.pDisplay);
+	profile_end(span);
 
 	/* Surfaces */
 	state.pSurface = wl_compositor_create_surface(state.pCompositor);
@@ -261,13 +566,87 @@ init_client(void)
 	xdg_surface_add_listener(state.pXDGsurface, &xdg_surface_listener, &state);
 
 	state.pXDGtoplevel = xdg_surface_get_toplevel(state.pXDGsurface);
+	xdg_toplevel_add_listener(state.pXDGtoplevel, &xdg_toplevel_listener, &state);
 	xdg_toplevel_set_title(state.pXDGtoplevel, "DEVideo");
 	wl_surface_commit(state.pSurface);
+	span = profile_begin("configure roundtrip");
 	wl_display_roundtrip(state.pDisplay);
+	profile_end(span);
+
+	if (software) {
+		if (init_shm_presenter(state.pShm, 
+				       state.pSurface, 
+				       state.width, 
+				       state.height) != EXIT_SUCCESS) { return EXIT_FAILURE; }
+	} else if (init_renderer("DEVideo", 
+		   		 state.pDisplay, 
+		   		 state.pSurface, 
+		   		 state.width, 
+		   		 state.height) != EXIT_SUCCESS) { return EXIT_FAILURE; }
+	state.software = software;
+	state.rendererReady = true;
+
+	state.running = true;
+	mark_redraw(&state);
+	state.frameReady = true;
+
+	return EXIT_SUCCESS;
+}
+
+int 
+get_client_fd(void) 
+{
+	return wl_display_get_fd(state.pDisplay);
+}
+
+bool 
+client_running(void) 
+{
+	return state.running;
+}
+
+bool 
+client_has_work(void) 
+{
+	return (state.redraw && state.frameReady) || !state.running;
+}
+
+void 
+request_redraw(void) 
+{
+	mark_redraw(&state);
+}
+
+int 
+prepare_client_read(bool* pFlushed) 
+{
+	while (wl_display_prepare_read(state.pDisplay) != 0) {
+		if (wl_display_dispatch_pending(state.pDisplay) == -1) { return EXIT_FAILURE; }
+	}
+
+	/* EAGAIN: the socket is full, the caller waits for it to be writable. */
+	*pFlushed = true;
+	if (wl_display_flush(state.pDisplay) == -1) {
+		if (errno != EAGAIN) {
+			wl_display_cancel_read(state.pDisplay);
+			return EXIT_FAILURE;
+		}
+		*pFlushed = false;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int 
+read_client_events(bool readable) 
+{
+	if (readable) {
+		if (wl_display_read_events(state.pDisplay) == -1) { return EXIT_FAILURE; }
+	} else {
+		wl_display_cancel_read(state.pDisplay);
+	}
 
-	if (init_renderer("DEVideo", 
-		   	state.pDisplay, 
-		   	state.pSurface) != EXIT_SUCCESS) { return EXIT_FAILURE; }
+	if (wl_display_dispatch_pending(state.pDisplay) == -1) { return EXIT_FAILURE; }
 
 	return EXIT_SUCCESS;
 }
@@ -275,14 +654,55 @@ init_client(void)
 void 
 update_client(void) 
 {
-	render_surface();
-	wl_display_dispatch(state.pDisplay);
+	/* Render only when there is something new and the compositor wants a frame. */
+	if (!state.redraw || !state.frameReady) { return; }
+
+	state.redraw = false;
+	request_frame_feedback(&state);
+	int ret = state.software ? present_shm_frame() : render_surface();
+	if (ret != EXIT_SUCCESS) { cancel_frame_feedback(&state); }
+}
+
+void 
+set_frame_timing_handler(FrameTimingHandler handler, void* pData) 
+{
+	state.timingHandler = handler;
+	state.pTimingData = pData;
+}
+
+bool 
+get_frame_timing(FrameTiming* pTiming) 
+{
+	if (!state.lastTiming.frameId) { return false; }
+
+	*pTiming = state.lastTiming;
+	return true;
+}
+
+clockid_t 
+get_presentation_clock(void) 
+{
+	return state.presentClock;
 }
 
 void 
 close_client(void) 
 {
-	close_renderer();
+	if (state.software) {
+		close_shm_presenter();
+	} else {
+		close_renderer();
+	}
+
+	cancel_frame_feedback(&state);
+	for (size_t i = 0; i < MAX_PENDING_FEEDBACK; ++i) {
+		if (state.feedback[i].pFeedback) {
+			wp_presentation_feedback_destroy(state.feedback[i].pFeedback);
+			state.feedback[i].pFeedback = nullptr;
+		}
+	}
+	if (state.pPresentation) { wp_presentation_destroy(state.pPresentation); }
+	if (state.pShm) { wl_shm_destroy(state.pShm); }
 
 	xdg_toplevel_destroy(state.pXDGtoplevel);
 	xdg_surface_destroy(state.pXDGsurface);
@@ -1,12 +1,56 @@
 #ifndef	CLIENT_H
 #define	CLIENT_H
 
+#include <stdint.h>
+#include <time.h>
+
+/* Presentation timing of a single frame, as reported by wp_presentation */
+typedef struct FrameTiming {
+	uint64_t	frameId;	/* Sequence number of the rendered frame. */
+	uint64_t	submitNs;	/* When the frame was handed to the renderer. */
+	uint64_t	presentNs;	/* When the frame turned into light. */
+	uint32_t	refreshNs;	/* Output refresh interval, 0 if unknown. */
+	uint64_t	msc;		/* Output vblank counter at presentation. */
+	uint32_t	missedFrames;	/* Refresh cycles skipped while this frame was pending. */
+	uint32_t	flags;		/* wp_presentation_feedback kind flags. */
+	bool		discarded;	/* The frame was never shown. */
+} FrameTiming;
+
+typedef void (*FrameTimingHandler)(const FrameTiming* pTiming, void* pData);
+
+int 
+init_client(bool software);
+
 int 
-init_client(void);
+get_client_fd(void);
+
+bool 
+client_running(void);
+
+bool 
+client_has_work(void);
+
+void 
+request_redraw(void);
+
+int 
+prepare_client_read(bool* pFlushed);
+
+int 
+read_client_events(bool readable);
 
 void 
 update_client(void);
 
+void 
+set_frame_timing_handler(FrameTimingHandler handler, void* pData);
+
+bool 
+get_frame_timing(FrameTiming* pTiming);
+
+clockid_t 
+get_presentation_clock(void);
+
 void
 close_client(void);
 
@@ -1,37 +1,453 @@
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+
+#include <libavutil/mathematics.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <unistd.h>
 
 #include "client.h"
 #include "controller.h"
+#include "decoder.h"
+#include "encoder.h"
+#include "profiler.h"
+#include "renderer.h"
+#include "scheduler.h"
 
-int
-init_controller(void) 
+#define MAX_EVENT_SOURCES	16
+#define DISPLAY_SOURCE		UINT32_MAX
+/* Frames between submission and readback; more than can be in flight */
+#define PTS_RING_SIZE		(READBACK_SLOTS * 2)
+
+/* File descriptors watched by the main loop besides the Wayland display */
+typedef struct EventSource {
+	int		fd;
+	EventHandler	handler;
+	void*		pData;
+} EventSource;
+static EventSource sources[MAX_EVENT_SOURCES];
+
+static int epollFd = -1;
+static int displayFd = -1;
+static bool displayWritable = true;
+
+int 
+add_event_source(int fd, EventHandler handler, void* pData) 
 {
-	if (init_client() == EXIT_FAILURE) {
-		fputs("Failed to initialize client!\n", stderr);
+	for (uint32_t i = 0; i < MAX_EVENT_SOURCES; ++i) {
+		if (sources[i].handler) { continue; }
+
+		struct epoll_event event = { };
+		event.events = EPOLLIN;
+		event.data.u32 = i;
+		if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == -1) {
+			perror("Controller: failed to watch event source");
+			return EXIT_FAILURE;
+		}
+
+		sources[i].fd = fd;
+		sources[i].handler = handler;
+		sources[i].pData = pData;
+		return EXIT_SUCCESS;
+	}
+
+	fputs("Controller: too many event sources.\n", stderr);
+	return EXIT_FAILURE;
+}
+
+void 
+remove_event_source(int fd) 
+{
+	for (uint32_t i = 0; i < MAX_EVENT_SOURCES; ++i) {
+		if (!sources[i].handler || sources[i].fd != fd) { continue; }
+
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+		sources[i].fd = -1;
+		sources[i].handler = nullptr;
+		sources[i].pData = nullptr;
+		return;
+	}
+}
+
+static int 
+watch_display(bool writable) 
+{
+	struct epoll_event event = { };
+	event.events = writable ? EPOLLIN : EPOLLIN | EPOLLOUT;
+	event.data.u32 = DISPLAY_SOURCE;
+
+	int op = (displayFd == -1) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+	if (epoll_ctl(epollFd, op, get_client_fd(), &event) == -1) {
+		perror("Controller: failed to watch the Wayland display");
 		return EXIT_FAILURE;
 	}
 
+	displayFd = get_client_fd();
+	displayWritable = writable;
 	return EXIT_SUCCESS;
 }
 
 void
 close_app(void) 
 {
+	/* The renderer gives back its frames before the decoder goes away. */
 	close_client();
+	if (get_decoder_fd() != -1) {
+		uint64_t dropped, repeated;
+		get_scheduler_stats(&dropped, &repeated);
+		fprintf(stderr, 
+			"Video: %llu frames dropped, %llu repeated.\n", 
+			(unsigned long long) dropped, 
+			(unsigned long long) repeated);
+
+		remove_event_source(get_decoder_fd());
+	}
+	close_decoder();
+
+	if (epollFd != -1) {
+		close(epollFd);
+		epollFd = -1;
+	}
 }
 
-int 
-run_app(void) 
+static void 
+on_decoded_frame(void* pData) 
 {
-	if (init_controller() != EXIT_SUCCESS) { return EXIT_FAILURE; }
+	(void) pData;
 
-	for(;;) {
-		update_client();
+	drain_decoder_events();
+	request_redraw();
+}
+
+static int 
+init_video(const char* input) 
+{
+	int span = profile_begin("open_decoder");
+	int ret = open_decoder(input);
+	profile_end(span);
+	if (ret != EXIT_SUCCESS) { return EXIT_FAILURE; }
+
+	if (add_event_source(get_decoder_fd(), on_decoded_frame, nullptr) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
 	}
 
-	close_app();
+	return start_decoder();
+}
+
+int
+init_controller(const AppOptions* pOptions) 
+{
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (epollFd == -1) {
+		perror("Controller: failed to create the event loop");
+		return EXIT_FAILURE;
+	}
+
+	/* Vulkan does not need the compositor until the surface is created. */
+	if (!pOptions->shm) { start_renderer("DEVideo"); }
+
+	int span = profile_begin("init_client");
+	if (init_client(pOptions->shm) == EXIT_FAILURE) {
+		fputs("Failed to initialize client!\n", stderr);
+		cancel_renderer();
+		return EXIT_FAILURE;
+	}
+	profile_end(span);
+
+	if (watch_display(true) != EXIT_SUCCESS) { return EXIT_FAILURE; }
+
+	if (pOptions->input && init_video(pOptions->input) != EXIT_SUCCESS) {
+		fputs("Failed to open the video!\n", stderr);
+		close_app();
+		return EXIT_FAILURE;
+	}
 
 	return EXIT_SUCCESS;
 }
 
+static int 
+run_event_loop(void) 
+{
+	struct epoll_event events[MAX_EVENT_SOURCES + 1];
+
+	while (client_running()) {
+		update_client();
+		/* Present every vblank while frames wait, the scheduler picks the one due. */
+		if (decoder_pending()) { request_redraw(); }
+
+		bool flushed;
+		if (prepare_client_read(&flushed) != EXIT_SUCCESS) { return EXIT_FAILURE; }
+		if (flushed != displayWritable && watch_display(flushed) != EXIT_SUCCESS) {
+			read_client_events(false);
+			return EXIT_FAILURE;
+		}
+
+		/* Events dispatched while preparing may already need a frame. */
+		int timeout = client_has_work() ? 0 : -1;
+		int count = epoll_wait(epollFd, events, MAX_EVENT_SOURCES + 1, timeout);
+		if (count == -1 && errno != EINTR) {
+			perror("Controller: failed to wait for events");
+			read_client_events(false);
+			return EXIT_FAILURE;
+		}
+
+		bool readable = false;
+		for (int i = 0; i < count; ++i) {
+			uint32_t index = events[i].data.u32;
+			if (index == DISPLAY_SOURCE) {
+				readable = events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP);
+				continue;
+			}
+
+			EventSource* pSource = &sources[index];
+			if (pSource->handler) { pSource->handler(pSource->pData); }
+		}
+
+		if (read_client_events(readable) != EXIT_SUCCESS) {
+			fputs("Controller: lost the connection to the compositor.\n", stderr);
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/* Running FNV-1a hash of every frame read back in headless mode */
+typedef struct ReadbackStats {
+	uint64_t	frames;
+	uint64_t	checksum;
+} ReadbackStats;
+
+static void 
+hash_frame(const ReadbackFrame* pFrame, void* pData) 
+{
+	ReadbackStats* pStats = pData;
+
+	uint64_t hash = pStats->checksum;
+	for (uint32_t y = 0; y < pFrame->height; ++y) {
+		const uint8_t* pRow = pFrame->pPixels + (size_t) y * pFrame->stride;
+		for (uint32_t x = 0; x < pFrame->width * 4; ++x) {
+			hash = (hash ^ pRow[x]) * 0x100000001b3ull;
+		}
+	}
+	pStats->checksum = hash;
+	++pStats->frames;
+	readback_release(pFrame->slot);
+}
+
+static int 
+run_headless(const AppOptions* pOptions) 
+{
+	if (init_renderer_headless("DEVideo",
+				   pOptions->width,
+				   pOptions->height,
+				   pOptions->readback) != EXIT_SUCCESS) {
+		fputs("Failed to initialize the headless renderer!\n", stderr);
+		return EXIT_FAILURE;
+	}
+	profile_report();
+
+	ReadbackStats stats = { 0, 0xcbf29ce484222325ull };
+	if (pOptions->readback) { set_frame_readback(hash_frame, &stats); }
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	int ret = EXIT_SUCCESS;
+	for (uint32_t i = 0; i < pOptions->frames && ret == EXIT_SUCCESS; ++i) {
+		ret = render_surface();
+	}
+	finish_rendering();
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double elapsed = (double) (end.tv_sec - start.tv_sec) +
+			 (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	printf("Headless: %u frames at %ux%u in %.3f s (%.1f fps)\n",
+	       pOptions->frames,
+	       pOptions->width,
+	       pOptions->height,
+	       elapsed,
+	       elapsed > 0.0 ? pOptions->frames / elapsed : 0.0);
+	if (pOptions->readback) {
+		printf("Headless: %llu frames read back, checksum %016llx\n",
+		       (unsigned long long) stats.frames,
+		       (unsigned long long) stats.checksum);
+	}
+
+	close_renderer();
+
+	return ret;
+}
+
+/* Read backs carry the sequence number of the frame they were copied from. */
+typedef struct TranscodeState {
+	int64_t		pts[PTS_RING_SIZE];
+	uint64_t	submitted;
+	uint64_t	encoded;
+	bool		failed;
+} TranscodeState;
+
+static void 
+encode_readback(const ReadbackFrame* pFrame, void* pData) 
+{
+	TranscodeState* pState = pData;
+
+	int64_t pts = pState->pts[pFrame->sequence % PTS_RING_SIZE];
+	++pState->encoded;
+	if (encode_readback_frame(pFrame, pts) != EXIT_SUCCESS) { pState->failed = true; }
+}
+
+static int64_t 
+get_frame_pts(const AVFrame* pFrame, uint64_t index) 
+{
+	if (pFrame->best_effort_timestamp != AV_NOPTS_VALUE) { return pFrame->best_effort_timestamp; }
+	if (pFrame->pts != AV_NOPTS_VALUE) { return pFrame->pts; }
+
+	/* Untimed streams are numbered at the nominal rate. */
+	AVRational frameRate = get_frame_rate();
+	if (!frameRate.num || !frameRate.den) { frameRate = (AVRational) { 25, 1 }; }
+	return av_rescale_q((int64_t) index, av_inv_q(frameRate), get_time_base());
+}
+
+/* Blocks until the decoder queued a frame or reached the end of the input. */
+static void 
+wait_for_decoder(void) 
+{
+	struct pollfd pfd = { get_decoder_fd(), POLLIN, 0 };
+	if (poll(&pfd, 1, -1) > 0) { drain_decoder_events(); }
+}
+
+/* The next decoded frame, or nullptr once the decoder finished and nothing is left */
+static AVFrame* 
+next_frame(void) 
+{
+	for (;;) {
+		AVFrame* pFrame = acquire_frame();
+		if (pFrame) { return pFrame; }
+
+		/* The last frames may have been queued just before the decoder finished. */
+		if (decoder_finished()) { return acquire_frame(); }
+		wait_for_decoder();
+	}
+}
+
+/* Decode, render offscreen and encode run on their own threads. The decoder frame 
+ * pool, the frames in flight and the readback slots bound each hand-off, so no stage 
+ * runs ahead of the next by more than a few frames. */
+static int 
+run_transcode(const AppOptions* pOptions) 
+{
+	int span = profile_begin("open_decoder");
+	int ret = open_decoder(pOptions->input);
+	profile_end(span);
+	if (ret != EXIT_SUCCESS || start_decoder() != EXIT_SUCCESS) {
+		fputs("Failed to open the video!\n", stderr);
+		close_decoder();
+		return EXIT_FAILURE;
+	}
+
+	/* The codec only knows the frame size for sure once it decoded a frame. */
+	AVFrame* pFrame = next_frame();
+	if (!pFrame) {
+		fputs("Transcode: the input has no video frames.\n", stderr);
+		close_decoder();
+		return EXIT_FAILURE;
+	}
+
+	/* Scaled output is rendered 1:1. 4:2:0 encoders need even dimensions. */
+	uint32_t width = pOptions->scaleWidth;
+	uint32_t height = pOptions->scaleHeight;
+	if (!width || !height) {
+		width = (uint32_t) pFrame->width;
+		height = (uint32_t) pFrame->height;
+	}
+	width &= ~1u;
+	height &= ~1u;
+
+	if (init_renderer_headless("DEVideo", width, height, true) != EXIT_SUCCESS) {
+		fputs("Failed to initialize the headless renderer!\n", stderr);
+		release_frame(pFrame);
+		close_decoder();
+		return EXIT_FAILURE;
+	}
+	if (open_encoder(pOptions->output, 
+			 width, 
+			 height, 
+			 get_time_base(), 
+			 get_frame_rate()) != EXIT_SUCCESS) {
+		fputs("Failed to open the output!\n", stderr);
+		release_frame(pFrame);
+		close_encoder();
+		close_renderer();
+		close_decoder();
+		return EXIT_FAILURE;
+	}
+	profile_report();
+
+	TranscodeState state = { };
+	set_frame_readback(encode_readback, &state);
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (pFrame) {
+		/* Every frame must be read back, so wait for the encoder instead of dropping. */
+		wait_for_readback_slot();
+		state.pts[state.submitted % PTS_RING_SIZE] = get_frame_pts(pFrame, state.submitted);
+		++state.submitted;
+		ret = render_frame(pFrame);
+		if (ret != EXIT_SUCCESS) {
+			fputs("Transcode: failed to render a frame.\n", stderr);
+			break;
+		}
+		if (state.failed) { break; }
+
+		pFrame = next_frame();
+	}
+	finish_rendering();
+
+	/* The encoder reads from the readback ring, and the renderer gives back its 
+	 * frames before the decoder goes away. */
+	if (close_encoder() != EXIT_SUCCESS || state.failed) { ret = EXIT_FAILURE; }
+	close_renderer();
+	close_decoder();
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double elapsed = (double) (end.tv_sec - start.tv_sec) + 
+			 (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	/* stdout may carry the Y4M stream itself. */
+	fprintf(stderr, 
+		"Transcode: %llu frames at %ux%u in %.3f s (%.1f fps)\n", 
+		(unsigned long long) state.encoded, 
+		width, 
+		height, 
+		elapsed, 
+		elapsed > 0.0 ? state.encoded / elapsed : 0.0);
+
+	return ret;
+}
+
+int 
+run_app(const AppOptions* pOptions) 
+{
+	if (pOptions->scaleWidth && pOptions->scaleHeight) {
+		set_video_scale(pOptions->scaleWidth, pOptions->scaleHeight, pOptions->scaleFilter);
+	}
+
+	if (pOptions->transcode) { return run_transcode(pOptions); }
+	if (pOptions->headless) { return run_headless(pOptions); }
+
+	if (init_controller(pOptions) != EXIT_SUCCESS) { return EXIT_FAILURE; }
+	profile_report();
+
+	int ret = run_event_loop();
+
+	close_app();
+
+	return ret;
+}
@@ -1,7 +1,37 @@
 #ifndef	CONTROLLER_H
 #define	CONTROLLER_H
 
+#include <stdint.h>
+
+#include "scaler.h"
+
+/* Command line options */
+typedef struct AppOptions {
+	bool		headless;	/* Render offscreen, without a compositor. */
+	bool		readback;	/* Copy offscreen frames back to host memory. */
+	bool		shm;		/* Present through wl_shm buffers, without Vulkan. */
+	uint32_t	frames;		/* Frames to render in headless mode. */
+	uint32_t	width;
+	uint32_t	height;
+	bool		transcode;	/* Render input into output, without a compositor. */
+	const char*	input;		/* Video file to play, if any. */
+	const char*	output;		/* Transcode destination */
+	uint32_t	scaleWidth;	/* Video is resampled to this size, if set. */
+	uint32_t	scaleHeight;
+	ScaleFilter	scaleFilter;
+} AppOptions;
+
+/* Called from the main loop when its file descriptor becomes readable. Handlers
+ * run while a Wayland read is prepared, so they must not render or dispatch. */
+typedef void (*EventHandler)(void* pData);
+
+int 
+add_event_source(int fd, EventHandler handler, void* pData);
+
+void 
+remove_event_source(int fd);
+
 int
-run_app(void);
+run_app(const AppOptions* pOptions);
 
 #endif	/* CONTROLLER_H */
@@ -0,0 +1,264 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+
+#include "convert.h"
+
+/* 14 bit chroma value of a zero color difference */
+#define CHROMA_BIAS	8192
+/* Fixed point coefficients carry 3 fractional bits of the 8 bit result. */
+#define COEFFICIENT_ONE	8192.0f
+
+typedef struct ConvertKernel {
+	const char*		name;
+	ConvertRowKernel	convert;
+} ConvertKernel;
+
+static ConvertKernel kernel = { "scalar", convert_row_scalar };
+static once_flag kernelOnce = ONCE_FLAG_INIT;
+
+static inline int16_t 
+mulhi(int32_t a, int32_t b) 
+{
+	return (int16_t) ((a * b) >> 16);
+}
+
+static inline uint8_t 
+saturate(int32_t value) 
+{
+	value >>= 3;
+	return value < 0 ? 0 : value > 255 ? 255 : (uint8_t) value;
+}
+
+static inline uint16_t 
+read_u16(const uint8_t* pData, size_t index) 
+{
+	uint16_t value;
+	memcpy(&value, pData + index * 2, sizeof(value));
+	return value;
+}
+
+/* 14 bit luma of output pixel x */
+static inline int32_t 
+load_luma(const ConvertRow* pRow, uint32_t x) 
+{
+	if (!pRow->half) {
+		return pRow->format == CONVERT_P010 ? 
+			read_u16(pRow->pLuma[0], x) >> 2 : 
+			pRow->pLuma[0][x] << 6;
+	}
+
+	int32_t sum = 0;
+	for (size_t r = 0; r < 2; ++r) {
+		for (uint32_t i = 2 * x; i < 2 * x + 2; ++i) {
+			sum += pRow->format == CONVERT_P010 ? 
+				read_u16(pRow->pLuma[r], i) >> 2 : 
+				pRow->pLuma[r][i] << 6;
+		}
+	}
+
+	return sum >> 2;
+}
+
+static inline void 
+load_chroma(const ConvertRow* pRow, uint32_t x, int32_t* pU, int32_t* pV) 
+{
+	uint32_t c = pRow->half ? x : x >> 1;
+	switch (pRow->format) {
+	case CONVERT_NV12:
+		*pU = pRow->pChroma[0][2 * c] << 6;
+		*pV = pRow->pChroma[0][2 * c + 1] << 6;
+		break;
+	case CONVERT_I420:
+		*pU = pRow->pChroma[0][c] << 6;
+		*pV = pRow->pChroma[1][c] << 6;
+		break;
+	case CONVERT_P010:
+		*pU = read_u16(pRow->pChroma[0], 2 * c) >> 2;
+		*pV = read_u16(pRow->pChroma[0], 2 * c + 1) >> 2;
+		break;
+	}
+
+	*pU -= CHROMA_BIAS;
+	*pV -= CHROMA_BIAS;
+}
+
+/* The reference every vector kernel must match bit for bit; they also use it for
+ * the pixels left over after their last full vector. */
+void 
+convert_pixels_scalar(const ConvertRow* pRow, 
+		      const ConvertCoefficients* pCoefficients, 
+		      uint32_t first) 
+{
+	const ConvertCoefficients* c = pCoefficients;
+
+	for (uint32_t x = first; x < pRow->width; ++x) {
+		int32_t u = 0, v = 0;
+		load_chroma(pRow, x, &u, &v);
+		int32_t luma = mulhi(load_luma(pRow, x) - c->yOffset, c->yScale) + 4;
+
+		uint8_t* pPixel = pRow->pOutput + (size_t) x * 4;
+		pPixel[0] = saturate(luma + mulhi(c->swapChroma ? u : v, c->first));
+		pPixel[1] = saturate(luma + mulhi(u, c->greenU) + mulhi(v, c->greenV));
+		pPixel[2] = saturate(luma + mulhi(c->swapChroma ? v : u, c->last));
+		pPixel[3] = 255;
+	}
+}
+
+void 
+convert_row_scalar(const ConvertRow* pRow, const ConvertCoefficients* pCoefficients) 
+{
+	convert_pixels_scalar(pRow, pCoefficients, 0);
+}
+
+static void 
+pick_kernel(void) 
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512bw")) {
+		kernel = (ConvertKernel) { "avx512", convert_row_avx512 };
+	} else if (__builtin_cpu_supports("avx2")) {
+		kernel = (ConvertKernel) { "avx2", convert_row_avx2 };
+	} else if (__builtin_cpu_supports("sse4.1")) {
+		kernel = (ConvertKernel) { "sse4.1", convert_row_sse41 };
+	}
+#endif
+
+	/* For comparing against the reference on the same host */
+	if (getenv("DEVIDEO_SCALAR_CONVERT")) {
+		kernel = (ConvertKernel) { "scalar", convert_row_scalar };
+	}
+}
+
+static bool 
+find_format(enum AVPixelFormat pixelFormat, ConvertFormat* pFormat) 
+{
+	switch (pixelFormat) {
+	case AV_PIX_FMT_NV12:
+		*pFormat = CONVERT_NV12;
+		return true;
+	case AV_PIX_FMT_YUV420P:
+	case AV_PIX_FMT_YUVJ420P:
+		*pFormat = CONVERT_I420;
+		return true;
+	case AV_PIX_FMT_P010LE:
+		*pFormat = CONVERT_P010;
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool 
+is_convertible(enum AVPixelFormat pixelFormat) 
+{
+	ConvertFormat format;
+	return find_format(pixelFormat, &format);
+}
+
+/* Same matrices as the fragment shader's conversion. */
+static void 
+compute_coefficients(const AVFrame* pFrame, PixelOrder order, ConvertCoefficients* pCoefficients) 
+{
+	float kr, kb;
+	switch (pFrame->colorspace) {
+	case AVCOL_SPC_BT2020_NCL:
+	case AVCOL_SPC_BT2020_CL:
+		kr = 0.2627f;
+		kb = 0.0593f;
+		break;
+	case AVCOL_SPC_BT709:
+		kr = 0.2126f;
+		kb = 0.0722f;
+		break;
+	case AVCOL_SPC_BT470BG:
+	case AVCOL_SPC_SMPTE170M:
+		kr = 0.299f;
+		kb = 0.114f;
+		break;
+	default:
+		/* Untagged streams: HD is almost always BT.709, SD BT.601. */
+		kr = (pFrame->height >= 720) ? 0.2126f : 0.299f;
+		kb = (pFrame->height >= 720) ? 0.0722f : 0.114f;
+		break;
+	}
+	float kg = 1.0f - kr - kb;
+
+	float lumaScale = 1.0f;
+	float chromaScale = 1.0f;
+	int16_t yOffset = 0;
+	if (pFrame->color_range != AVCOL_RANGE_JPEG && pFrame->format != AV_PIX_FMT_YUVJ420P) {
+		lumaScale = 255.0f / 219.0f;
+		chromaScale = 255.0f / 224.0f;
+		yOffset = 16 << 6;
+	}
+
+	float red = 2.0f * (1.0f - kr) * chromaScale;
+	float blue = 2.0f * (1.0f - kb) * chromaScale;
+
+	ConvertCoefficients* c = pCoefficients;
+	c->yOffset = yOffset;
+	c->yScale = (int16_t) (lumaScale * COEFFICIENT_ONE + 0.5f);
+	c->greenU = (int16_t) (-2.0f * kb * (1.0f - kb) / kg * chromaScale * COEFFICIENT_ONE - 0.5f);
+	c->greenV = (int16_t) (-2.0f * kr * (1.0f - kr) / kg * chromaScale * COEFFICIENT_ONE - 0.5f);
+	c->swapChroma = (order == PIXEL_BGRA);
+	c->first = (int16_t) ((c->swapChroma ? blue : red) * COEFFICIENT_ONE + 0.5f);
+	c->last = (int16_t) ((c->swapChroma ? red : blue) * COEFFICIENT_ONE + 0.5f);
+}
+
+/* Converts a 4:2:0 frame to 4 byte pixels, at its own size or halved in both
+ * directions. The output must hold (half ? height / 2 : height) rows of stride. */
+int 
+convert_frame(const AVFrame* pFrame, 
+	      uint8_t* pOutput, 
+	      uint32_t stride, 
+	      PixelOrder order, 
+	      bool half) 
+{
+	ConvertFormat format;
+	if (!find_format(pFrame->format, &format)) {
+		fputs("Convert: unsupported pixel format.\n", stderr);
+		return EXIT_FAILURE;
+	}
+	call_once(&kernelOnce, pick_kernel);
+
+	ConvertCoefficients coefficients;
+	compute_coefficients(pFrame, order, &coefficients);
+
+	uint32_t width = half ? (uint32_t) pFrame->width / 2 : (uint32_t) pFrame->width;
+	uint32_t height = half ? (uint32_t) pFrame->height / 2 : (uint32_t) pFrame->height;
+
+	ConvertRow row = { };
+	row.format = format;
+	row.half = half;
+	row.width = width;
+	for (uint32_t y = 0; y < height; ++y) {
+		ptrdiff_t lumaRow = half ? 2 * y : y;
+		ptrdiff_t chromaRow = half ? y : y / 2;
+
+		row.pLuma[0] = pFrame->data[0] + lumaRow * pFrame->linesize[0];
+		row.pLuma[1] = half ? row.pLuma[0] + pFrame->linesize[0] : nullptr;
+		row.pChroma[0] = pFrame->data[1] + chromaRow * pFrame->linesize[1];
+		row.pChroma[1] = format == CONVERT_I420 ? 
+			pFrame->data[2] + chromaRow * pFrame->linesize[2] : 
+			nullptr;
+		row.pOutput = pOutput + (size_t) y * stride;
+
+		kernel.convert(&row, &coefficients);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+const char* 
+get_convert_kernel_name(void) 
+{
+	call_once(&kernelOnce, pick_kernel);
+	return kernel.name;
+}
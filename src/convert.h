@@ -0,0 +1,79 @@
+#ifndef	CONVERT_H
+#define	CONVERT_H
+
+#include <stdint.h>
+
+#include <libavutil/frame.h>
+
+/* Byte order of converted pixels in memory; BGRA is WL_SHM_FORMAT_ARGB8888. */
+typedef enum PixelOrder {
+	PIXEL_RGBA,
+	PIXEL_BGRA,
+} PixelOrder;
+
+typedef enum ConvertFormat {
+	CONVERT_NV12,
+	CONVERT_I420,
+	CONVERT_P010,
+} ConvertFormat;
+
+/* Fixed point YCbCr to RGB, shared by every kernel so that all of them produce the
+ * same bytes. Samples enter as 14 bit values, chroma centered on zero; each channel
+ * is (luma + sum of mulhi(chroma, coefficient) + 4) >> 3, saturated to 8 bits,
+ * where luma is mulhi(Y - yOffset, yScale) and mulhi(a, b) is (a * b) >> 16. */
+typedef struct ConvertCoefficients {
+	int16_t	yOffset;
+	int16_t	yScale;
+	int16_t	first;		/* Cr to R, or Cb to B when swapChroma is set */
+	int16_t	greenU;
+	int16_t	greenV;
+	int16_t	last;		/* Cb to B, or Cr to R when swapChroma is set */
+	bool	swapChroma;	/* BGRA: the first byte comes from Cb. */
+} ConvertCoefficients;
+
+/* One output row. When halving, each output pixel averages 2x2 luma samples and
+ * takes the chroma sample at its own position, 4:2:0 chroma being half size. */
+typedef struct ConvertRow {
+	ConvertFormat	format;
+	bool		half;
+	const uint8_t*	pLuma[2];	/* The second row is only read when halving. */
+	const uint8_t*	pChroma[2];	/* Cb and Cr planes, or interleaved CbCr in [0] */
+	uint8_t*	pOutput;
+	uint32_t	width;		/* Output pixels */
+} ConvertRow;
+
+typedef void (*ConvertRowKernel)(const ConvertRow* pRow, const ConvertCoefficients* pCoefficients);
+
+void 
+convert_row_scalar(const ConvertRow* pRow, const ConvertCoefficients* pCoefficients);
+
+void 
+convert_pixels_scalar(const ConvertRow* pRow, 
+		      const ConvertCoefficients* pCoefficients, 
+		      uint32_t first);
+
+#if defined(__x86_64__) || defined(__i386__)
+void 
+convert_row_sse41(const ConvertRow* pRow, const ConvertCoefficients* pCoefficients);
+
+void 
+convert_row_avx2(const ConvertRow* pRow, const ConvertCoefficients* pCoefficients);
+
+void 
+convert_row_avx512(const ConvertRow* pRow, const ConvertCoefficients* pCoefficients);
+#endif
+
+bool 
+is_convertible(enum AVPixelFormat pixelFormat);
+
+int 
+convert_frame(const AVFrame* pFrame, 
+	      uint8_t* pOutput, 
+	      uint32_t stride, 
+	      PixelOrder order, 
+	      bool half);
+
+const char* 
+get_convert_kernel_name(void);
+
+#endif	/* CONVERT_H */
@@ -0,0 +1,186 @@
+#include <stdint.h>
+
+#include <immintrin.h>
+
+#include "convert.h"
+
+/* Pixels per iteration: sixteen 16 bit lanes */
+#define BLOCK	16
+
+typedef struct Constants {
+	__m256i	yOffset;
+	__m256i	yScale;
+	__m256i	first;
+	__m256i	greenU;
+	__m256i	greenV;
+	__m256i	last;
+	__m256i	round;
+	__m256i	chromaBias;
+	__m256i	alpha;
+	__m256i	lowHalf;
+} Constants;
+
+static inline void 
+load_constants(const ConvertCoefficients* c, Constants* pConstants) 
+{
+	pConstants->yOffset = _mm256_set1_epi16(c->yOffset);
+	pConstants->yScale = _mm256_set1_epi16(c->yScale);
+	pConstants->first = _mm256_set1_epi16(c->first);
+	pConstants->greenU = _mm256_set1_epi16(c->greenU);
+	pConstants->greenV = _mm256_set1_epi16(c->greenV);
+	pConstants->last = _mm256_set1_epi16(c->last);
+	pConstants->round = _mm256_set1_epi16(4);
+	pConstants->chromaBias = _mm256_set1_epi16(8192);
+	pConstants->alpha = _mm256_set1_epi16(255);
+	pConstants->lowHalf = _mm256_set1_epi32(0xFFFF);
+}
+
+/* Splits interleaved 16 bit (Cb, Cr) pairs, repeating each sample for the two
+ * pixels sharing it. Stays within 32 bit lanes, so no lane crossing is needed. */
+static inline void 
+split_pairs(__m256i pairs, const Constants* k, __m256i* pU, __m256i* pV) 
+{
+	__m256i u = _mm256_and_si256(pairs, k->lowHalf);
+	__m256i v = _mm256_srli_epi32(pairs, 16);
+	*pU = _mm256_or_si256(u, _mm256_slli_epi32(u, 16));
+	*pV = _mm256_or_si256(v, _mm256_slli_epi32(v, 16));
+}
+
+/* Two registers of 32 bit values below 2^16 to one of 16 bit values; the pack
+ * works per 128 bit lane, the permute puts the quarters back in order. */
+static inline __m256i 
+narrow(__m256i low, __m256i high) 
+{
+	return _mm256_permute4x64_epi64(_mm256_packus_epi32(low, high), 0xD8);
+}
+
+static inline __m128i 
+load_half(const uint8_t* pData) 
+{
+	return _mm_loadu_si128((const __m128i*) pData);
+}
+
+static inline __m256i 
+load(const uint8_t* pData) 
+{
+	return _mm256_loadu_si256((const __m256i*) pData);
+}
+
+/* 14 bit luma, centered chroma for pixels x to x + BLOCK */
+static inline void 
+load_block(const ConvertRow* pRow, 
+	   uint32_t x, 
+	   const Constants* k, 
+	   __m256i* pY, 
+	   __m256i* pU, 
+	   __m256i* pV) 
+{
+	__m256i y = _mm256_setzero_si256(), u = y, v = y;
+
+	if (!pRow->half) {
+		const uint8_t* pChroma = pRow->pChroma[0];
+		switch (pRow->format) {
+		case CONVERT_NV12:
+			y = _mm256_slli_epi16(_mm256_cvtepu8_epi16(load_half(pRow->pLuma[0] + x)), 6);
+			split_pairs(_mm256_cvtepu8_epi16(load_half(pChroma + x)), k, &u, &v);
+			u = _mm256_slli_epi16(u, 6);
+			v = _mm256_slli_epi16(v, 6);
+			break;
+		case CONVERT_I420:
+			y = _mm256_slli_epi16(_mm256_cvtepu8_epi16(load_half(pRow->pLuma[0] + x)), 6);
+			u = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (pChroma + x / 2)));
+			v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (pRow->pChroma[1] + x / 2)));
+			u = _mm256_slli_epi16(_mm256_or_si256(u, _mm256_slli_epi32(u, 16)), 6);
+			v = _mm256_slli_epi16(_mm256_or_si256(v, _mm256_slli_epi32(v, 16)), 6);
+			break;
+		case CONVERT_P010:
+			y = _mm256_srli_epi16(load(pRow->pLuma[0] + x * 2), 2);
+			split_pairs(_mm256_srli_epi16(load(pChroma + x * 2), 2), k, &u, &v);
+			break;
+		}
+	} else if (pRow->format == CONVERT_P010) {
+		/* Pairwise sums in 32 bit lanes: four 14 bit samples overflow int16. */
+		__m256i sums[2];
+		for (int i = 0; i < 2; ++i) {
+			__m256i top = _mm256_srli_epi16(load(pRow->pLuma[0] + x * 4 + i * 32), 2);
+			__m256i bottom = _mm256_srli_epi16(load(pRow->pLuma[1] + x * 4 + i * 32), 2);
+			__m256i sum = _mm256_add_epi32(_mm256_and_si256(top, k->lowHalf), 
+						       _mm256_srli_epi32(top, 16));
+			sum = _mm256_add_epi32(sum, _mm256_and_si256(bottom, k->lowHalf));
+			sums[i] = _mm256_srli_epi32(_mm256_add_epi32(sum, _mm256_srli_epi32(bottom, 16)), 2);
+		}
+		y = narrow(sums[0], sums[1]);
+
+		__m256i low = _mm256_srli_epi16(load(pRow->pChroma[0] + x * 4), 2);
+		__m256i high = _mm256_srli_epi16(load(pRow->pChroma[0] + x * 4 + 32), 2);
+		u = narrow(_mm256_and_si256(low, k->lowHalf), _mm256_and_si256(high, k->lowHalf));
+		v = narrow(_mm256_srli_epi32(low, 16), _mm256_srli_epi32(high, 16));
+	} else {
+		/* Four 8 bit samples sum to at most 10 bits; times 16 is their 14 bit mean. */
+		__m256i ones = _mm256_set1_epi8(1);
+		__m256i top = _mm256_maddubs_epi16(load(pRow->pLuma[0] + x * 2), ones);
+		__m256i bottom = _mm256_maddubs_epi16(load(pRow->pLuma[1] + x * 2), ones);
+		y = _mm256_slli_epi16(_mm256_add_epi16(top, bottom), 4);
+
+		if (pRow->format == CONVERT_NV12) {
+			__m256i pairs = load(pRow->pChroma[0] + x * 2);
+			u = _mm256_slli_epi16(_mm256_and_si256(pairs, _mm256_set1_epi16(0xFF)), 6);
+			v = _mm256_slli_epi16(_mm256_srli_epi16(pairs, 8), 6);
+		} else {
+			u = _mm256_slli_epi16(_mm256_cvtepu8_epi16(load_half(pRow->pChroma[0] + x)), 6);
+			v = _mm256_slli_epi16(_mm256_cvtepu8_epi16(load_half(pRow->pChroma[1] + x)), 6);
+		}
+	}
+
+	*pY = y;
+	*pU = _mm256_sub_epi16(u, k->chromaBias);
+	*pV = _mm256_sub_epi16(v, k->chromaBias);
+}
+
+static inline void 
+store_block(uint8_t* pOutput, 
+	    __m256i y, 
+	    __m256i u, 
+	    __m256i v, 
+	    bool swapChroma, 
+	    const Constants* k) 
+{
+	__m256i luma = _mm256_mulhi_epi16(_mm256_sub_epi16(y, k->yOffset), k->yScale);
+	luma = _mm256_add_epi16(luma, k->round);
+
+	__m256i c0 = _mm256_add_epi16(luma, _mm256_mulhi_epi16(swapChroma ? u : v, k->first));
+	__m256i c1 = _mm256_add_epi16(luma, _mm256_add_epi16(_mm256_mulhi_epi16(u, k->greenU), 
+							     _mm256_mulhi_epi16(v, k->greenV)));
+	__m256i c2 = _mm256_add_epi16(luma, _mm256_mulhi_epi16(swapChroma ? v : u, k->last));
+	c0 = _mm256_srai_epi16(c0, 3);
+	c1 = _mm256_srai_epi16(c1, 3);
+	c2 = _mm256_srai_epi16(c2, 3);
+
+	/* Same interleave as SSE4.1 in each lane: pixels 0-3 and 8-11, then 4-7 and
+	 * 12-15, so the lanes are regrouped before storing. */
+	__m256i evens = _mm256_packus_epi16(c0, c2);
+	__m256i odds = _mm256_packus_epi16(c1, k->alpha);
+	__m256i first = _mm256_unpacklo_epi8(evens, odds);
+	__m256i second = _mm256_unpackhi_epi8(evens, odds);
+	__m256i low = _mm256_unpacklo_epi16(first, second);
+	__m256i high = _mm256_unpackhi_epi16(first, second);
+
+	_mm256_storeu_si256((__m256i*) pOutput, _mm256_permute2x128_si256(low, high, 0x20));
+	_mm256_storeu_si256((__m256i*) (pOutput + 32), _mm256_permute2x128_si256(low, high, 0x31));
+}
+
+void 
+convert_row_avx2(const ConvertRow* pRow, const ConvertCoefficients* pCoefficients) 
+{
+	Constants k;
+	load_constants(pCoefficients, &k);
+
+	uint32_t x = 0;
+	for (; x + BLOCK <= pRow->width; x += BLOCK) {
+		__m256i y, u, v;
+		load_block(pRow, x, &k, &y, &u, &v);
+		store_block(pRow->pOutput + (size_t) x * 4, y, u, v, pCoefficients->swapChroma, &k);
+	}
+
+	convert_pixels_scalar(pRow, pCoefficients, x);
+}
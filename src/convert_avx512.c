@@ -0,0 +1,190 @@
+#include <stdint.h>
+
+#include <immintrin.h>
+
+#include "convert.h"
+
+/* Pixels per iteration: thirty-two 16 bit lanes */
+#define BLOCK	32
+
+typedef struct Constants {
+	__m512i	yOffset;
+	__m512i	yScale;
+	__m512i	first;
+	__m512i	greenU;
+	__m512i	greenV;
+	__m512i	last;
+	__m512i	round;
+	__m512i	chromaBias;
+	__m512i	alpha;
+	__m512i	lowHalf;
+	__m512i	narrowOrder;
+	__m512i	storeFirst;
+	__m512i	storeSecond;
+} Constants;
+
+static inline void 
+load_constants(const ConvertCoefficients* c, Constants* pConstants) 
+{
+	pConstants->yOffset = _mm512_set1_epi16(c->yOffset);
+	pConstants->yScale = _mm512_set1_epi16(c->yScale);
+	pConstants->first = _mm512_set1_epi16(c->first);
+	pConstants->greenU = _mm512_set1_epi16(c->greenU);
+	pConstants->greenV = _mm512_set1_epi16(c->greenV);
+	pConstants->last = _mm512_set1_epi16(c->last);
+	pConstants->round = _mm512_set1_epi16(4);
+	pConstants->chromaBias = _mm512_set1_epi16(8192);
+	pConstants->alpha = _mm512_set1_epi16(255);
+	pConstants->lowHalf = _mm512_set1_epi32(0xFFFF);
+	pConstants->narrowOrder = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+	pConstants->storeFirst = _mm512_setr_epi64(0, 1, 8, 9, 2, 3, 10, 11);
+	pConstants->storeSecond = _mm512_setr_epi64(4, 5, 12, 13, 6, 7, 14, 15);
+}
+
+/* Splits interleaved 16 bit (Cb, Cr) pairs, repeating each sample for the two
+ * pixels sharing it. */
+static inline void 
+split_pairs(__m512i pairs, const Constants* k, __m512i* pU, __m512i* pV) 
+{
+	__m512i u = _mm512_and_si512(pairs, k->lowHalf);
+	__m512i v = _mm512_srli_epi32(pairs, 16);
+	*pU = _mm512_or_si512(u, _mm512_slli_epi32(u, 16));
+	*pV = _mm512_or_si512(v, _mm512_slli_epi32(v, 16));
+}
+
+/* Two registers of 32 bit values below 2^16 to one of 16 bit values */
+static inline __m512i 
+narrow(__m512i low, __m512i high, const Constants* k) 
+{
+	return _mm512_permutexvar_epi64(k->narrowOrder, _mm512_packus_epi32(low, high));
+}
+
+static inline __m256i 
+load_half(const uint8_t* pData) 
+{
+	return _mm256_loadu_si256((const __m256i*) pData);
+}
+
+static inline __m512i 
+load(const uint8_t* pData) 
+{
+	return _mm512_loadu_si512(pData);
+}
+
+/* 14 bit luma, centered chroma for pixels x to x + BLOCK */
+static inline void 
+load_block(const ConvertRow* pRow, 
+	   uint32_t x, 
+	   const Constants* k, 
+	   __m512i* pY, 
+	   __m512i* pU, 
+	   __m512i* pV) 
+{
+	__m512i y = _mm512_setzero_si512(), u = y, v = y;
+
+	if (!pRow->half) {
+		const uint8_t* pChroma = pRow->pChroma[0];
+		switch (pRow->format) {
+		case CONVERT_NV12:
+			y = _mm512_slli_epi16(_mm512_cvtepu8_epi16(load_half(pRow->pLuma[0] + x)), 6);
+			split_pairs(_mm512_cvtepu8_epi16(load_half(pChroma + x)), k, &u, &v);
+			u = _mm512_slli_epi16(u, 6);
+			v = _mm512_slli_epi16(v, 6);
+			break;
+		case CONVERT_I420:
+			y = _mm512_slli_epi16(_mm512_cvtepu8_epi16(load_half(pRow->pLuma[0] + x)), 6);
+			u = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*) (pChroma + x / 2)));
+			v = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*) (pRow->pChroma[1] + x / 2)));
+			u = _mm512_slli_epi16(_mm512_or_si512(u, _mm512_slli_epi32(u, 16)), 6);
+			v = _mm512_slli_epi16(_mm512_or_si512(v, _mm512_slli_epi32(v, 16)), 6);
+			break;
+		case CONVERT_P010:
+			y = _mm512_srli_epi16(load(pRow->pLuma[0] + x * 2), 2);
+			split_pairs(_mm512_srli_epi16(load(pChroma + x * 2), 2), k, &u, &v);
+			break;
+		}
+	} else if (pRow->format == CONVERT_P010) {
+		/* Pairwise sums in 32 bit lanes: four 14 bit samples overflow int16. */
+		__m512i sums[2];
+		for (int i = 0; i < 2; ++i) {
+			__m512i top = _mm512_srli_epi16(load(pRow->pLuma[0] + x * 4 + i * 64), 2);
+			__m512i bottom = _mm512_srli_epi16(load(pRow->pLuma[1] + x * 4 + i * 64), 2);
+			__m512i sum = _mm512_add_epi32(_mm512_and_si512(top, k->lowHalf), 
+						       _mm512_srli_epi32(top, 16));
+			sum = _mm512_add_epi32(sum, _mm512_and_si512(bottom, k->lowHalf));
+			sums[i] = _mm512_srli_epi32(_mm512_add_epi32(sum, _mm512_srli_epi32(bottom, 16)), 2);
+		}
+		y = narrow(sums[0], sums[1], k);
+
+		__m512i low = _mm512_srli_epi16(load(pRow->pChroma[0] + x * 4), 2);
+		__m512i high = _mm512_srli_epi16(load(pRow->pChroma[0] + x * 4 + 64), 2);
+		u = narrow(_mm512_and_si512(low, k->lowHalf), _mm512_and_si512(high, k->lowHalf), k);
+		v = narrow(_mm512_srli_epi32(low, 16), _mm512_srli_epi32(high, 16), k);
+	} else {
+		/* Four 8 bit samples sum to at most 10 bits; times 16 is their 14 bit mean. */
+		__m512i ones = _mm512_set1_epi8(1);
+		__m512i top = _mm512_maddubs_epi16(load(pRow->pLuma[0] + x * 2), ones);
+		__m512i bottom = _mm512_maddubs_epi16(load(pRow->pLuma[1] + x * 2), ones);
+		y = _mm512_slli_epi16(_mm512_add_epi16(top, bottom), 4);
+
+		if (pRow->format == CONVERT_NV12) {
+			__m512i pairs = load(pRow->pChroma[0] + x * 2);
+			u = _mm512_slli_epi16(_mm512_and_si512(pairs, _mm512_set1_epi16(0xFF)), 6);
+			v = _mm512_slli_epi16(_mm512_srli_epi16(pairs, 8), 6);
+		} else {
+			u = _mm512_slli_epi16(_mm512_cvtepu8_epi16(load_half(pRow->pChroma[0] + x)), 6);
+			v = _mm512_slli_epi16(_mm512_cvtepu8_epi16(load_half(pRow->pChroma[1] + x)), 6);
+		}
+	}
+
+	*pY = y;
+	*pU = _mm512_sub_epi16(u, k->chromaBias);
+	*pV = _mm512_sub_epi16(v, k->chromaBias);
+}
+
+static inline void 
+store_block(uint8_t* pOutput, 
+	    __m512i y, 
+	    __m512i u, 
+	    __m512i v, 
+	    bool swapChroma, 
+	    const Constants* k) 
+{
+	__m512i luma = _mm512_mulhi_epi16(_mm512_sub_epi16(y, k->yOffset), k->yScale);
+	luma = _mm512_add_epi16(luma, k->round);
+
+	__m512i c0 = _mm512_add_epi16(luma, _mm512_mulhi_epi16(swapChroma ? u : v, k->first));
+	__m512i c1 = _mm512_add_epi16(luma, _mm512_add_epi16(_mm512_mulhi_epi16(u, k->greenU), 
+							     _mm512_mulhi_epi16(v, k->greenV)));
+	__m512i c2 = _mm512_add_epi16(luma, _mm512_mulhi_epi16(swapChroma ? v : u, k->last));
+	c0 = _mm512_srai_epi16(c0, 3);
+	c1 = _mm512_srai_epi16(c1, 3);
+	c2 = _mm512_srai_epi16(c2, 3);
+
+	/* Lane n of low and high holds pixels 8n to 8n + 3 and 8n + 4 to 8n + 7. */
+	__m512i evens = _mm512_packus_epi16(c0, c2);
+	__m512i odds = _mm512_packus_epi16(c1, k->alpha);
+	__m512i first = _mm512_unpacklo_epi8(evens, odds);
+	__m512i second = _mm512_unpackhi_epi8(evens, odds);
+	__m512i low = _mm512_unpacklo_epi16(first, second);
+	__m512i high = _mm512_unpackhi_epi16(first, second);
+
+	_mm512_storeu_si512(pOutput, _mm512_permutex2var_epi64(low, k->storeFirst, high));
+	_mm512_storeu_si512(pOutput + 64, _mm512_permutex2var_epi64(low, k->storeSecond, high));
+}
+
+void 
+convert_row_avx512(const ConvertRow* pRow, const ConvertCoefficients* pCoefficients) 
+{
+	Constants k;
+	load_constants(pCoefficients, &k);
+
+	uint32_t x = 0;
+	for (; x + BLOCK <= pRow->width; x += BLOCK) {
+		__m512i y, u, v;
+		load_block(pRow, x, &k, &y, &u, &v);
+		store_block(pRow->pOutput + (size_t) x * 4, y, u, v, pCoefficients->swapChroma, &k);
+	}
+
+	convert_pixels_scalar(pRow, pCoefficients, x);
+}
@@ -0,0 +1,190 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <smmintrin.h>
+
+#include "convert.h"
+
+/* Pixels per iteration: eight 16 bit lanes */
+#define BLOCK	8
+
+typedef struct Constants {
+	__m128i	yOffset;
+	__m128i	yScale;
+	__m128i	first;
+	__m128i	greenU;
+	__m128i	greenV;
+	__m128i	last;
+	__m128i	round;
+	__m128i	chromaBias;
+	__m128i	alpha;
+	__m128i	lowHalf;
+} Constants;
+
+static inline void 
+load_constants(const ConvertCoefficients* c, Constants* pConstants) 
+{
+	pConstants->yOffset = _mm_set1_epi16(c->yOffset);
+	pConstants->yScale = _mm_set1_epi16(c->yScale);
+	pConstants->first = _mm_set1_epi16(c->first);
+	pConstants->greenU = _mm_set1_epi16(c->greenU);
+	pConstants->greenV = _mm_set1_epi16(c->greenV);
+	pConstants->last = _mm_set1_epi16(c->last);
+	pConstants->round = _mm_set1_epi16(4);
+	pConstants->chromaBias = _mm_set1_epi16(8192);
+	pConstants->alpha = _mm_set1_epi16(255);
+	pConstants->lowHalf = _mm_set1_epi32(0xFFFF);
+}
+
+/* Splits interleaved 16 bit (Cb, Cr) pairs, repeating each sample for the two
+ * pixels sharing it. */
+static inline void 
+split_pairs(__m128i pairs, const Constants* k, __m128i* pU, __m128i* pV) 
+{
+	__m128i u = _mm_and_si128(pairs, k->lowHalf);
+	__m128i v = _mm_srli_epi32(pairs, 16);
+	*pU = _mm_or_si128(u, _mm_slli_epi32(u, 16));
+	*pV = _mm_or_si128(v, _mm_slli_epi32(v, 16));
+}
+
+/* Two registers of 32 bit values below 2^16 to one of 16 bit values */
+static inline __m128i 
+narrow(__m128i low, __m128i high) 
+{
+	return _mm_packus_epi32(low, high);
+}
+
+static inline __m128i 
+load_low(const uint8_t* pData) 
+{
+	return _mm_loadl_epi64((const __m128i*) pData);
+}
+
+static inline __m128i 
+load_u32(const uint8_t* pData) 
+{
+	int32_t value;
+	memcpy(&value, pData, sizeof(value));
+	return _mm_cvtsi32_si128(value);
+}
+
+static inline __m128i 
+load(const uint8_t* pData) 
+{
+	return _mm_loadu_si128((const __m128i*) pData);
+}
+
+/* 14 bit luma, centered chroma for pixels x to x + BLOCK */
+static inline void 
+load_block(const ConvertRow* pRow, 
+	   uint32_t x, 
+	   const Constants* k, 
+	   __m128i* pY, 
+	   __m128i* pU, 
+	   __m128i* pV) 
+{
+	__m128i y = _mm_setzero_si128(), u = y, v = y;
+
+	if (!pRow->half) {
+		const uint8_t* pChroma = pRow->pChroma[0];
+		switch (pRow->format) {
+		case CONVERT_NV12:
+			y = _mm_slli_epi16(_mm_cvtepu8_epi16(load_low(pRow->pLuma[0] + x)), 6);
+			split_pairs(_mm_cvtepu8_epi16(load_low(pChroma + x)), k, &u, &v);
+			u = _mm_slli_epi16(u, 6);
+			v = _mm_slli_epi16(v, 6);
+			break;
+		case CONVERT_I420:
+			y = _mm_slli_epi16(_mm_cvtepu8_epi16(load_low(pRow->pLuma[0] + x)), 6);
+			u = _mm_cvtepu8_epi16(load_u32(pChroma + x / 2));
+			v = _mm_cvtepu8_epi16(load_u32(pRow->pChroma[1] + x / 2));
+			u = _mm_slli_epi16(_mm_unpacklo_epi16(u, u), 6);
+			v = _mm_slli_epi16(_mm_unpacklo_epi16(v, v), 6);
+			break;
+		case CONVERT_P010:
+			y = _mm_srli_epi16(load(pRow->pLuma[0] + x * 2), 2);
+			split_pairs(_mm_srli_epi16(load(pChroma + x * 2), 2), k, &u, &v);
+			break;
+		}
+	} else if (pRow->format == CONVERT_P010) {
+		/* Pairwise sums in 32 bit lanes: four 14 bit samples overflow int16. */
+		__m128i sums[2];
+		for (int i = 0; i < 2; ++i) {
+			__m128i top = _mm_srli_epi16(load(pRow->pLuma[0] + x * 4 + i * 16), 2);
+			__m128i bottom = _mm_srli_epi16(load(pRow->pLuma[1] + x * 4 + i * 16), 2);
+			__m128i sum = _mm_add_epi32(_mm_and_si128(top, k->lowHalf), _mm_srli_epi32(top, 16));
+			sum = _mm_add_epi32(sum, _mm_and_si128(bottom, k->lowHalf));
+			sums[i] = _mm_srli_epi32(_mm_add_epi32(sum, _mm_srli_epi32(bottom, 16)), 2);
+		}
+		y = narrow(sums[0], sums[1]);
+
+		__m128i low = _mm_srli_epi16(load(pRow->pChroma[0] + x * 4), 2);
+		__m128i high = _mm_srli_epi16(load(pRow->pChroma[0] + x * 4 + 16), 2);
+		u = narrow(_mm_and_si128(low, k->lowHalf), _mm_and_si128(high, k->lowHalf));
+		v = narrow(_mm_srli_epi32(low, 16), _mm_srli_epi32(high, 16));
+	} else {
+		/* Four 8 bit samples sum to at most 10 bits; times 16 is their 14 bit mean. */
+		__m128i ones = _mm_set1_epi8(1);
+		__m128i top = _mm_maddubs_epi16(load(pRow->pLuma[0] + x * 2), ones);
+		__m128i bottom = _mm_maddubs_epi16(load(pRow->pLuma[1] + x * 2), ones);
+		y = _mm_slli_epi16(_mm_add_epi16(top, bottom), 4);
+
+		if (pRow->format == CONVERT_NV12) {
+			__m128i pairs = load(pRow->pChroma[0] + x * 2);
+			u = _mm_slli_epi16(_mm_and_si128(pairs, _mm_set1_epi16(0xFF)), 6);
+			v = _mm_slli_epi16(_mm_srli_epi16(pairs, 8), 6);
+		} else {
+			u = _mm_slli_epi16(_mm_cvtepu8_epi16(load_low(pRow->pChroma[0] + x)), 6);
+			v = _mm_slli_epi16(_mm_cvtepu8_epi16(load_low(pRow->pChroma[1] + x)), 6);
+		}
+	}
+
+	*pY = y;
+	*pU = _mm_sub_epi16(u, k->chromaBias);
+	*pV = _mm_sub_epi16(v, k->chromaBias);
+}
+
+static inline void 
+store_block(uint8_t* pOutput, 
+	    __m128i y, 
+	    __m128i u, 
+	    __m128i v, 
+	    bool swapChroma, 
+	    const Constants* k) 
+{
+	__m128i luma = _mm_mulhi_epi16(_mm_sub_epi16(y, k->yOffset), k->yScale);
+	luma = _mm_add_epi16(luma, k->round);
+
+	__m128i c0 = _mm_add_epi16(luma, _mm_mulhi_epi16(swapChroma ? u : v, k->first));
+	__m128i c1 = _mm_add_epi16(luma, _mm_add_epi16(_mm_mulhi_epi16(u, k->greenU), 
+						       _mm_mulhi_epi16(v, k->greenV)));
+	__m128i c2 = _mm_add_epi16(luma, _mm_mulhi_epi16(swapChroma ? v : u, k->last));
+	c0 = _mm_srai_epi16(c0, 3);
+	c1 = _mm_srai_epi16(c1, 3);
+	c2 = _mm_srai_epi16(c2, 3);
+
+	/* c0 c1 pairs and c2 a pairs, then both interleaved into pixels */
+	__m128i evens = _mm_packus_epi16(c0, c2);
+	__m128i odds = _mm_packus_epi16(c1, k->alpha);
+	__m128i first = _mm_unpacklo_epi8(evens, odds);
+	__m128i second = _mm_unpackhi_epi8(evens, odds);
+
+	_mm_storeu_si128((__m128i*) pOutput, _mm_unpacklo_epi16(first, second));
+	_mm_storeu_si128((__m128i*) (pOutput + 16), _mm_unpackhi_epi16(first, second));
+}
+
+void 
+convert_row_sse41(const ConvertRow* pRow, const ConvertCoefficients* pCoefficients) 
+{
+	Constants k;
+	load_constants(pCoefficients, &k);
+
+	uint32_t x = 0;
+	for (; x + BLOCK <= pRow->width; x += BLOCK) {
+		__m128i y, u, v;
+		load_block(pRow, x, &k, &y, &u, &v);
+		store_block(pRow->pOutput + (size_t) x * 4, y, u, v, pCoefficients->swapChroma, &k);
+	}
+
+	convert_pixels_scalar(pRow, pCoefficients, x);
+}
@@ -0,0 +1,527 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/mathematics.h>
+#include <semaphore.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "decoder.h"
+#include "framepool.h"
+#include "mmapio.h"
+#include "probecache.h"
+#include "queue.h"
+#include "seekindex.h"
+#include "y4m.h"
+
+#define FRAME_POOL_SIZE	8
+
+static AVFormatContext* pFormat;
+static AVCodecContext* pCodec;
+static int streamIndex = -1;
+static AVRational timeBase;
+static AVRational frameRate;
+/* Demuxers without their own index are seeked by byte offset from the keyframe index. */
+static bool byteSeek;
+
+/* Y4M input bypasses libav: frames point straight into the file or a pipe buffer. */
+static Y4MReader y4m;
+static bool rawInput;
+
+/* Every AVFrame is allocated up front and circulates between the two threads: the 
+ * decoder fills a free frame and queues it, the renderer returns it once the GPU is 
+ * done with it. Both rings are lock-free. The semaphore counts free frames, so the 
+ * decoder only sleeps when it runs FRAME_POOL_SIZE frames ahead. */
+static AVFrame* frameStore[FRAME_POOL_SIZE];
+static FrameQueue frames;
+static FrameQueue freeFrames;
+static sem_t freeCount;
+static int eventFd = -1;
+
+static thrd_t decoderThread;
+static bool started;
+static atomic_bool stopping;
+static atomic_bool finished;
+
+/* Every seek bumps seekSerial. Frames carry the serial they were decoded under in 
+ * AVFrame.opaque, so the renderer drops the ones queued before the seek. */
+static atomic_uint seekSerial;
+static atomic_llong seekTarget;
+static sem_t seekSignal;
+static unsigned outputSerial;
+static int64_t skipPts = AV_NOPTS_VALUE;
+
+static void 
+print_error(const char* message, int error) 
+{
+	char description[AV_ERROR_MAX_STRING_SIZE];
+	av_strerror(error, description, sizeof(description));
+	fprintf(stderr, "Decoder: %s: %s.\n", message, description);
+}
+
+static void 
+notify_renderer(void) 
+{
+	/* Only fails with EAGAIN once the counter saturates, which still wakes the loop. */
+	uint64_t one = 1;
+	[[maybe_unused]] ssize_t written = write(eventFd, &one, sizeof(one));
+}
+
+static AVFrame* 
+take_frame(void) 
+{
+	while (sem_wait(&freeCount) == -1) {
+		if (errno != EINTR) { return nullptr; }
+	}
+	if (atomic_load(&stopping)) { return nullptr; }
+
+	return queue_pop(&freeFrames);
+}
+
+/* Hands every frame the decoder has ready to the renderer. A frame that was 
+ * taken but not filled is kept in *ppFrame for the next call. */
+static int 
+receive_frames(AVFrame** ppFrame) 
+{
+	for (;;) {
+		if (!*ppFrame && !(*ppFrame = take_frame())) { return AVERROR_EXIT; }
+
+		int ret = avcodec_receive_frame(pCodec, *ppFrame);
+		if (ret == AVERROR(EAGAIN)) { return 0; }
+		if (ret < 0) { return ret; }
+
+		/* After a seek, frames between the keyframe and the target are not shown. */
+		int64_t pts = (*ppFrame)->best_effort_timestamp;
+		if (skipPts != AV_NOPTS_VALUE && pts != AV_NOPTS_VALUE && pts < skipPts) {
+			av_frame_unref(*ppFrame);
+			continue;
+		}
+		skipPts = AV_NOPTS_VALUE;
+
+		(*ppFrame)->opaque = (void*) (uintptr_t) outputSerial;
+		queue_push(&frames, *ppFrame);
+		notify_renderer();
+		*ppFrame = nullptr;
+	}
+}
+
+static int 
+seek_stream(int64_t targetNs) 
+{
+	int64_t target = av_rescale_q(targetNs, (AVRational) { 1, 1000000000 }, timeBase);
+
+	/* Straight to the keyframe: by offset, or by the exact timestamp the demuxer 
+	 * finds in its own index without searching. */
+	const KeyFrame* pKey = find_keyframe(target);
+	int ret;
+	if (pKey && byteSeek && pKey->pos >= 0) {
+		int64_t offset = avio_seek(pFormat->pb, pKey->pos, SEEK_SET);
+		ret = offset < 0 ? (int) offset : avformat_flush(pFormat);
+	} else {
+		ret = av_seek_frame(pFormat, 
+				    streamIndex, 
+				    pKey ? pKey->pts : target, 
+				    AVSEEK_FLAG_BACKWARD);
+	}
+	avcodec_flush_buffers(pCodec);
+	skipPts = target;
+
+	return ret;
+}
+
+/* Sleeps after the end of the input until a seek or close_decoder() wakes it. */
+static void 
+wait_for_seek(void) 
+{
+	while (!atomic_load(&stopping) && atomic_load(&seekSerial) == outputSerial) {
+		if (sem_wait(&seekSignal) == -1 && errno != EINTR) { return; }
+	}
+}
+
+static int 
+decode_video(void* pData) 
+{
+	(void) pData;
+
+	AVPacket* pPacket = av_packet_alloc();
+	AVFrame* pFrame = nullptr;
+	int ret = pPacket ? 0 : AVERROR(ENOMEM);
+
+	while (ret >= 0 && !atomic_load(&stopping)) {
+		unsigned serial = atomic_load(&seekSerial);
+		if (serial != outputSerial) {
+			outputSerial = serial;
+			if ((ret = seek_stream(atomic_load(&seekTarget))) < 0) {
+				print_error("seek failed", ret);
+			}
+			atomic_store(&finished, false);
+		}
+
+		ret = av_read_frame(pFormat, pPacket);
+		if (ret < 0) {
+			if (ret != AVERROR_EOF) { break; }
+
+			/* End of input: drain the frames still buffered in the codec. */
+			avcodec_send_packet(pCodec, nullptr);
+			ret = receive_frames(&pFrame);
+			if (ret < 0 && ret != AVERROR_EOF) { break; }
+
+			atomic_store(&finished, true);
+			notify_renderer();
+			wait_for_seek();
+			ret = 0;
+			continue;
+		}
+
+		if (pPacket->stream_index == streamIndex) {
+			ret = avcodec_send_packet(pCodec, pPacket);
+			if (ret >= 0) { ret = receive_frames(&pFrame); }
+			/* A corrupt packet costs a frame, not the whole stream. */
+			if (ret == AVERROR_INVALIDDATA) { ret = 0; }
+		}
+		av_packet_unref(pPacket);
+	}
+
+	if (ret < 0 && ret != AVERROR_EOF && ret != AVERROR_EXIT) {
+		print_error("decoding stopped", ret);
+	}
+
+	/* An unfilled frame stays in frameStore until close_decoder(). */
+	av_packet_free(&pPacket);
+
+	atomic_store(&finished, true);
+	notify_renderer();
+
+	return (ret >= 0 || ret == AVERROR_EOF) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Same hand-off as decode_video(), with Y4M frames in place of decoded ones */
+static int 
+read_raw_video(void* pData) 
+{
+	(void) pData;
+
+	AVFrame* pFrame = nullptr;
+	int ret = 0;
+
+	while (!atomic_load(&stopping)) {
+		unsigned serial = atomic_load(&seekSerial);
+		if (serial != outputSerial) {
+			outputSerial = serial;
+			int64_t frameIndex = av_rescale_q(atomic_load(&seekTarget), 
+							  (AVRational) { 1, 1000000000 }, 
+							  timeBase);
+			if (seek_y4m(&y4m, frameIndex) != EXIT_SUCCESS) {
+				fputs("Decoder: this Y4M input cannot seek.\n", stderr);
+			}
+			atomic_store(&finished, false);
+		}
+
+		if (!pFrame && !(pFrame = take_frame())) { break; }
+
+		ret = read_y4m_frame(&y4m, pFrame);
+		if (ret == AVERROR_EOF) {
+			atomic_store(&finished, true);
+			notify_renderer();
+			wait_for_seek();
+			continue;
+		}
+		if (ret < 0) {
+			print_error("reading stopped", ret);
+			break;
+		}
+
+		pFrame->opaque = (void*) (uintptr_t) outputSerial;
+		queue_push(&frames, pFrame);
+		notify_renderer();
+		pFrame = nullptr;
+	}
+
+	atomic_store(&finished, true);
+	notify_renderer();
+
+	return (ret >= 0 || ret == AVERROR_EOF) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int 
+open_raw_input(const char* path) 
+{
+	if (open_y4m_reader(&y4m, path) != EXIT_SUCCESS) { return EXIT_FAILURE; }
+	rawInput = true;
+
+	/* Frames are numbered, so one tick of the time base is one frame. */
+	frameRate = y4m.format.frameRate;
+	timeBase = av_inv_q(frameRate);
+
+	return EXIT_SUCCESS;
+}
+
+/* Reads the stream info the slow way. A cached record already applied to the 
+ * streams is discarded by opening the input again. */
+static int 
+probe_streams(const char* path, bool reopen) 
+{
+	int ret;
+	if (reopen) {
+		close_mapped_input(&pFormat);
+		ret = open_mapped_input(&pFormat, path);
+		if (ret < 0) {
+			print_error("failed to open the input", ret);
+			return EXIT_FAILURE;
+		}
+	}
+
+	ret = avformat_find_stream_info(pFormat, nullptr);
+	if (ret < 0) {
+		print_error("failed to read the stream info", ret);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int 
+open_codec(const char* path) 
+{
+	int ret = open_mapped_input(&pFormat, path);
+	if (ret < 0) {
+		print_error("failed to open the input", ret);
+		return EXIT_FAILURE;
+	}
+
+	/* Probing can decode seconds of video; a file opened before skips it. */
+	int cachedIndex = -1;
+	bool probed = load_probe_info(pFormat, path, &cachedIndex) != EXIT_SUCCESS;
+	if (probed && probe_streams(path, false) != EXIT_SUCCESS) { return EXIT_FAILURE; }
+
+	const AVCodec* pDecoder = nullptr;
+	streamIndex = av_find_best_stream(pFormat, 
+					  AVMEDIA_TYPE_VIDEO, 
+					  cachedIndex, 
+					  -1, 
+					  &pDecoder, 
+					  0);
+	/* A record that names no decodable stream is probed again and rewritten. */
+	if (streamIndex < 0 && !probed) {
+		probed = true;
+		if (probe_streams(path, true) != EXIT_SUCCESS) { return EXIT_FAILURE; }
+		streamIndex = av_find_best_stream(pFormat, AVMEDIA_TYPE_VIDEO, -1, -1, &pDecoder, 0);
+	}
+	if (streamIndex < 0) {
+		print_error("no decodable video stream", streamIndex);
+		return EXIT_FAILURE;
+	}
+	AVStream* pStream = pFormat->streams[streamIndex];
+	timeBase = pStream->time_base;
+	frameRate = av_guess_frame_rate(pFormat, pStream, nullptr);
+	byteSeek = !has_demuxer_index(pFormat, streamIndex) && 
+		!(pFormat->iformat->flags & AVFMT_NO_BYTE_SEEK);
+
+	/* Seeking works without it, only slower. */
+	if (open_seek_index(path, streamIndex) != EXIT_SUCCESS) {
+		fputs("Decoder: no keyframe index, seeking falls back to the demuxer.\n", stderr);
+	}
+
+	pCodec = avcodec_alloc_context3(pDecoder);
+	if (!pCodec) {
+		fputs("Decoder: failed to allocate the codec context.\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	ret = avcodec_parameters_to_context(pCodec, pStream->codecpar);
+	if (ret < 0) {
+		print_error("invalid codec parameters", ret);
+		return EXIT_FAILURE;
+	}
+	pCodec->pkt_timebase = pStream->time_base;
+	pCodec->thread_count = 0;	/* One slice/frame thread per core */
+
+	/* Page-aligned frames the renderer can import instead of copying. */
+	if (init_frame_pool(pCodec, FRAME_POOL_SIZE) != EXIT_SUCCESS) { return EXIT_FAILURE; }
+
+	ret = avcodec_open2(pCodec, pDecoder, nullptr);
+	if (ret < 0) {
+		print_error("failed to open the codec", ret);
+		return EXIT_FAILURE;
+	}
+	if (probed) { save_probe_info(pFormat, path, streamIndex); }
+
+	return EXIT_SUCCESS;
+}
+
+int 
+open_decoder(const char* path) 
+{
+	int ret = is_y4m_path(path) ? open_raw_input(path) : open_codec(path);
+	if (ret != EXIT_SUCCESS) { return EXIT_FAILURE; }
+
+	if (init_queue(&frames, FRAME_POOL_SIZE) != EXIT_SUCCESS || 
+		init_queue(&freeFrames, FRAME_POOL_SIZE) != EXIT_SUCCESS) {
+		fputs("Decoder: failed to allocate the frame queues.\n", stderr);
+		return EXIT_FAILURE;
+	}
+	sem_init(&freeCount, 0, FRAME_POOL_SIZE);
+	sem_init(&seekSignal, 0, 0);
+
+	for (size_t i = 0; i < FRAME_POOL_SIZE; ++i) {
+		frameStore[i] = av_frame_alloc();
+		if (!frameStore[i]) {
+			fputs("Decoder: failed to allocate frames.\n", stderr);
+			return EXIT_FAILURE;
+		}
+		queue_push(&freeFrames, frameStore[i]);
+	}
+
+	eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (eventFd == -1) {
+		perror("Decoder: failed to create the frame event");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int 
+start_decoder(void) 
+{
+	atomic_store(&stopping, false);
+	atomic_store(&finished, false);
+
+	thrd_start_t run = rawInput ? read_raw_video : decode_video;
+	if (thrd_create(&decoderThread, run, nullptr) != thrd_success) {
+		fputs("Decoder: failed to start the decoder thread.\n", stderr);
+		return EXIT_FAILURE;
+	}
+	started = true;
+
+	return EXIT_SUCCESS;
+}
+
+int 
+get_decoder_fd(void) 
+{
+	return eventFd;
+}
+
+void 
+drain_decoder_events(void) 
+{
+	uint64_t count;
+	[[maybe_unused]] ssize_t bytes = read(eventFd, &count, sizeof(count));
+}
+
+AVRational 
+get_time_base(void) 
+{
+	return timeBase;
+}
+
+AVRational 
+get_frame_rate(void) 
+{
+	return frameRate;
+}
+
+/* Starts decoding again from targetNs in stream time; called from the render thread. */
+void 
+request_seek(int64_t targetNs) 
+{
+	if (!started) { return; }
+
+	atomic_store(&seekTarget, targetNs < 0 ? 0 : targetNs);
+	atomic_fetch_add(&seekSerial, 1);
+	sem_post(&seekSignal);
+
+	/* Returning stale frames also wakes a decoder waiting for a free one. */
+	peek_frame();
+}
+
+AVFrame* 
+peek_frame(void) 
+{
+	if (!frames.slots) { return nullptr; }
+
+	unsigned serial = atomic_load(&seekSerial);
+	AVFrame* pFrame;
+	while ((pFrame = queue_peek(&frames)) && (uintptr_t) pFrame->opaque != serial) {
+		queue_pop(&frames);
+		release_frame(pFrame);
+	}
+
+	return pFrame;
+}
+
+AVFrame* 
+acquire_frame(void) 
+{
+	AVFrame* pFrame = peek_frame();
+	if (pFrame) { queue_pop(&frames); }
+
+	return pFrame;
+}
+
+void 
+release_frame(AVFrame* pFrame) 
+{
+	if (!pFrame) { return; }
+
+	av_frame_unref(pFrame);
+	queue_push(&freeFrames, pFrame);
+	sem_post(&freeCount);
+}
+
+bool 
+decoder_pending(void) 
+{
+	return peek_frame() != nullptr;
+}
+
+bool 
+decoder_finished(void) 
+{
+	return atomic_load(&finished) && !decoder_pending();
+}
+
+/* The renderer must have released every frame it acquired. */
+void 
+close_decoder(void) 
+{
+	if (started) {
+		atomic_store(&stopping, true);
+		sem_post(&freeCount);
+		sem_post(&seekSignal);
+		thrd_join(decoderThread, nullptr);
+		started = false;
+	}
+
+	close_queue(&frames);
+	if (freeFrames.slots) {
+		close_queue(&freeFrames);
+		sem_destroy(&freeCount);
+		sem_destroy(&seekSignal);
+	}
+	for (size_t i = 0; i < FRAME_POOL_SIZE; ++i) { av_frame_free(&frameStore[i]); }
+
+	if (eventFd != -1) {
+		close(eventFd);
+		eventFd = -1;
+	}
+
+	/* Mapped Y4M frames were unreferenced with frameStore above. */
+	if (rawInput) {
+		close_y4m_reader(&y4m);
+		rawInput = false;
+	}
+
+	close_seek_index();
+	avcodec_free_context(&pCodec);
+	close_frame_pool();
+	close_mapped_input(&pFormat);
+	streamIndex = -1;
+}
@@ -0,0 +1,50 @@
+#ifndef	DECODER_H
+#define	DECODER_H
+
+#include <stdint.h>
+
+#include <libavutil/frame.h>
+#include <libavutil/rational.h>
+
+int 
+open_decoder(const char* path);
+
+int 
+start_decoder(void);
+
+int 
+get_decoder_fd(void);
+
+void 
+drain_decoder_events(void);
+
+AVRational 
+get_time_base(void);
+
+AVRational 
+get_frame_rate(void);
+
+/* Consumer side, called only from the render thread */
+void 
+request_seek(int64_t targetNs);
+
+AVFrame* 
+peek_frame(void);
+
+AVFrame* 
+acquire_frame(void);
+
+/* Gives the frame back for reuse; its memory must no longer be read by the GPU. */
+void 
+release_frame(AVFrame* pFrame);
+
+bool 
+decoder_pending(void);
+
+bool 
+decoder_finished(void);
+
+void 
+close_decoder(void);
+
+#endif	/* DECODER_H */
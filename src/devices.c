@@ -5,8 +5,15 @@
 #include <vulkan/vulkan.h>
 
 #include "devices.h"
+#include "hostimport.h"
+#include "offscreen.h"
 #include "pipeline.h"
+#include "profiler.h"
+#include "readback.h"
+#include "scaler.h"
+#include "video.h"
 
+static bool headless;
 static VkPhysicalDevice physicalDevice;
 static VkPhysicalDeviceFeatures deviceFeatures;
 
@@ -17,6 +24,15 @@ typedef struct QueueFamilyIndices {
 } QueueFamilyIndices;
 static QueueFamilyIndices indices;
 
+/* Devices that passed the surface independent checks */
+#define MAX_CANDIDATE_DEVICES	8
+typedef struct CandidateDevices {
+	uint32_t count;
+	VkPhysicalDevice data[MAX_CANDIDATE_DEVICES];
+	bool probed;
+} CandidateDevices;
+static CandidateDevices candidates;
+
 static VkDevice logicalDevice;
 static VkQueue graphicsQueue;
 static VkQueue presentQueue;
@@ -24,6 +40,7 @@ static VkQueue presentQueue;
 const char* const deviceExtensions[] = {
 	VK_KHR_SWAPCHAIN_EXTENSION_NAME, 
 };
+static bool hostImportSupported;
 
 static VkSurfaceCapabilitiesKHR capabilities;
 
@@ -39,6 +56,7 @@ typedef struct PresentModes {
 } PresentModes;
 static PresentModes presentModes;
 
+static VkSurfaceKHR presentSurface;
 static VkSwapchainKHR swapChain;
 
 typedef struct SwapChainImages {
@@ -65,11 +83,39 @@ typedef struct SwapChainFramebuffers {
 static SwapChainFramebuffers swapChainFramebuffers;
 
 static VkCommandPool commandPool;
-static VkCommandBuffer commandBuffer;
 
-VkSemaphore imageAvailableSph;
-VkSemaphore renderFinishedSph;
-VkFence inFlightFence;
+/* Per frame in flight resources */
+typedef struct FrameSlot {
+	VkCommandBuffer commandBuffer;
+	VkSemaphore imageAvailableSph;
+	VkSemaphore renderFinishedSph;
+	VkFence inFlightFence;
+} FrameSlot;
+static FrameSlot frames[MAX_FRAMES_IN_FLIGHT];
+static uint32_t currentFrame;
+
+/* Pre-recorded command buffers, one per swapchain image */
+typedef struct ImageCommandBuffers {
+	uint32_t count;
+	VkCommandBuffer* data;
+	VkFence* inFlight;
+} ImageCommandBuffers;
+static ImageCommandBuffers imageCommands;
+static RecordMode recordMode = RECORD_PRERECORDED;
+/* Set when the swapchain or the record mode changes */
+static bool commandsDirty;
+
+/* Swapchain resources kept alive until no frame in flight references them */
+#define MAX_RETIRED_SWAPCHAINS	4
+typedef struct RetiredSwapChain {
+	VkSwapchainKHR swapChain;
+	SwapChainImgViews views;
+	SwapChainFramebuffers framebuffers;
+	ImageCommandBuffers commands;
+	uint32_t framesLeft;
+} RetiredSwapChain;
+static RetiredSwapChain retired[MAX_RETIRED_SWAPCHAINS];
+static VkExtent2D requestedExtent;
 
 void 
 find_queue_families(VkPhysicalDevice device, 
@@ -92,7 +138,13 @@ find_queue_families(VkPhysicalDevice device,
 			hasGraphicsFamily = true;
 		}
 
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &supportsPresent);
+		/* Offscreen rendering never presents. */
+		if (surface == VK_NULL_HANDLE) {
+			pIndices->presentFamily = i;
+			supportsPresent = true;
+		} else {
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &supportsPresent);
+		}
 
 		if ((pIndices->isComplete = hasGraphicsFamily && supportsPresent)) { break; }
 		hasGraphicsFamily = false;
@@ -128,6 +180,25 @@ check_device_extension_support(VkPhysicalDevice device)
 	return true;
 }
 
+bool 
+has_device_extension(VkPhysicalDevice device, const char* name) 
+{
+	uint32_t extensionCount;
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+	VkExtensionProperties availableExtensions[extensionCount];
+	vkEnumerateDeviceExtensionProperties(device, 
+					      nullptr, 
+					      &extensionCount, 
+					      availableExtensions);
+
+	for (size_t i = 0; i < extensionCount; ++i) {
+		if (strcmp(name, availableExtensions[i].extensionName) == 0) { return true; }
+	}
+
+	return false;
+}
+
 void 
 query_swapChain_support(VkPhysicalDevice device, VkSurfaceKHR surface) 
 {
@@ -172,6 +243,7 @@ bool
 is_device_suitable(VkPhysicalDevice device, VkSurfaceKHR surface) 
 {
 	find_queue_families(device, surface, &indices);
+	if (headless) { return indices.isComplete; }
 
 	bool extensionSupport = check_device_extension_support(device);
 
@@ -181,10 +253,13 @@ is_device_suitable(VkPhysicalDevice device, VkSurfaceKHR surface)
 	return indices.isComplete && extensionSupport && swapChainSupport;
 }
 
+/* Enumerates devices and filters out those that could never be used. None of 
+ * this needs a surface, so it may run before the Wayland handshake is done. */
 VkResult 
-pick_physical_device(VkInstance instance, VkSurfaceKHR surface) 
+probe_physical_devices(VkInstance instance) 
 {
-	physicalDevice = VK_NULL_HANDLE;
+	candidates.count = 0;
+	candidates.probed = true;
 
 	uint32_t deviceCount = 0;
 	vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
@@ -197,18 +272,40 @@ pick_physical_device(VkInstance instance, VkSurfaceKHR surface)
 	VkPhysicalDevice devices[deviceCount];
 	vkEnumeratePhysicalDevices(instance, &deviceCount, devices);
 
-	for (size_t i = 0; i < deviceCount; ++i) {
-		if (is_device_suitable(devices[i], surface)) {
-			physicalDevice = devices[i];
+	for (size_t i = 0; i < deviceCount && candidates.count < MAX_CANDIDATE_DEVICES; ++i) {
+		QueueFamilyIndices graphicsIndices;
+		find_queue_families(devices[i], VK_NULL_HANDLE, &graphicsIndices);
+		if (!graphicsIndices.isComplete) { continue; }
+		if (!headless && !check_device_extension_support(devices[i])) { continue; }
+
+		candidates.data[candidates.count++] = devices[i];
+	}
+
+	return VK_SUCCESS;
+}
+
+VkResult 
+pick_physical_device(VkInstance instance, VkSurfaceKHR surface) 
+{
+	physicalDevice = VK_NULL_HANDLE;
+
+	if (!candidates.probed) {
+		VkResult ret = probe_physical_devices(instance);
+		if (ret != VK_SUCCESS) { return ret; }
+	}
+
+	for (size_t i = 0; i < candidates.count; ++i) {
+		if (is_device_suitable(candidates.data[i], surface)) {
+			physicalDevice = candidates.data[i];
 			break;
 		}
-
-		if (physicalDevice == VK_NULL_HANDLE) {
-			fputs("Devices: failed to find a suitable GPU.\n", stderr);
-			return VK_ERROR_INITIALIZATION_FAILED;
-		} 
 	}
 
+	if (physicalDevice == VK_NULL_HANDLE) {
+		fputs("Devices: failed to find a suitable GPU.\n", stderr);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	} 
+
 	return VK_SUCCESS;
 }
 
@@ -234,14 +331,27 @@ create_logical_device()
 		queueCreateInfos[i].pQueuePriorities = &queuePriority;
 	}
 
+	const char* extensions[2];
+	uint32_t extensionCount = 0;
+	if (!headless) { extensions[extensionCount++] = VK_KHR_SWAPCHAIN_EXTENSION_NAME; }
+
+	/* Lets the GPU copy decoded frames straight out of decoder memory. */
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	hostImportSupported = properties.apiVersion >= VK_API_VERSION_1_1 && 
+		has_device_extension(physicalDevice, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+	if (hostImportSupported) {
+		extensions[extensionCount++] = VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME;
+	}
+
 	/* Create the logical device: */
 	VkDeviceCreateInfo createInfo = { };
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	createInfo.pQueueCreateInfos = queueCreateInfos;
 	createInfo.queueCreateInfoCount = uniqueQueues;
 	createInfo.pEnabledFeatures = &deviceFeatures;
-	createInfo.enabledExtensionCount = sizeof(deviceExtensions) / sizeof(const char*);
-	createInfo.ppEnabledExtensionNames = deviceExtensions;
+	createInfo.enabledExtensionCount = extensionCount;
+	createInfo.ppEnabledExtensionNames = extensions;
 	createInfo.ppEnabledLayerNames = nullptr;
 
 	if (vkCreateDevice(physicalDevice, 
@@ -282,15 +392,37 @@ choose_swap_present_mode(void)
 	return VK_PRESENT_MODE_FIFO_KHR;
 }
 
+VkExtent2D 
+choose_swap_extent(uint32_t width, uint32_t height) 
+{
+	if (capabilities.currentExtent.width != UINT32_MAX) { return capabilities.currentExtent; }
+
+	VkExtent2D actual = { width, height };
+	if (actual.width < capabilities.minImageExtent.width) {
+		actual.width = capabilities.minImageExtent.width;
+	} else if (actual.width > capabilities.maxImageExtent.width) {
+		actual.width = capabilities.maxImageExtent.width;
+	}
+	if (actual.height < capabilities.minImageExtent.height) {
+		actual.height = capabilities.minImageExtent.height;
+	} else if (actual.height > capabilities.maxImageExtent.height) {
+		actual.height = capabilities.maxImageExtent.height;
+	}
+
+	return actual;
+}
+
 VkResult 
-create_swapChain(VkSurfaceKHR surface, uint32_t width, uint32_t height) 
+create_swapChain(VkSurfaceKHR surface, 
+		 uint32_t width, 
+		 uint32_t height, 
+		 VkSwapchainKHR oldSwapChain) 
 {
 	VkSurfaceFormatKHR surfaceFormat = choose_swap_surface_format();
 
 	VkPresentModeKHR presentMode = choose_swap_present_mode();
 
-	extent.width = width;
-	extent.height = height;
+	extent = choose_swap_extent(width, height);
 
 	uint32_t imageCount = capabilities.minImageCount + 1;
 	if (capabilities.maxImageCount > 0 && imageCount > capabilities.maxImageCount) {
@@ -326,7 +458,7 @@ create_swapChain(VkSurfaceKHR surface, uint32_t width, uint32_t height)
 	createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 	createInfo.presentMode = presentMode;
 	createInfo.clipped = VK_TRUE;
-	createInfo.oldSwapchain = VK_NULL_HANDLE;
+	createInfo.oldSwapchain = oldSwapChain;
 
 	if (vkCreateSwapchainKHR(logicalDevice, 
 			  		&createInfo, 
@@ -398,7 +530,8 @@ create_render_pass(void)
 	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	colorAttachment.finalLayout = headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : 
+						 VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
 	VkAttachmentReference colorAttachmentRef = { };
 	colorAttachmentRef.attachment = 0;
@@ -409,13 +542,21 @@ create_render_pass(void)
 	subpass.colorAttachmentCount = 1;
 	subpass.pColorAttachments = &colorAttachmentRef;
 
-	VkSubpassDependency dependency = { };
-	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-	dependency.dstSubpass = 0;
-	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.srcAccessMask = 0;
-	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	VkSubpassDependency dependencies[2] = { };
+	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[0].dstSubpass = 0;
+	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[0].srcAccessMask = 0;
+	dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+	/* Offscreen targets are copied out right after the pass. */
+	dependencies[1].srcSubpass = 0;
+	dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
 
 	VkRenderPassCreateInfo renderPassInfo = { };
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -423,8 +564,8 @@ create_render_pass(void)
 	renderPassInfo.pAttachments = &colorAttachment;
 	renderPassInfo.subpassCount = 1;
 	renderPassInfo.pSubpasses = &subpass;
-	renderPassInfo.dependencyCount = 1;
-	renderPassInfo.pDependencies = &dependency;
+	renderPassInfo.dependencyCount = headless ? 2 : 1;
+	renderPassInfo.pDependencies = dependencies;
 
 	if (vkCreateRenderPass(logicalDevice, 
 				&renderPassInfo, 
@@ -498,14 +639,19 @@ create_command_buffer(void)
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	allocInfo.commandPool = commandPool;
 	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandBufferCount = 1;
+	allocInfo.commandBufferCount = MAX_FRAMES_IN_FLIGHT;
 
+	VkCommandBuffer commandBuffers[MAX_FRAMES_IN_FLIGHT];
 	if (vkAllocateCommandBuffers(logicalDevice, 
 				      &allocInfo, 
-				      &commandBuffer) != VK_SUCCESS) {
+				      commandBuffers) != VK_SUCCESS) {
 		fputs("Devices: failed to allocate command buffer.\n", stderr);
 		return VK_ERROR_INITIALIZATION_FAILED;
 	}
+
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+		frames[i].commandBuffer = commandBuffers[i];
+	}
 	return VK_SUCCESS;
 }
 
@@ -522,6 +668,10 @@ record_command_buffer(VkCommandBuffer commandBuffer, uint32_t imageIndex)
 		return VK_ERROR_INITIALIZATION_FAILED;
 	}
 
+	/* Video planes change every frame, so only per frame buffers sample them. */
+	bool video = recordMode == RECORD_PER_FRAME && 
+		     record_video_upload(commandBuffer, currentFrame) == VK_SUCCESS;
+
 	VkRenderPassBeginInfo renderPassInfo = { };
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 	renderPassInfo.renderPass = renderPass;
@@ -552,7 +702,9 @@ record_command_buffer(VkCommandBuffer commandBuffer, uint32_t imageIndex)
 	scissor.extent = extent;
 	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-	vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+	if (video && bind_video_frame(commandBuffer, get_pipeline_layout(), currentFrame)) {
+		vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+	}
 	vkCmdEndRenderPass(commandBuffer);
 
 	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
@@ -564,63 +716,239 @@ record_command_buffer(VkCommandBuffer commandBuffer, uint32_t imageIndex)
 }
 
 VkResult 
-create_sync_objects(void) 
+create_image_command_buffers(void) 
 {
-	VkSemaphoreCreateInfo semaphoreInfo = { };
-	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	imageCommands.data = malloc(images.count * sizeof(VkCommandBuffer));
+	imageCommands.inFlight = calloc(images.count, sizeof(VkFence));
+	if (!imageCommands.data || !imageCommands.inFlight) { 
+		return VK_ERROR_INITIALIZATION_FAILED; 
+	}
+	imageCommands.count = images.count;
 
-	VkFenceCreateInfo fenceInfo = { };
-	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+	VkCommandBufferAllocateInfo allocInfo = { };
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = commandPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = imageCommands.count;
 
-	if (vkCreateSemaphore(logicalDevice, 
-			       &semaphoreInfo, 
-			       nullptr, 
-			       &imageAvailableSph) != VK_SUCCESS || 
-		vkCreateSemaphore(logicalDevice, 
-			       &semaphoreInfo, 
-			       nullptr, 
-			       &renderFinishedSph) != VK_SUCCESS || 
-		vkCreateFence(logicalDevice, 
-				&fenceInfo, 
-				nullptr, 
-				&inFlightFence) != VK_SUCCESS) { 
-		fputs("Devices: failed to create semaphores.\n", stderr);
+	if (vkAllocateCommandBuffers(logicalDevice, 
+				      &allocInfo, 
+				      imageCommands.data) != VK_SUCCESS) {
+		fputs("Devices: failed to allocate per image command buffers.\n", stderr);
 		return VK_ERROR_INITIALIZATION_FAILED;
 	}
 
+	commandsDirty = true;
 	return VK_SUCCESS;
 }
 
 VkResult 
-setup_devices(VkInstance instance, 
-	      VkSurfaceKHR surface, 
-	      uint32_t width, 
-	      uint32_t height) 
+record_image_command_buffers(void) 
 {
-	VkResult ret;
+	/* None of the pre-recorded buffers may be pending while re-recording. */
+	for (size_t i = 0; i < imageCommands.count; ++i) {
+		VkFence fence = imageCommands.inFlight[i];
+		if (fence == VK_NULL_HANDLE) { continue; }
 
-	ret = pick_physical_device(instance, surface);
+		vkWaitForFences(logicalDevice, 1, &fence, VK_TRUE, UINT64_MAX);
+		imageCommands.inFlight[i] = VK_NULL_HANDLE;
+	}
+
+	for (size_t i = 0; i < imageCommands.count; ++i) {
+		vkResetCommandBuffer(imageCommands.data[i], 0);
+		if (record_command_buffer(imageCommands.data[i], i) != VK_SUCCESS) {
+			return VK_ERROR_UNKNOWN;
+		}
+	}
+
+	commandsDirty = false;
+	return VK_SUCCESS;
+}
+
+void 
+set_record_mode(RecordMode mode) 
+{
+	recordMode = mode;
+	commandsDirty = true;
+}
+
+void 
+destroy_retired_swapChain(RetiredSwapChain* pRetired) 
+{
+	if (pRetired->commands.count) {
+		vkFreeCommandBuffers(logicalDevice, 
+				      commandPool, 
+				      pRetired->commands.count, 
+				      pRetired->commands.data);
+		free(pRetired->commands.data);
+		free(pRetired->commands.inFlight);
+	}
+
+	for (size_t i = 0; i < pRetired->framebuffers.count; ++i) {
+		vkDestroyFramebuffer(logicalDevice, pRetired->framebuffers.data[i], nullptr);
+	}
+	free(pRetired->framebuffers.data);
+
+	for (size_t i = 0; i < pRetired->views.count; ++i) {
+		vkDestroyImageView(logicalDevice, pRetired->views.data[i], nullptr);
+	}
+	free(pRetired->views.data);
+
+	vkDestroySwapchainKHR(logicalDevice, pRetired->swapChain, nullptr);
+	*pRetired = (RetiredSwapChain) { };
+}
+
+void 
+release_retired_swapChains(void) 
+{
+	/* Called once per submitted frame, whose fence was waited first: after a 
+	 * full turn of the ring, every submission that used a retired swapchain 
+	 * has completed. Early returns must not count, as they do not advance 
+	 * the ring. */
+	for (size_t i = 0; i < MAX_RETIRED_SWAPCHAINS; ++i) {
+		if (retired[i].swapChain == VK_NULL_HANDLE) { continue; }
+		if (--retired[i].framesLeft == 0) { destroy_retired_swapChain(&retired[i]); }
+	}
+}
+
+RetiredSwapChain* 
+retire_swapChain(void) 
+{
+	RetiredSwapChain* pRetired = nullptr;
+	for (size_t i = 0; i < MAX_RETIRED_SWAPCHAINS && !pRetired; ++i) {
+		if (retired[i].swapChain == VK_NULL_HANDLE) { pRetired = &retired[i]; }
+	}
+
+	/* Resized faster than frames complete: drain the ring once. */
+	if (!pRetired) {
+		VkFence fences[MAX_FRAMES_IN_FLIGHT];
+		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+			fences[i] = frames[i].inFlightFence;
+		}
+		vkWaitForFences(logicalDevice, MAX_FRAMES_IN_FLIGHT, fences, VK_TRUE, UINT64_MAX);
+		for (size_t i = 0; i < MAX_RETIRED_SWAPCHAINS; ++i) {
+			destroy_retired_swapChain(&retired[i]);
+		}
+		pRetired = &retired[0];
+	}
+
+	pRetired->swapChain = swapChain;
+	pRetired->views = views;
+	pRetired->framebuffers = swapChainFramebuffers;
+	pRetired->commands = imageCommands;
+	pRetired->framesLeft = MAX_FRAMES_IN_FLIGHT;
+
+	swapChain = VK_NULL_HANDLE;
+	views = (SwapChainImgViews) { };
+	swapChainFramebuffers = (SwapChainFramebuffers) { };
+	imageCommands = (ImageCommandBuffers) { };
+	free(images.data);
+	images = (SwapChainImages) { };
+
+	return pRetired;
+}
+
+VkResult 
+recreate_swapChain(uint32_t width, uint32_t height) 
+{
+	requestedExtent.width = width;
+	requestedExtent.height = height;
+
+	/* Nothing to present into while minimized. */
+	if (!width || !height) { return VK_SUCCESS; }
+
+	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, presentSurface, &capabilities);
+
+	RetiredSwapChain* pRetired = retire_swapChain();
+
+	VkResult ret;
+	ret = create_swapChain(presentSurface, width, height, pRetired->swapChain);
 	if (ret != VK_SUCCESS) { return ret; }
 
-	ret = create_logical_device();
+	ret = create_image_views();
 	if (ret != VK_SUCCESS) { return ret; }
 
-	ret = create_swapChain(surface, width, height);
+	ret = create_framebuffers();
 	if (ret != VK_SUCCESS) { return ret; }
 
+	return create_image_command_buffers();
+}
+
+VkResult 
+create_sync_objects(void) 
+{
+	VkSemaphoreCreateInfo semaphoreInfo = { };
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+	VkFenceCreateInfo fenceInfo = { };
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+		if (vkCreateSemaphore(logicalDevice, 
+				       &semaphoreInfo, 
+				       nullptr, 
+				       &frames[i].imageAvailableSph) != VK_SUCCESS || 
+			vkCreateSemaphore(logicalDevice, 
+				       &semaphoreInfo, 
+				       nullptr, 
+				       &frames[i].renderFinishedSph) != VK_SUCCESS || 
+			vkCreateFence(logicalDevice, 
+					&fenceInfo, 
+					nullptr, 
+					&frames[i].inFlightFence) != VK_SUCCESS) { 
+			fputs("Devices: failed to create semaphores.\n", stderr);
+			return VK_ERROR_INITIALIZATION_FAILED;
+		}
+	}
+	currentFrame = 0;
+
+	return VK_SUCCESS;
+}
+
+VkResult 
+create_frame_resources(void) 
+{
+	VkResult ret;
+
 	ret = create_image_views();
 	if (ret != VK_SUCCESS) { return ret; }
 
 	ret = create_render_pass();
 	if (ret != VK_SUCCESS) { return ret; }
 
+	/* A missing cache only costs startup time. */
+	int span = profile_begin("create_pipeline_cache");
+	create_pipeline_cache(physicalDevice, logicalDevice);
+	profile_end(span);
+
+	span = profile_begin("create_graphics_pipeline");
 	ret = create_graphics_pipeline(logicalDevice, 
 					extent, 
 					renderPass, 
 					&graphicsPipeline);
+	profile_end(span);
+	if (ret != VK_SUCCESS) { return ret; }
+
+	ret = create_video_resources(physicalDevice, 
+				      logicalDevice, 
+				      get_descriptor_set_layout());
 	if (ret != VK_SUCCESS) { return ret; }
 
+	if (scaler_enabled()) {
+		span = profile_begin("create_scaler");
+		ret = create_scaler(physicalDevice, 
+				    logicalDevice, 
+				    indices.graphicsFamily, 
+				    get_descriptor_set_layout());
+		profile_end(span);
+		if (ret != VK_SUCCESS) { return ret; }
+	}
+
+	/* Without it, frames go through the staging ring. */
+	if (hostImportSupported) { init_host_import(physicalDevice, logicalDevice); }
+
+	span = profile_begin("create_command_resources");
 	ret = create_framebuffers();
 	if (ret != VK_SUCCESS) { return ret; }
 
@@ -633,30 +961,222 @@ setup_devices(VkInstance instance,
 	ret = create_sync_objects();
 	if (ret != VK_SUCCESS) { return ret; }
 
+	ret = create_image_command_buffers();
+	if (ret != VK_SUCCESS) { return ret; }
+
+	if (recordMode == RECORD_PRERECORDED) {
+		ret = record_image_command_buffers();
+		if (ret != VK_SUCCESS) { return ret; }
+	}
+	profile_end(span);
+
+	return VK_SUCCESS;
+}
+
+VkResult 
+setup_devices(VkInstance instance, 
+	      VkSurfaceKHR surface, 
+	      uint32_t width, 
+	      uint32_t height) 
+{
+	VkResult ret;
+	int span = profile_begin("setup_devices");
+
+	int step = profile_begin("pick_physical_device");
+	ret = pick_physical_device(instance, surface);
+	profile_end(step);
+	if (ret != VK_SUCCESS) { return ret; }
+
+	step = profile_begin("create_logical_device");
+	ret = create_logical_device();
+	profile_end(step);
+	if (ret != VK_SUCCESS) { return ret; }
+
+	presentSurface = surface;
+	requestedExtent.width = width;
+	requestedExtent.height = height;
+	step = profile_begin("create_swapChain");
+	ret = create_swapChain(surface, width, height, VK_NULL_HANDLE);
+	profile_end(step);
+	if (ret != VK_SUCCESS) { return ret; }
+
+	ret = create_frame_resources();
+	profile_end(span);
+
+	return ret;
+}
+
+VkResult 
+setup_headless_devices(VkInstance instance, 
+		       uint32_t width, 
+		       uint32_t height, 
+		       bool readback) 
+{
+	VkResult ret;
+	headless = true;
+	int span = profile_begin("setup_headless_devices");
+
+	int step = profile_begin("pick_physical_device");
+	ret = pick_physical_device(instance, VK_NULL_HANDLE);
+	profile_end(step);
+	if (ret != VK_SUCCESS) { return ret; }
+
+	step = profile_begin("create_logical_device");
+	ret = create_logical_device();
+	profile_end(step);
+	if (ret != VK_SUCCESS) { return ret; }
+
+	/* The offscreen ring replaces the swapchain, one image per frame in flight. */
+	swapChainFormat = VK_FORMAT_B8G8R8A8_UNORM;
+	extent.width = width;
+	extent.height = height;
+	images.data = (VkImage*) malloc(MAX_FRAMES_IN_FLIGHT * sizeof(VkImage));
+	if (!images.data) { return VK_ERROR_INITIALIZATION_FAILED; }
+	images.count = MAX_FRAMES_IN_FLIGHT;
+
+	step = profile_begin("create_offscreen_targets");
+	ret = create_offscreen_targets(physicalDevice, 
+					logicalDevice, 
+					swapChainFormat, 
+					extent, 
+					images.count, 
+					images.data);
+	profile_end(step);
+	if (ret != VK_SUCCESS) { return ret; }
+
+	if (readback) {
+		ret = create_readback_ring(physicalDevice, 
+					   logicalDevice, 
+					   indices.graphicsFamily, 
+					   extent);
+		if (ret != VK_SUCCESS) { return ret; }
+	}
+
+	ret = create_frame_resources();
+	profile_end(span);
+
+	return ret;
+}
+
+VkResult 
+draw_offscreen_frame(void) 
+{
+	FrameSlot* pFrame = &frames[currentFrame];
+
+	if (recordMode == RECORD_PRERECORDED && commandsDirty) {
+		if (record_image_command_buffers() != VK_SUCCESS) { return VK_ERROR_UNKNOWN; }
+	}
+
+	/* Offscreen target i is always rendered by frame slot i. */
+	vkWaitForFences(logicalDevice, 1, &pFrame->inFlightFence, VK_TRUE, UINT64_MAX);
+	/* Copies whose fence signalled are handed out before the fence is reused. */
+	poll_readbacks();
+	vkResetFences(logicalDevice, 1, &pFrame->inFlightFence);
+	imageCommands.inFlight[currentFrame] = pFrame->inFlightFence;
+
+	VkCommandBuffer commandBuffer;
+	if (recordMode == RECORD_PRERECORDED) {
+		commandBuffer = imageCommands.data[currentFrame];
+	} else {
+		commandBuffer = pFrame->commandBuffer;
+		vkResetCommandBuffer(commandBuffer, 0);
+		record_command_buffer(commandBuffer, currentFrame);
+	}
+
+	/* The copy rides in its own command buffer, so pre-recorded frames can be read back. */
+	VkCommandBuffer commandBuffers[] = { 
+		commandBuffer, 
+		record_readback(images.data[currentFrame]), 
+	};
+
+	VkSubmitInfo submitInfo = { };
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = (commandBuffers[1] != VK_NULL_HANDLE) ? 2 : 1;
+	submitInfo.pCommandBuffers = commandBuffers;
+
+	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, pFrame->inFlightFence) != VK_SUCCESS) {
+		fputs("Devices: failed to submit offscreen command buffer.\n", stderr);
+		cancel_readback();
+		return VK_ERROR_UNKNOWN;
+	}
+	submit_readback(pFrame->inFlightFence);
+
+	currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+
 	return VK_SUCCESS;
 }
 
 VkResult 
 draw_frame(void) 
 {
-	vkWaitForFences(logicalDevice, 1, &inFlightFence, VK_TRUE, UINT64_MAX);
-	vkResetFences(logicalDevice, 1, &inFlightFence);
+	if (headless) { return draw_offscreen_frame(); }
+
+	FrameSlot* pFrame = &frames[currentFrame];
+
+	if (recordMode == RECORD_PRERECORDED && commandsDirty) {
+		if (record_image_command_buffers() != VK_SUCCESS) { return VK_ERROR_UNKNOWN; }
+	}
+
+	/* Only blocks when the GPU is MAX_FRAMES_IN_FLIGHT frames behind. */
+	vkWaitForFences(logicalDevice, 1, &pFrame->inFlightFence, VK_TRUE, UINT64_MAX);
+
+	if (swapChain == VK_NULL_HANDLE) { return VK_NOT_READY; }
 
 	uint32_t imageIndex;
-	vkAcquireNextImageKHR(logicalDevice, 
-			       swapChain, 
-			       UINT64_MAX, 
-			       imageAvailableSph, 
-			       VK_NULL_HANDLE, 
-			       &imageIndex);
+	VkResult result = vkAcquireNextImageKHR(logicalDevice, 
+						 swapChain, 
+						 UINT64_MAX, 
+						 pFrame->imageAvailableSph, 
+						 VK_NULL_HANDLE, 
+						 &imageIndex);
+	if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+		if (recreate_swapChain(requestedExtent.width, 
+				       requestedExtent.height) != VK_SUCCESS) { 
+			return VK_ERROR_OUT_OF_DATE_KHR; 
+		}
+		if (swapChain == VK_NULL_HANDLE) { return VK_NOT_READY; }
+
+		if (recordMode == RECORD_PRERECORDED && 
+			record_image_command_buffers() != VK_SUCCESS) { 
+			return VK_ERROR_UNKNOWN; 
+		}
+
+		result = vkAcquireNextImageKHR(logicalDevice, 
+					        swapChain, 
+					        UINT64_MAX, 
+					        pFrame->imageAvailableSph, 
+					        VK_NULL_HANDLE, 
+					        &imageIndex);
+	}
+	if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+		fputs("Devices: failed to acquire a swapchain image.\n", stderr);
+		return result;
+	}
+	bool outdated = (result == VK_SUBOPTIMAL_KHR);
 
-	vkResetCommandBuffer(commandBuffer, 0);
-	record_command_buffer(commandBuffer, imageIndex);
+	/* Reset only once work is certain to be submitted with this fence. */
+	vkResetFences(logicalDevice, 1, &pFrame->inFlightFence);
+
+	/* A pre-recorded buffer must not be resubmitted while still pending. */
+	VkFence imageFence = imageCommands.inFlight[imageIndex];
+	if (imageFence != VK_NULL_HANDLE && imageFence != pFrame->inFlightFence) {
+		vkWaitForFences(logicalDevice, 1, &imageFence, VK_TRUE, UINT64_MAX);
+	}
+	imageCommands.inFlight[imageIndex] = pFrame->inFlightFence;
+
+	VkCommandBuffer commandBuffer;
+	if (recordMode == RECORD_PRERECORDED) {
+		commandBuffer = imageCommands.data[imageIndex];
+	} else {
+		commandBuffer = pFrame->commandBuffer;
+		vkResetCommandBuffer(commandBuffer, 0);
+		record_command_buffer(commandBuffer, imageIndex);
+	}
 
 	VkSubmitInfo submitInfo = { };
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-	VkSemaphore waitSemaphores[] = { imageAvailableSph  };
+	VkSemaphore waitSemaphores[] = { pFrame->imageAvailableSph  };
 	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
 	submitInfo.waitSemaphoreCount = 1;
 	submitInfo.pWaitSemaphores = waitSemaphores;
@@ -664,14 +1184,15 @@ draw_frame(void)
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &commandBuffer;
 
-	VkSemaphore signalSemaphores[] = { renderFinishedSph };
+	VkSemaphore signalSemaphores[] = { pFrame->renderFinishedSph };
 	submitInfo.signalSemaphoreCount = 1;
 	submitInfo.pSignalSemaphores = signalSemaphores;
 
-	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFence) != VK_SUCCESS) {
+	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, pFrame->inFlightFence) != VK_SUCCESS) {
 		fputs("Devices: failed to submit draw command buffer.\n", stderr);
 		return VK_ERROR_UNKNOWN;
 	}
+	release_retired_swapChains();
 
 	VkPresentInfoKHR presentInfo = { };
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -684,21 +1205,54 @@ draw_frame(void)
 	presentInfo.pImageIndices = &imageIndex;
 	presentInfo.pResults = nullptr;
 
-	vkQueuePresentKHR(presentQueue, &presentInfo);
+	result = vkQueuePresentKHR(presentQueue, &presentInfo);
+
+	currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+
+	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || outdated) {
+		return recreate_swapChain(requestedExtent.width, requestedExtent.height);
+	} else if (result != VK_SUCCESS) {
+		fputs("Devices: failed to present a swapchain image.\n", stderr);
+		return result;
+	}
 
 	return VK_SUCCESS;
 }
 
 void 
-close_devices() 
+finish_frames(void) 
 {
 	vkDeviceWaitIdle(logicalDevice);
 
-	vkDestroySemaphore(logicalDevice, renderFinishedSph, nullptr);
-	vkDestroySemaphore(logicalDevice, imageAvailableSph, nullptr);
-	vkDestroyFence(logicalDevice, inFlightFence, nullptr);
+	/* Hand out the copies still in flight, oldest first. */
+	if (headless) { poll_readbacks(); }
+}
+
+void 
+close_devices() 
+{
+	finish_frames();
+
+	for (size_t i = 0; i < MAX_RETIRED_SWAPCHAINS; ++i) {
+		if (retired[i].swapChain != VK_NULL_HANDLE) { 
+			destroy_retired_swapChain(&retired[i]); 
+		}
+	}
+
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+		vkDestroySemaphore(logicalDevice, frames[i].renderFinishedSph, nullptr);
+		vkDestroySemaphore(logicalDevice, frames[i].imageAvailableSph, nullptr);
+		vkDestroyFence(logicalDevice, frames[i].inFlightFence, nullptr);
+	}
 
 	vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
+	if (imageCommands.count) {
+		free(imageCommands.data);
+		free(imageCommands.inFlight);
+		imageCommands.data = nullptr;
+		imageCommands.inFlight = nullptr;
+		imageCommands.count = 0;
+	}
 
 	for (size_t i = 0; i < swapChainFramebuffers.count; ++i) {
 		vkDestroyFramebuffer(logicalDevice, swapChainFramebuffers.data[i], nullptr);
@@ -707,7 +1261,11 @@ close_devices()
 	swapChainFramebuffers.data = nullptr;
 	swapChainFramebuffers.count = 0;
 
+	close_scaler(logicalDevice);
+	close_video_resources(logicalDevice);
+	close_host_import(logicalDevice);
 	close_graphics_pipeline(logicalDevice, graphicsPipeline);
+	close_pipeline_cache(logicalDevice);
 	vkDestroyRenderPass(logicalDevice, renderPass, nullptr);
 
 	if (views.count) {
@@ -724,7 +1282,12 @@ close_devices()
 		images.data = nullptr;
 		images.count = 0;
 	}
-	vkDestroySwapchainKHR(logicalDevice, swapChain, nullptr);
+	if (headless) {
+		close_readback_ring(logicalDevice);
+		close_offscreen_targets(logicalDevice);
+	} else {
+		vkDestroySwapchainKHR(logicalDevice, swapChain, nullptr);
+	}
 
 	if (formats.count) {
 		free(formats.data);
@@ -3,15 +3,45 @@
 
 #include <vulkan/vulkan.h>
 
+/* Number of frames the CPU may record ahead of the GPU. */
+#ifndef	MAX_FRAMES_IN_FLIGHT
+#define	MAX_FRAMES_IN_FLIGHT	2
+#endif
+
+/* How draw_frame() obtains its command buffers */
+typedef enum RecordMode {
+	RECORD_PER_FRAME,	/* Re-record every frame. */
+	RECORD_PRERECORDED,	/* Clear only, recorded once per swapchain image; used until 
+				 * the first video frame arrives. */
+} RecordMode;
+
+VkResult 
+probe_physical_devices(VkInstance instance);
+
 VkResult 
 setup_devices(VkInstance instance, 
 	      VkSurfaceKHR surface, 
 	      uint32_t width, 
 	      uint32_t height);
 
+VkResult 
+setup_headless_devices(VkInstance instance, 
+		       uint32_t width, 
+		       uint32_t height, 
+		       bool readback);
+
+VkResult 
+recreate_swapChain(uint32_t width, uint32_t height);
+
 VkResult 
 draw_frame(void);
 
+void 
+finish_frames(void);
+
+void 
+set_record_mode(RecordMode mode);
+
 void 
 close_devices();
 
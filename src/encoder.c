@@ -0,0 +1,339 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/mathematics.h>
+#include <libswscale/swscale.h>
+#include <semaphore.h>
+
+#include "encoder.h"
+#include "queue.h"
+#include "y4m.h"
+
+static AVFormatContext* pOutput;
+static AVCodecContext* pEncoder;
+static AVStream* pStream;
+static AVPacket* pPacket;
+static bool headerWritten;
+
+/* Y4M output skips libav, like Y4M input does. */
+static Y4MWriter y4m;
+static bool rawOutput;
+
+static struct SwsContext* pScaler;
+static AVFrame* pEncodeFrame;
+static uint32_t frameHeight;
+static AVRational inputTimeBase;
+static AVRational codecTimeBase;
+static int64_t lastPts = AV_NOPTS_VALUE;
+
+/* Read back frames are converted straight out of the readback ring: the render 
+ * thread queues the slot, the encoder thread converts it and releases the slot. 
+ * At most one job per slot is outstanding, so jobs are indexed by slot. */
+typedef struct EncodeJob {
+	const ReadbackFrame*	pFrame;
+	int64_t			pts;
+} EncodeJob;
+static EncodeJob jobs[READBACK_SLOTS];
+static FrameQueue pending;
+static sem_t pendingCount;
+
+static thrd_t encoderThread;
+static bool started;
+static atomic_bool failed;
+
+static void 
+print_error(const char* message, int error) 
+{
+	char description[AV_ERROR_MAX_STRING_SIZE];
+	av_strerror(error, description, sizeof(description));
+	fprintf(stderr, "Encoder: %s: %s.\n", message, description);
+}
+
+static int 
+write_packets(void) 
+{
+	int ret;
+	while ((ret = avcodec_receive_packet(pEncoder, pPacket)) >= 0) {
+		av_packet_rescale_ts(pPacket, pEncoder->time_base, pStream->time_base);
+		pPacket->stream_index = pStream->index;
+		ret = av_interleaved_write_frame(pOutput, pPacket);
+		if (ret < 0) { return ret; }
+	}
+
+	return (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) ? 0 : ret;
+}
+
+static int 
+encode_frame(const EncodeJob* pJob) 
+{
+	int ret = av_frame_make_writable(pEncodeFrame);
+	if (ret < 0) {
+		readback_release(pJob->pFrame->slot);
+		return ret;
+	}
+
+	const uint8_t* planes[] = { pJob->pFrame->pPixels };
+	int strides[] = { (int) pJob->pFrame->stride };
+	sws_scale(pScaler, 
+		  planes, 
+		  strides, 
+		  0, 
+		  (int) frameHeight, 
+		  pEncodeFrame->data, 
+		  pEncodeFrame->linesize);
+	/* The pixels are not needed past the conversion. */
+	readback_release(pJob->pFrame->slot);
+	pEncodeFrame->pts = pJob->pts;
+
+	if (rawOutput) {
+		return write_y4m_frame(&y4m, pEncodeFrame) == EXIT_SUCCESS ? 0 : AVERROR(EIO);
+	}
+
+	ret = avcodec_send_frame(pEncoder, pEncodeFrame);
+	if (ret < 0) { return ret; }
+
+	return write_packets();
+}
+
+static int 
+encode_video(void* pData) 
+{
+	(void) pData;
+
+	int ret = 0;
+	for (;;) {
+		while (sem_wait(&pendingCount) == -1 && errno == EINTR) { }
+
+		/* close_encoder() wakes the thread once more with nothing queued. */
+		EncodeJob* pJob = queue_pop(&pending);
+		if (!pJob) { break; }
+
+		/* After an error slots are still released, so the render thread never waits. */
+		if (ret < 0) {
+			readback_release(pJob->pFrame->slot);
+		} else if ((ret = encode_frame(pJob)) < 0) {
+			print_error("failed to encode a frame", ret);
+			atomic_store(&failed, true);
+		}
+	}
+
+	/* Drain the frames the codec still holds for reordering. */
+	if (ret >= 0 && !rawOutput) {
+		ret = avcodec_send_frame(pEncoder, nullptr);
+		if (ret >= 0) { ret = write_packets(); }
+		if (ret < 0) { print_error("failed to flush the encoder", ret); }
+	}
+
+	return ret >= 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static AVFrame* 
+alloc_frame(enum AVPixelFormat format, uint32_t width, uint32_t height) 
+{
+	AVFrame* pFrame = av_frame_alloc();
+	if (!pFrame) { return nullptr; }
+
+	pFrame->format = format;
+	pFrame->width = (int) width;
+	pFrame->height = (int) height;
+	if (av_frame_get_buffer(pFrame, 0) < 0) { av_frame_free(&pFrame); }
+
+	return pFrame;
+}
+
+static int 
+open_codec_output(const char* path, uint32_t width, uint32_t height, AVRational frameRate) 
+{
+	int ret = avformat_alloc_output_context2(&pOutput, nullptr, nullptr, path);
+	if (ret < 0) {
+		print_error("unknown output format", ret);
+		return EXIT_FAILURE;
+	}
+
+	const AVCodec* pCodec = avcodec_find_encoder(pOutput->oformat->video_codec);
+	if (!pCodec) {
+		fputs("Encoder: no video encoder for this container.\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	pStream = avformat_new_stream(pOutput, nullptr);
+	pEncoder = avcodec_alloc_context3(pCodec);
+	pPacket = av_packet_alloc();
+	if (!pStream || !pEncoder || !pPacket) {
+		fputs("Encoder: failed to allocate the output.\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	pEncoder->width = (int) width;
+	pEncoder->height = (int) height;
+	pEncoder->pix_fmt = AV_PIX_FMT_YUV420P;
+	pEncoder->time_base = codecTimeBase;
+	pEncoder->framerate = frameRate;
+	/* What swscale produces from RGB by default */
+	pEncoder->color_range = AVCOL_RANGE_MPEG;
+	pEncoder->colorspace = AVCOL_SPC_SMPTE170M;
+	pEncoder->thread_count = 0;
+	if (pOutput->oformat->flags & AVFMT_GLOBALHEADER) {
+		pEncoder->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+	}
+
+	ret = avcodec_open2(pEncoder, pCodec, nullptr);
+	if (ret < 0) {
+		print_error("failed to open the encoder", ret);
+		return EXIT_FAILURE;
+	}
+
+	ret = avcodec_parameters_from_context(pStream->codecpar, pEncoder);
+	if (ret < 0) {
+		print_error("invalid encoder parameters", ret);
+		return EXIT_FAILURE;
+	}
+	pStream->time_base = codecTimeBase;
+
+	if (!(pOutput->oformat->flags & AVFMT_NOFILE)) {
+		ret = avio_open(&pOutput->pb, path, AVIO_FLAG_WRITE);
+		if (ret < 0) {
+			print_error("failed to open the output", ret);
+			return EXIT_FAILURE;
+		}
+	}
+
+	ret = avformat_write_header(pOutput, nullptr);
+	if (ret < 0) {
+		print_error("failed to write the header", ret);
+		return EXIT_FAILURE;
+	}
+	headerWritten = true;
+
+	return EXIT_SUCCESS;
+}
+
+/* Frames passed to encode_readback_frame() are BGRA, with pts in timeBase. The output 
+ * format follows from the file extension, .y4m is written without libav. */
+int 
+open_encoder(const char* path, 
+	     uint32_t width, 
+	     uint32_t height, 
+	     AVRational timeBase, 
+	     AVRational frameRate) 
+{
+	if (!frameRate.num || !frameRate.den) { frameRate = (AVRational) { 25, 1 }; }
+	frameHeight = height;
+	inputTimeBase = timeBase;
+	codecTimeBase = av_inv_q(frameRate);
+	lastPts = AV_NOPTS_VALUE;
+	atomic_store(&failed, false);
+
+	rawOutput = is_y4m_path(path);
+	if (rawOutput) {
+		Y4MFormat format = { };
+		format.width = width;
+		format.height = height;
+		format.frameRate = frameRate;
+		format.pixelFormat = AV_PIX_FMT_YUV420P;
+		if (open_y4m_writer(&y4m, path, &format) != EXIT_SUCCESS) { return EXIT_FAILURE; }
+	} else if (open_codec_output(path, width, height, frameRate) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	pScaler = sws_getContext((int) width, 
+				 (int) height, 
+				 AV_PIX_FMT_BGRA, 
+				 (int) width, 
+				 (int) height, 
+				 AV_PIX_FMT_YUV420P, 
+				 SWS_BILINEAR, 
+				 nullptr, 
+				 nullptr, 
+				 nullptr);
+	pEncodeFrame = alloc_frame(AV_PIX_FMT_YUV420P, width, height);
+	if (!pScaler || !pEncodeFrame) {
+		fputs("Encoder: failed to set up the color conversion.\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (init_queue(&pending, READBACK_SLOTS) != EXIT_SUCCESS) {
+		fputs("Encoder: failed to allocate the frame queue.\n", stderr);
+		return EXIT_FAILURE;
+	}
+	sem_init(&pendingCount, 0, 0);
+
+	if (thrd_create(&encoderThread, encode_video, nullptr) != thrd_success) {
+		fputs("Encoder: failed to start the encoder thread.\n", stderr);
+		return EXIT_FAILURE;
+	}
+	started = true;
+
+	return EXIT_SUCCESS;
+}
+
+/* Queues a read back frame without copying it; the encoder thread releases its 
+ * slot once converted. Called from the render thread, never blocks. */
+int 
+encode_readback_frame(const ReadbackFrame* pFrame, int64_t pts) 
+{
+	if (!started || atomic_load(&failed)) {
+		readback_release(pFrame->slot);
+		return EXIT_FAILURE;
+	}
+
+	/* Rounding to the codec time base must not produce duplicate timestamps. */
+	pts = av_rescale_q(pts, inputTimeBase, codecTimeBase);
+	if (lastPts != AV_NOPTS_VALUE && pts <= lastPts) { pts = lastPts + 1; }
+	lastPts = pts;
+
+	EncodeJob* pJob = &jobs[pFrame->slot];
+	pJob->pFrame = pFrame;
+	pJob->pts = pts;
+	queue_push(&pending, pJob);
+	sem_post(&pendingCount);
+
+	return EXIT_SUCCESS;
+}
+
+/* Encodes whatever is still queued, then finishes the file. */
+int 
+close_encoder(void) 
+{
+	int ret = started ? EXIT_SUCCESS : EXIT_FAILURE;
+	if (started) {
+		sem_post(&pendingCount);
+		thrd_join(encoderThread, &ret);
+		started = false;
+	}
+
+	if (pOutput) {
+		if (headerWritten && ret == EXIT_SUCCESS && av_write_trailer(pOutput) < 0) {
+			fputs("Encoder: failed to finish the output.\n", stderr);
+			ret = EXIT_FAILURE;
+		}
+		if (!(pOutput->oformat->flags & AVFMT_NOFILE)) { avio_closep(&pOutput->pb); }
+		avformat_free_context(pOutput);
+		pOutput = nullptr;
+		pStream = nullptr;
+		headerWritten = false;
+	}
+	if (rawOutput) {
+		if (close_y4m_writer(&y4m) != EXIT_SUCCESS) { ret = EXIT_FAILURE; }
+		rawOutput = false;
+	}
+
+	if (pending.slots) {
+		close_queue(&pending);
+		sem_destroy(&pendingCount);
+	}
+
+	av_frame_free(&pEncodeFrame);
+	sws_freeContext(pScaler);
+	pScaler = nullptr;
+	av_packet_free(&pPacket);
+	avcodec_free_context(&pEncoder);
+
+	return ret;
+}
@@ -0,0 +1,23 @@
+#ifndef	ENCODER_H
+#define	ENCODER_H
+
+#include <stdint.h>
+
+#include <libavutil/rational.h>
+
+#include "readback.h"
+
+int 
+open_encoder(const char* path, 
+	     uint32_t width, 
+	     uint32_t height, 
+	     AVRational timeBase, 
+	     AVRational frameRate);
+
+int 
+encode_readback_frame(const ReadbackFrame* pFrame, int64_t pts);
+
+int 
+close_encoder(void);
+
+#endif	/* ENCODER_H */
@@ -0,0 +1,204 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <unistd.h>
+
+#include "framepool.h"
+
+#define PLANE_ALIGN		64
+/* Frames a codec may keep for reference or reordering, on top of those in flight */
+#define MAX_CODEC_FRAMES	16
+
+/* A bounded set of page-aligned, page-sized buffers holding one decoded frame each, 
+ * all planes inside, so the renderer can import them as device memory. Buffers are 
+ * allocated on first use up to the cap and never freed before close_frame_pool(), 
+ * so steady-state decoding allocates no frame memory and imports stay valid. */
+typedef struct FramePool {
+	uint32_t count;		/* Buffers allocated so far */
+	uint32_t capacity;
+	uint32_t freeCount;
+	uint8_t* data[MAX_POOL_BUFFERS];
+	uint8_t* freeList[MAX_POOL_BUFFERS];
+	size_t bufferSize;
+} FramePool;
+static FramePool pool;
+static mtx_t poolMutex;
+static bool poolReady;
+static size_t pageSize;
+
+/* Frame layout shared by sizing and allocation */
+typedef struct FrameLayout {
+	int linesizes[4];
+	size_t planeSizes[4];
+	size_t size;
+} FrameLayout;
+
+static int 
+compute_frame_layout(AVCodecContext* pCodec, 
+		     enum AVPixelFormat pixelFormat, 
+		     int width, 
+		     int height, 
+		     FrameLayout* pLayout) 
+{
+	int strideAlign[AV_NUM_DATA_POINTERS];
+	avcodec_align_dimensions2(pCodec, &width, &height, strideAlign);
+
+	if (av_image_fill_linesizes(pLayout->linesizes, pixelFormat, width) < 0) { return -1; }
+
+	ptrdiff_t strides[4];
+	for (size_t i = 0; i < 4; ++i) {
+		int align = strideAlign[i] > PLANE_ALIGN ? strideAlign[i] : PLANE_ALIGN;
+		pLayout->linesizes[i] = (pLayout->linesizes[i] + align - 1) / align * align;
+		strides[i] = pLayout->linesizes[i];
+	}
+
+	if (av_image_fill_plane_sizes(pLayout->planeSizes, pixelFormat, height, strides) < 0) {
+		return -1;
+	}
+
+	/* Codecs may read a little past the last row. */
+	pLayout->size = PLANE_ALIGN;
+	for (size_t i = 0; i < 4; ++i) {
+		pLayout->size += (pLayout->planeSizes[i] + PLANE_ALIGN - 1) & 
+				 ~(size_t) (PLANE_ALIGN - 1);
+	}
+	pLayout->size = (pLayout->size + pageSize - 1) & ~(pageSize - 1);
+
+	return 0;
+}
+
+static void 
+return_pooled_buffer(void* pOpaque, uint8_t* pData) 
+{
+	(void) pOpaque;
+
+	mtx_lock(&poolMutex);
+	pool.freeList[pool.freeCount++] = pData;
+	mtx_unlock(&poolMutex);
+}
+
+static uint8_t* 
+take_pooled_buffer(void) 
+{
+	mtx_lock(&poolMutex);
+
+	uint8_t* pData = nullptr;
+	if (pool.freeCount) {
+		pData = pool.freeList[--pool.freeCount];
+	} else if (pool.count < pool.capacity) {
+		void* pNew;
+		if (posix_memalign(&pNew, pageSize, pool.bufferSize) == 0) {
+			pData = pNew;
+			pool.data[pool.count++] = pData;
+		}
+	}
+
+	mtx_unlock(&poolMutex);
+	return pData;
+}
+
+/* May run on any of the codec's frame threads. */
+static int 
+get_pooled_frame(AVCodecContext* pCodec, AVFrame* pFrame, int flags) 
+{
+	const AVPixFmtDescriptor* pDescriptor = av_pix_fmt_desc_get(pFrame->format);
+	if (!(pCodec->codec->capabilities & AV_CODEC_CAP_DR1) || 
+		!pDescriptor || (pDescriptor->flags & AV_PIX_FMT_FLAG_HWACCEL)) {
+		return avcodec_default_get_buffer2(pCodec, pFrame, flags);
+	}
+
+	/* Frames larger than the stream announced, or an exhausted pool, fall back 
+	 * to the default allocator: slower, but never a stall. */
+	FrameLayout layout;
+	if (compute_frame_layout(pCodec, 
+				 pFrame->format, 
+				 pFrame->width, 
+				 pFrame->height, 
+				 &layout) < 0 || 
+		layout.size > pool.bufferSize) {
+		return avcodec_default_get_buffer2(pCodec, pFrame, flags);
+	}
+
+	uint8_t* pData = take_pooled_buffer();
+	if (!pData) { return avcodec_default_get_buffer2(pCodec, pFrame, flags); }
+
+	/* The pool itself is the opaque pointer, marking the buffer as pooled. */
+	pFrame->buf[0] = av_buffer_create(pData, 
+					  pool.bufferSize, 
+					  return_pooled_buffer, 
+					  &pool, 
+					  0);
+	if (!pFrame->buf[0]) {
+		return_pooled_buffer(nullptr, pData);
+		return AVERROR(ENOMEM);
+	}
+
+	for (size_t i = 0; i < 4 && layout.planeSizes[i]; ++i) {
+		pFrame->data[i] = pData;
+		pFrame->linesize[i] = layout.linesizes[i];
+		pData += (layout.planeSizes[i] + PLANE_ALIGN - 1) & ~(size_t) (PLANE_ALIGN - 1);
+	}
+	pFrame->extended_data = pFrame->data;
+
+	return 0;
+}
+
+/* Pooled buffers stay allocated until close_frame_pool(), so they may be imported. */
+bool 
+is_pooled_buffer(const AVBufferRef* pBuffer) 
+{
+	return av_buffer_get_opaque(pBuffer) == &pool;
+}
+
+/* frameCount is the number of decoded frames held outside the codec at once. */
+int 
+init_frame_pool(AVCodecContext* pCodec, uint32_t frameCount) 
+{
+	long page = sysconf(_SC_PAGESIZE);
+	pageSize = page > 0 ? (size_t) page : 4096;
+
+	/* Sized from what the container announced; nothing to pool if it did not say. */
+	FrameLayout layout;
+	if (pCodec->width <= 0 || pCodec->height <= 0 || 
+		compute_frame_layout(pCodec, 
+				     pCodec->pix_fmt, 
+				     pCodec->width, 
+				     pCodec->height, 
+				     &layout) < 0) {
+		return EXIT_SUCCESS;
+	}
+
+	if (mtx_init(&poolMutex, mtx_plain) != thrd_success) {
+		fputs("FramePool: failed to create the pool lock.\n", stderr);
+		return EXIT_FAILURE;
+	}
+	poolReady = true;
+
+	uint32_t threads = pCodec->thread_count > 0 ? pCodec->thread_count : 
+			   (uint32_t) sysconf(_SC_NPROCESSORS_ONLN);
+	pool.capacity = frameCount + MAX_CODEC_FRAMES + threads;
+	if (pool.capacity > MAX_POOL_BUFFERS) { pool.capacity = MAX_POOL_BUFFERS; }
+	pool.bufferSize = layout.size;
+
+	pCodec->get_buffer2 = get_pooled_frame;
+
+	return EXIT_SUCCESS;
+}
+
+/* Every frame must have been freed, and the codec closed, before this runs. */
+void 
+close_frame_pool(void) 
+{
+	if (!poolReady) { return; }
+
+	for (size_t i = 0; i < pool.count; ++i) { free(pool.data[i]); }
+	pool = (FramePool) { };
+	mtx_destroy(&poolMutex);
+	poolReady = false;
+}
@@ -0,0 +1,20 @@
+#ifndef	FRAMEPOOL_H
+#define	FRAMEPOOL_H
+
+#include <stdint.h>
+
+#include <libavcodec/avcodec.h>
+
+/* Most buffers a pool ever allocates; also bounds the host imports made of them. */
+#define MAX_POOL_BUFFERS	64
+
+int 
+init_frame_pool(AVCodecContext* pCodec, uint32_t frameCount);
+
+bool 
+is_pooled_buffer(const AVBufferRef* pBuffer);
+
+void 
+close_frame_pool(void);
+
+#endif	/* FRAMEPOOL_H */
@@ -0,0 +1,160 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vulkan/vulkan.h>
+
+#include "buffers.h"
+#include "framepool.h"
+#include "hostimport.h"
+
+/* Host allocations wrapped as transfer sources through VK_EXT_external_memory_host. 
+ * The host memory must outlive its import, so callers only pass frame pool buffers, 
+ * which outlive the renderer; one entry per buffer the pool may hold. */
+#define MAX_HOST_IMPORTS	MAX_POOL_BUFFERS
+typedef struct HostImport {
+	void* pHost;
+	VkDeviceSize size;
+	VkBuffer buffer;	/* VK_NULL_HANDLE if the driver refused the pointer */
+	VkDeviceMemory memory;
+} HostImport;
+
+typedef struct HostImports {
+	uint32_t count;
+	HostImport data[MAX_HOST_IMPORTS];
+} HostImports;
+static HostImports imports;
+
+static VkPhysicalDevice importPhysicalDevice;
+static VkDevice importDevice;
+static VkDeviceSize importAlignment;
+static PFN_vkGetMemoryHostPointerPropertiesEXT pfnGetMemoryHostPointerProperties;
+
+VkResult 
+init_host_import(VkPhysicalDevice physicalDevice, VkDevice device) 
+{
+	VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProperties = { };
+	hostProperties.sType = 
+		VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+
+	VkPhysicalDeviceProperties2 properties = { };
+	properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	properties.pNext = &hostProperties;
+	vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+	pfnGetMemoryHostPointerProperties = (PFN_vkGetMemoryHostPointerPropertiesEXT) 
+		vkGetDeviceProcAddr(device, "vkGetMemoryHostPointerPropertiesEXT");
+	if (!pfnGetMemoryHostPointerProperties) {
+		fputs("HostImport: vkGetMemoryHostPointerPropertiesEXT is missing.\n", stderr);
+		return VK_ERROR_EXTENSION_NOT_PRESENT;
+	}
+
+	importPhysicalDevice = physicalDevice;
+	importDevice = device;
+	importAlignment = hostProperties.minImportedHostPointerAlignment;
+
+	return VK_SUCCESS;
+}
+
+bool 
+host_import_enabled(void) 
+{
+	return pfnGetMemoryHostPointerProperties != nullptr;
+}
+
+VkDeviceSize 
+get_host_import_alignment(void) 
+{
+	return importAlignment;
+}
+
+VkResult 
+create_host_import(HostImport* pImport) 
+{
+	VkMemoryHostPointerPropertiesEXT pointerProperties = { };
+	pointerProperties.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+	if (pfnGetMemoryHostPointerProperties(importDevice, 
+					       VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, 
+					       pImport->pHost, 
+					       &pointerProperties) != VK_SUCCESS) {
+		return VK_ERROR_INVALID_EXTERNAL_HANDLE;
+	}
+
+	VkExternalMemoryBufferCreateInfo externalInfo = { };
+	externalInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+	externalInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+
+	VkBufferCreateInfo bufferInfo = { };
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.pNext = &externalInfo;
+	bufferInfo.size = pImport->size;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(importDevice, &bufferInfo, nullptr, &pImport->buffer) != VK_SUCCESS) {
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(importDevice, pImport->buffer, &memRequirements);
+
+	VkImportMemoryHostPointerInfoEXT importInfo = { };
+	importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+	importInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+	importInfo.pHostPointer = pImport->pHost;
+
+	VkMemoryAllocateInfo allocInfo = { };
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.pNext = &importInfo;
+	allocInfo.allocationSize = pImport->size;
+
+	if (find_memory_type(importPhysicalDevice, 
+			      memRequirements.memoryTypeBits & pointerProperties.memoryTypeBits, 
+			      0, 
+			      &allocInfo.memoryTypeIndex) != VK_SUCCESS || 
+		vkAllocateMemory(importDevice, 
+				 &allocInfo, 
+				 nullptr, 
+				 &pImport->memory) != VK_SUCCESS) {
+		vkDestroyBuffer(importDevice, pImport->buffer, nullptr);
+		pImport->buffer = VK_NULL_HANDLE;
+		return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+	}
+	vkBindBufferMemory(importDevice, pImport->buffer, pImport->memory, 0);
+
+	return VK_SUCCESS;
+}
+
+/* Each allocation is imported on first use and found by address afterwards. */
+VkBuffer 
+import_host_buffer(void* pHost, VkDeviceSize size) 
+{
+	if (!host_import_enabled()) { return VK_NULL_HANDLE; }
+	if ((uintptr_t) pHost % importAlignment || size % importAlignment) { return VK_NULL_HANDLE; }
+
+	for (size_t i = 0; i < imports.count; ++i) {
+		HostImport* pImport = &imports.data[i];
+		if (pImport->pHost == pHost && pImport->size == size) { return pImport->buffer; }
+	}
+	if (imports.count == MAX_HOST_IMPORTS) { return VK_NULL_HANDLE; }
+
+	HostImport* pImport = &imports.data[imports.count++];
+	pImport->pHost = pHost;
+	pImport->size = size;
+	if (create_host_import(pImport) != VK_SUCCESS) {
+		fputs("HostImport: driver refused a decoder buffer, staging it instead.\n", stderr);
+	}
+
+	return pImport->buffer;
+}
+
+void 
+close_host_import(VkDevice device) 
+{
+	for (size_t i = 0; i < imports.count; ++i) {
+		vkDestroyBuffer(device, imports.data[i].buffer, nullptr);
+		vkFreeMemory(device, imports.data[i].memory, nullptr);
+	}
+	imports.count = 0;
+	pfnGetMemoryHostPointerProperties = nullptr;
+}
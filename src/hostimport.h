@@ -0,0 +1,21 @@
+#ifndef	HOSTIMPORT_H
+#define	HOSTIMPORT_H
+
+#include <vulkan/vulkan.h>
+
+VkResult 
+init_host_import(VkPhysicalDevice physicalDevice, VkDevice device);
+
+bool 
+host_import_enabled(void);
+
+VkDeviceSize 
+get_host_import_alignment(void);
+
+VkBuffer 
+import_host_buffer(void* pHost, VkDeviceSize size);
+
+void 
+close_host_import(VkDevice device);
+
+#endif	/* HOSTIMPORT_H */
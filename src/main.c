@@ -1,14 +1,89 @@
-#include <libgen.h>
+#include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
+#include <string.h>
 
 #include "controller.h"
 
+static void 
+print_usage(const char* program) 
+{
+	fprintf(stderr, 
+		"Usage: %s [--headless[=FRAMES]] [--readback] [--shm] [--size=WIDTHxHEIGHT]\n"
+		"          [--scale=WIDTHxHEIGHT[:bilinear|bicubic|lanczos]] [FILE]\n"
+		"       %s [--scale=...] --transcode INPUT OUTPUT\n", 
+		program, 
+		program);
+}
+
+/* WIDTHxHEIGHT, optionally followed by :FILTER; Lanczos by default */
+static int 
+parse_scale(const char* value, AppOptions* pOptions) 
+{
+	pOptions->scaleFilter = SCALE_LANCZOS3;
+
+	int length = 0;
+	if (sscanf(value, "%ux%u%n", &pOptions->scaleWidth, &pOptions->scaleHeight, &length) != 2 || 
+		!pOptions->scaleWidth || !pOptions->scaleHeight) {
+		return EXIT_FAILURE;
+	}
+
+	value += length;
+	if (*value == '\0') { return EXIT_SUCCESS; }
+	if (*value != ':') { return EXIT_FAILURE; }
+
+	return parse_scale_filter(value + 1, &pOptions->scaleFilter);
+}
+
+static int 
+parse_options(int argc, char* argv[], AppOptions* pOptions) 
+{
+	pOptions->frames = 1000;
+	pOptions->width = 800;
+	pOptions->height = 600;
+
+	for (int i = 1; i < argc; ++i) {
+		const char* arg = argv[i];
+
+		if (strcmp(arg, "--headless") == 0) {
+			pOptions->headless = true;
+		} else if (strncmp(arg, "--headless=", 11) == 0) {
+			pOptions->headless = true;
+			pOptions->frames = (uint32_t) strtoul(arg + 11, nullptr, 10);
+		} else if (strcmp(arg, "--transcode") == 0) {
+			if (i + 2 >= argc) { return EXIT_FAILURE; }
+			pOptions->transcode = true;
+			pOptions->input = argv[++i];
+			pOptions->output = argv[++i];
+		} else if (strcmp(arg, "--readback") == 0) {
+			pOptions->readback = true;
+		} else if (strcmp(arg, "--shm") == 0) {
+			pOptions->shm = true;
+		} else if (strncmp(arg, "--size=", 7) == 0) {
+			if (sscanf(arg + 7, "%ux%u", &pOptions->width, &pOptions->height) != 2 || 
+				!pOptions->width || !pOptions->height) {
+				return EXIT_FAILURE;
+			}
+		} else if (strncmp(arg, "--scale=", 8) == 0) {
+			if (parse_scale(arg + 8, pOptions) != EXIT_SUCCESS) { return EXIT_FAILURE; }
+		} else if ((arg[0] != '-' || strcmp(arg, "-") == 0) && !pOptions->input) {
+			/* "-" reads a Y4M stream from stdin. */
+			pOptions->input = arg;
+		} else {
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
 int 
 main(int argc, char* argv[])
 {
-	const char* appPath = dirname(argv[0]);
-	chdir(appPath);
+	AppOptions options = { };
+	if (parse_options(argc, argv, &options) != EXIT_SUCCESS) {
+		print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
 
-	return run_app();
+	return run_app(&options);
 }
@@ -0,0 +1,195 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <libavformat/avformat.h>
+#include <libavutil/mem.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mmapio.h"
+
+/* The demuxer reads through this; 256 KiB keeps large packets to one callback. */
+#define IO_BUFFER_SIZE		(256 * 1024)
+/* How far ahead of the read position the kernel is asked to fault pages in */
+#define READAHEAD_WINDOW	(8 * 1024 * 1024)
+
+/* A read-only view of a whole local file, served to libavformat instead of read() */
+typedef struct MappedFile {
+	const uint8_t*	pData;
+	size_t		size;
+	size_t		pos;
+	size_t		advisedEnd;	/* Readahead already requested up to here */
+	size_t		pageSize;
+} MappedFile;
+
+static void 
+advise_readahead(MappedFile* pFile) 
+{
+	if (pFile->pos + READAHEAD_WINDOW / 2 < pFile->advisedEnd || 
+		pFile->advisedEnd >= pFile->size) {
+		return;
+	}
+
+	/* Start at the page holding pos after a seek, else where the last window ended. */
+	size_t start = pFile->advisedEnd > pFile->pos ? pFile->advisedEnd : pFile->pos;
+	start &= ~(pFile->pageSize - 1);
+	size_t end = start + READAHEAD_WINDOW;
+	if (end > pFile->size) { end = pFile->size; }
+
+	posix_madvise((void*) (pFile->pData + start), end - start, POSIX_MADV_WILLNEED);
+	pFile->advisedEnd = end;
+}
+
+static int 
+read_mapped(void* pOpaque, uint8_t* pBuffer, int size) 
+{
+	MappedFile* pFile = pOpaque;
+	if (pFile->pos >= pFile->size) { return AVERROR_EOF; }
+
+	size_t count = pFile->size - pFile->pos;
+	if (count > (size_t) size) { count = (size_t) size; }
+
+	memcpy(pBuffer, pFile->pData + pFile->pos, count);
+	pFile->pos += count;
+	advise_readahead(pFile);
+
+	return (int) count;
+}
+
+static int64_t 
+seek_mapped(void* pOpaque, int64_t offset, int whence) 
+{
+	MappedFile* pFile = pOpaque;
+
+	int64_t base;
+	switch (whence & ~AVSEEK_FORCE) {
+	case AVSEEK_SIZE:
+		return (int64_t) pFile->size;
+	case SEEK_SET:
+		base = 0;
+		break;
+	case SEEK_CUR:
+		base = (int64_t) pFile->pos;
+		break;
+	case SEEK_END:
+		base = (int64_t) pFile->size;
+		break;
+	default:
+		return AVERROR(EINVAL);
+	}
+
+	int64_t pos = base + offset;
+	if (pos < 0) { return AVERROR(EINVAL); }
+
+	/* Reads past the end return EOF, like read() on the file would. */
+	pFile->pos = (size_t) pos;
+	pFile->advisedEnd = pFile->pos;
+	advise_readahead(pFile);
+
+	return pos;
+}
+
+static void 
+unmap_file(MappedFile* pFile) 
+{
+	munmap((void*) pFile->pData, pFile->size);
+	free(pFile);
+}
+
+/* avformat_close_input() leaves custom I/O to its owner. */
+static void 
+free_mapped_io(AVIOContext** ppIO) 
+{
+	MappedFile* pFile = (*ppIO)->opaque;
+	av_freep(&(*ppIO)->buffer);
+	avio_context_free(ppIO);
+	unmap_file(pFile);
+}
+
+static MappedFile* 
+map_file(const char* path) 
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) { return nullptr; }
+
+	/* Pipes, devices and empty files keep the buffered read() path. */
+	struct stat st;
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+		close(fd);
+		return nullptr;
+	}
+
+	void* pData = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (pData == MAP_FAILED) { return nullptr; }
+
+	MappedFile* pFile = calloc(1, sizeof(MappedFile));
+	if (!pFile) {
+		munmap(pData, (size_t) st.st_size);
+		return nullptr;
+	}
+	pFile->pData = pData;
+	pFile->size = (size_t) st.st_size;
+	pFile->pageSize = (size_t) sysconf(_SC_PAGESIZE);
+
+	/* Demuxing reads front to back: read ahead aggressively, drop pages behind. */
+	posix_madvise(pData, pFile->size, POSIX_MADV_SEQUENTIAL);
+	advise_readahead(pFile);
+
+	return pFile;
+}
+
+/* Opens a local file through an mmap-backed AVIOContext. Anything that cannot be 
+ * mapped is opened by libavformat as usual. Returns an AVERROR code. */
+int 
+open_mapped_input(AVFormatContext** ppFormat, const char* path) 
+{
+	MappedFile* pFile = map_file(path);
+	if (!pFile) { return avformat_open_input(ppFormat, path, nullptr, nullptr); }
+
+	uint8_t* pBuffer = av_malloc(IO_BUFFER_SIZE);
+	AVIOContext* pIO = nullptr;
+	if (pBuffer) {
+		pIO = avio_alloc_context(pBuffer, 
+					 IO_BUFFER_SIZE, 
+					 0, 
+					 pFile, 
+					 read_mapped, 
+					 nullptr, 
+					 seek_mapped);
+	}
+	if (!pIO) {
+		av_free(pBuffer);
+		unmap_file(pFile);
+		return AVERROR(ENOMEM);
+	}
+
+	*ppFormat = avformat_alloc_context();
+	if (!*ppFormat) {
+		free_mapped_io(&pIO);
+		return AVERROR(ENOMEM);
+	}
+	(*ppFormat)->pb = pIO;
+	(*ppFormat)->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+	/* The path still names the input for format probing by extension. */
+	int ret = avformat_open_input(ppFormat, path, nullptr, nullptr);
+	if (ret < 0) { free_mapped_io(&pIO); }
+
+	return ret;
+}
+
+void 
+close_mapped_input(AVFormatContext** ppFormat) 
+{
+	if (!*ppFormat) { return; }
+
+	AVIOContext* pIO = ((*ppFormat)->flags & AVFMT_FLAG_CUSTOM_IO) ? (*ppFormat)->pb : nullptr;
+	avformat_close_input(ppFormat);
+	if (pIO) { free_mapped_io(&pIO); }
+}
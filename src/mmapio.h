@@ -0,0 +1,12 @@
+#ifndef	MMAPIO_H
+#define	MMAPIO_H
+
+#include <libavformat/avformat.h>
+
+int 
+open_mapped_input(AVFormatContext** ppFormat, const char* path);
+
+void 
+close_mapped_input(AVFormatContext** ppFormat);
+
+#endif	/* MMAPIO_H */
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vulkan/vulkan.h>
+
+#include "buffers.h"
+#include "offscreen.h"
+
+/* Offscreen color target, standing in for a swapchain image */
+typedef struct OffscreenTarget {
+	VkImage image;
+	VkDeviceMemory memory;
+} OffscreenTarget;
+
+typedef struct OffscreenTargets {
+	uint32_t count;
+	OffscreenTarget* data;
+} OffscreenTargets;
+static OffscreenTargets targets;
+
+VkResult 
+create_offscreen_targets(VkPhysicalDevice physicalDevice, 
+			 VkDevice device, 
+			 VkFormat format, 
+			 VkExtent2D extent, 
+			 uint32_t count, 
+			 VkImage* pImages) 
+{
+	targets.data = calloc(count, sizeof(OffscreenTarget));
+	if (!targets.data) { return VK_ERROR_INITIALIZATION_FAILED; }
+	targets.count = count;
+
+	VkImageUsageFlags usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | 
+				  VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
+	for (size_t i = 0; i < count; ++i) {
+		OffscreenTarget* pTarget = &targets.data[i];
+
+		if (create_image(physicalDevice, 
+				  device, 
+				  extent, 
+				  format, 
+				  usage, 
+				  &pTarget->image, 
+				  &pTarget->memory) != VK_SUCCESS) {
+			fputs("Offscreen: failed to create render targets.\n", stderr);
+			return VK_ERROR_INITIALIZATION_FAILED;
+		}
+		pImages[i] = pTarget->image;
+	}
+
+	return VK_SUCCESS;
+}
+
+void 
+close_offscreen_targets(VkDevice device) 
+{
+	for (size_t i = 0; i < targets.count; ++i) {
+		OffscreenTarget* pTarget = &targets.data[i];
+
+		vkDestroyImage(device, pTarget->image, nullptr);
+		vkFreeMemory(device, pTarget->memory, nullptr);
+	}
+
+	free(targets.data);
+	targets.data = nullptr;
+	targets.count = 0;
+}
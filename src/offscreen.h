@@ -0,0 +1,17 @@
+#ifndef	OFFSCREEN_H
+#define	OFFSCREEN_H
+
+#include <vulkan/vulkan.h>
+
+VkResult 
+create_offscreen_targets(VkPhysicalDevice physicalDevice, 
+			 VkDevice device, 
+			 VkFormat format, 
+			 VkExtent2D extent, 
+			 uint32_t count, 
+			 VkImage* pImages);
+
+void 
+close_offscreen_targets(VkDevice device);
+
+#endif	/* OFFSCREEN_H */
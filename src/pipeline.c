@@ -1,11 +1,26 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <vulkan/vulkan.h>
 
+#include "cache.h"
+#include "pipeline.h"
+
+/* Layout of VK_PIPELINE_CACHE_HEADER_VERSION_ONE */
+#define CACHE_HEADER_SIZE	(16 + VK_UUID_SIZE)
+
 static VkShaderModule vertexShaderModule;
 static VkShaderModule fragmentShaderModule;
 
+/* SPIR-V generated at build time by glslc -mfmt=num */
+static const uint32_t vertexShaderCode[] = {
+#include "vert.spv.inc"
+};
+static const uint32_t fragmentShaderCode[] = {
+#include "frag.spv.inc"
+};
+
 static VkDynamicState dynamicStates[] = {
 	VK_DYNAMIC_STATE_VIEWPORT, 
 	VK_DYNAMIC_STATE_SCISSOR, 
@@ -16,12 +31,20 @@ VkRect2D scissor = { };
 
 VkPipelineLayout pipelineLayout;
 
+/* The video planes, sampled through one immutable sampler */
+static VkSampler planeSampler;
+static VkDescriptorSetLayout descriptorSetLayout;
+
+static VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+static char pipelineCachePath[4096];
+static size_t loadedCacheSize;
+
 int 
 read_shader(const char* path, uint8_t** buffer, size_t* pBfSize) 
 {
 	int ret = EXIT_FAILURE;
 
-	FILE* file = fopen(path, "r");
+	FILE* file = fopen(path, "rb");
 	if (!file) { return ret; }
 
 	fseek(file, 0L, SEEK_END);
@@ -45,6 +68,116 @@ out:
 	return ret;
 }
 
+static uint32_t 
+read_u32(const uint8_t* pData) 
+{
+	uint32_t value;
+	memcpy(&value, pData, sizeof(value));
+	return value;
+}
+
+/* Rejects cache blobs written by another driver, device or driver version. */
+static bool 
+is_cache_valid(const uint8_t* pData, 
+	       size_t size, 
+	       const VkPhysicalDeviceProperties* pProperties) 
+{
+	if (size < CACHE_HEADER_SIZE) { return false; }
+
+	uint32_t headerSize = read_u32(pData);
+	uint32_t headerVersion = read_u32(pData + 4);
+	uint32_t vendorID = read_u32(pData + 8);
+	uint32_t deviceID = read_u32(pData + 12);
+
+	return headerSize >= CACHE_HEADER_SIZE && headerSize <= size && 
+		headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE && 
+		vendorID == pProperties->vendorID && 
+		deviceID == pProperties->deviceID && 
+		memcmp(pData + 16, pProperties->pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+VkResult 
+create_pipeline_cache(VkPhysicalDevice physicalDevice, VkDevice device) 
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	char name[128];
+	int len = snprintf(name, 
+			   sizeof(name), 
+			   "pipeline-%04x-%04x-", 
+			   properties.vendorID, 
+			   properties.deviceID);
+	for (size_t i = 0; i < VK_UUID_SIZE; ++i) {
+		len += snprintf(name + len, 
+				sizeof(name) - len, 
+				"%02x", 
+				properties.pipelineCacheUUID[i]);
+	}
+	snprintf(name + len, sizeof(name) - len, ".bin");
+
+	uint8_t* pData = nullptr;
+	size_t size = 0;
+	if (get_cache_path("pipeline", 
+			    name, 
+			    pipelineCachePath, 
+			    sizeof(pipelineCachePath)) != EXIT_SUCCESS) {
+		pipelineCachePath[0] = '\0';
+	} else if (read_cache_file(pipelineCachePath, &pData, &size) == EXIT_SUCCESS && 
+		!is_cache_valid(pData, size, &properties)) {
+		fputs("Pipeline: ignoring stale pipeline cache.\n", stderr);
+		free(pData);
+		pData = nullptr;
+		size = 0;
+	}
+
+	VkPipelineCacheCreateInfo createInfo = { };
+	createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	createInfo.initialDataSize = size;
+	createInfo.pInitialData = pData;
+
+	VkResult ret = vkCreatePipelineCache(device, &createInfo, nullptr, &pipelineCache);
+	if (ret != VK_SUCCESS && pData) {
+		/* Some drivers reject corrupt data instead of ignoring it. */
+		createInfo.initialDataSize = 0;
+		createInfo.pInitialData = nullptr;
+		size = 0;
+		ret = vkCreatePipelineCache(device, &createInfo, nullptr, &pipelineCache);
+	}
+	free(pData);
+
+	if (ret != VK_SUCCESS) {
+		fputs("Pipeline: failed to create pipeline cache.\n", stderr);
+		pipelineCache = VK_NULL_HANDLE;
+		return ret;
+	}
+	loadedCacheSize = size;
+
+	return VK_SUCCESS;
+}
+
+void 
+close_pipeline_cache(VkDevice device) 
+{
+	if (pipelineCache == VK_NULL_HANDLE) { return; }
+
+	size_t size = 0;
+	uint8_t* pData = nullptr;
+	if (pipelineCachePath[0] && 
+		vkGetPipelineCacheData(device, pipelineCache, &size, nullptr) == VK_SUCCESS && 
+		size != loadedCacheSize && 
+		(pData = malloc(size)) && 
+		vkGetPipelineCacheData(device, pipelineCache, &size, pData) == VK_SUCCESS) {
+		if (write_cache_file(pipelineCachePath, pData, size) != EXIT_SUCCESS) {
+			fputs("Pipeline: failed to save pipeline cache.\n", stderr);
+		}
+	}
+	free(pData);
+
+	vkDestroyPipelineCache(device, pipelineCache, nullptr);
+	pipelineCache = VK_NULL_HANDLE;
+}
+
 VkResult 
 create_shader_module(VkDevice device, 
 		     VkShaderModule* shaderModule, 
@@ -63,44 +196,113 @@ create_shader_module(VkDevice device,
 	return VK_SUCCESS;
 }
 
+/* Uses the embedded code unless $DEVIDEO_SHADER_DIR holds an override. */
 VkResult 
-create_graphics_pipeline(VkDevice device, 
-			 VkExtent2D extent, 
-			 VkRenderPass renderPass, 
-			 VkPipeline* pGraphicsPipeline) 
+load_shader_module(VkDevice device, 
+		   const char* name, 
+		   const uint32_t* pCode, 
+		   size_t codeSize, 
+		   VkShaderModule* pShaderModule) 
 {
-	VkResult ret;
+	uint8_t* pOverride = nullptr;
+	size_t overrideSize = 0;
+
+	const char* dir = getenv("DEVIDEO_SHADER_DIR");
+	if (dir) {
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/%s", dir, name);
+		if (read_shader(path, &pOverride, &overrideSize) != EXIT_SUCCESS) {
+			fprintf(stderr, "Pipeline: failed to read %s, using the built-in code.\n", path);
+			pOverride = nullptr;
+		}
+	}
 
-	uint8_t* vertexShader = nullptr;
-	size_t vxShSize = 0;
-	char* path = "shaders/vert.spv"; 
-	ret = read_shader(path, &vertexShader, &vxShSize);
-	if (ret != VK_SUCCESS) {
-		fprintf(stderr, "Pipeline: failed to retrieve %s code.\n", path);
-		goto out;
+	VkResult ret;
+	if (pOverride) {
+		ret = create_shader_module(device, pShaderModule, pOverride, overrideSize);
+		free(pOverride);
+	} else {
+		ret = create_shader_module(device, 
+					    pShaderModule, 
+					    (const uint8_t*) pCode, 
+					    codeSize);
 	}
 
-	ret = create_shader_module(device, &vertexShaderModule, vertexShader, vxShSize);
 	if (ret != VK_SUCCESS) {
-		fputs("Pipeline: failed to create shader module.\n", stderr);
-		goto out;
+		fprintf(stderr, "Pipeline: failed to create %s shader module.\n", name);
 	}
+	return ret;
+}
 
-	uint8_t* fragmentShader = nullptr;
-	size_t fgShSize = 0;
-	path = "shaders/frag.spv";
-	ret = read_shader(path, &fragmentShader, &fgShSize);
-	if (ret != EXIT_SUCCESS) {
-		fprintf(stderr, "Pipeline: failed to retrieve %s code.\n", path);
-		goto out;
+VkResult 
+create_descriptor_set_layout(VkDevice device) 
+{
+	VkSamplerCreateInfo samplerInfo = { };
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.anisotropyEnable = VK_FALSE;
+	samplerInfo.maxLod = 0.0f;
+	samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+	samplerInfo.unnormalizedCoordinates = VK_FALSE;
+
+	if (vkCreateSampler(device, &samplerInfo, nullptr, &planeSampler) != VK_SUCCESS) {
+		fputs("Pipeline: failed to create the plane sampler.\n", stderr);
+		return VK_ERROR_INITIALIZATION_FAILED;
 	}
 
-	ret = create_shader_module(device, &fragmentShaderModule, fragmentShader, fgShSize);
-	if (ret != VK_SUCCESS) {
-		fputs("Pipeline: failed to create shader module.\n", stderr);
-		goto out;
+	VkSampler samplers[VIDEO_PLANES];
+	for (size_t i = 0; i < VIDEO_PLANES; ++i) { samplers[i] = planeSampler; }
+
+	VkDescriptorSetLayoutBinding planesBinding = { };
+	planesBinding.binding = 0;
+	planesBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	planesBinding.descriptorCount = VIDEO_PLANES;
+	planesBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	planesBinding.pImmutableSamplers = samplers;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = { };
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = 1;
+	layoutInfo.pBindings = &planesBinding;
+
+	if (vkCreateDescriptorSetLayout(device, 
+					 &layoutInfo, 
+					 nullptr, 
+					 &descriptorSetLayout) != VK_SUCCESS) {
+		fputs("Pipeline: failed to create descriptor set layout.\n", stderr);
+		return VK_ERROR_INITIALIZATION_FAILED;
 	}
 
+	return VK_SUCCESS;
+}
+
+VkResult 
+create_graphics_pipeline(VkDevice device, 
+			 VkExtent2D extent, 
+			 VkRenderPass renderPass, 
+			 VkPipeline* pGraphicsPipeline) 
+{
+	VkResult ret;
+
+	ret = load_shader_module(device, 
+				  "vert.spv", 
+				  vertexShaderCode, 
+				  sizeof(vertexShaderCode), 
+				  &vertexShaderModule);
+	if (ret != VK_SUCCESS) { return ret; }
+
+	ret = load_shader_module(device, 
+				  "frag.spv", 
+				  fragmentShaderCode, 
+				  sizeof(fragmentShaderCode), 
+				  &fragmentShaderModule);
+	if (ret != VK_SUCCESS) { return ret; }
+
 	VkPipelineShaderStageCreateInfo shaderStages[2]; 
 	shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	shaderStages[0].pNext = nullptr;
@@ -198,12 +400,20 @@ create_graphics_pipeline(VkDevice device,
 	colorBlending.blendConstants[2] = 0.0f;
 	colorBlending.blendConstants[3] = 0.0f;
 
+	ret = create_descriptor_set_layout(device);
+	if (ret != VK_SUCCESS) { return ret; }
+
+	VkPushConstantRange pushConstantRange = { };
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(ColorConversion);
+
 	VkPipelineLayoutCreateInfo pipelineLayoutInfo = { };
 	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutInfo.setLayoutCount = 0;
-	pipelineLayoutInfo.pSetLayouts = nullptr;
-	pipelineLayoutInfo.pushConstantRangeCount = 0;
-	pipelineLayoutInfo.pPushConstantRanges = nullptr;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
 	ret = vkCreatePipelineLayout(device, 
 				      &pipelineLayoutInfo, 
@@ -211,7 +421,7 @@ create_graphics_pipeline(VkDevice device,
 				      &pipelineLayout);
 	if (ret != VK_SUCCESS) {
 		fputs("Pipeline: failed to create pipeline layout.\n", stderr);
-		goto out;
+		return ret;
 	}
 
 	VkGraphicsPipelineCreateInfo pipelineInfo = { };
@@ -233,28 +443,76 @@ create_graphics_pipeline(VkDevice device,
 	pipelineInfo.basePipelineIndex = -1;
 
 	ret = vkCreateGraphicsPipelines(device, 
-					VK_NULL_HANDLE, 
+					pipelineCache, 
 					1, 
 					&pipelineInfo, 
 				 	nullptr, 
 					pGraphicsPipeline);
 	if (ret != VK_SUCCESS) {
 		fputs("Pipeline: failed to create graphics pipeline.\n", stderr);
-		goto out;
+		return ret;
+	}
+
+	return VK_SUCCESS;
+}
+
+/* Compute pipelines share the pipeline cache; the shader module is only needed while 
+ * the pipeline is created. */
+VkResult 
+create_compute_pipeline(VkDevice device, 
+			const char* name, 
+			const uint32_t* pCode, 
+			size_t codeSize, 
+			VkPipelineLayout layout, 
+			VkPipeline* pPipeline) 
+{
+	VkShaderModule shaderModule;
+	VkResult ret = load_shader_module(device, name, pCode, codeSize, &shaderModule);
+	if (ret != VK_SUCCESS) { return ret; }
+
+	VkComputePipelineCreateInfo pipelineInfo = { };
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = shaderModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = layout;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineInfo.basePipelineIndex = -1;
+
+	ret = vkCreateComputePipelines(device, 
+				       pipelineCache, 
+				       1, 
+				       &pipelineInfo, 
+				       nullptr, 
+				       pPipeline);
+	vkDestroyShaderModule(device, shaderModule, nullptr);
+	if (ret != VK_SUCCESS) {
+		fprintf(stderr, "Pipeline: failed to create %s compute pipeline.\n", name);
 	}
 
-	ret = VK_SUCCESS;
-out:
-	if (vertexShader) { free(vertexShader); } 
-	if (fragmentShader) { free(fragmentShader); }
 	return ret;
 }
 
+VkPipelineLayout 
+get_pipeline_layout(void) 
+{
+	return pipelineLayout;
+}
+
+VkDescriptorSetLayout 
+get_descriptor_set_layout(void) 
+{
+	return descriptorSetLayout;
+}
+
 void 
 close_graphics_pipeline(VkDevice device, VkPipeline graphicsPipeline) 
 {
 	vkDestroyPipeline(device, graphicsPipeline, nullptr);
 	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+	vkDestroySampler(device, planeSampler, nullptr);
 	vkDestroyShaderModule(device, vertexShaderModule, nullptr);
 	vkDestroyShaderModule(device, fragmentShaderModule, nullptr);
 }
@@ -1,14 +1,46 @@
 #ifndef	PIPELINE_H
 #define	PIPELINE_H
 
+#include <stdint.h>
+
 #include <vulkan/vulkan.h>
 
-int 
+#define VIDEO_PLANES	3
+
+/* Push constants of the YUV fragment shader */
+typedef struct ColorConversion {
+	float		yuvToRgb[16];	/* Column major, offsets in the last column. */
+	float		bitScale;	/* Rescales LSB-aligned high bit depth samples. */
+	uint32_t	planar;		/* Cb and Cr in separate planes. */
+	uint32_t	rgb;		/* The first plane is RGB output of the scaler. */
+} ColorConversion;
+
+VkResult 
+create_pipeline_cache(VkPhysicalDevice physicalDevice, VkDevice device);
+
+void 
+close_pipeline_cache(VkDevice device);
+
+VkResult 
 create_graphics_pipeline(VkDevice device, 
 			 VkExtent2D extent, 
 			 VkRenderPass renderPass, 
 			 VkPipeline* pGraphicsPipeline);
 
+VkResult 
+create_compute_pipeline(VkDevice device, 
+			const char* name, 
+			const uint32_t* pCode, 
+			size_t codeSize, 
+			VkPipelineLayout layout, 
+			VkPipeline* pPipeline);
+
+VkPipelineLayout 
+get_pipeline_layout(void);
+
+VkDescriptorSetLayout 
+get_descriptor_set_layout(void);
+
 void 
 close_graphics_pipeline(VkDevice device, VkPipeline graphicsPipeline);
 
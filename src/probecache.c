@@ -0,0 +1,266 @@
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/mem.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "probecache.h"
+
+#define PROBE_MAGIC	0x45425250u	/* "PRBE" */
+#define PROBE_VERSION	1
+
+/* What avformat_find_stream_info() found for the decoded stream. The record is 
+ * followed by extradataSize bytes of extradata and pathSize bytes of path. */
+typedef struct ProbeRecord {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	libavVersion;	/* Codec ids are only stable within one libavcodec */
+	uint32_t	pathSize;
+	uint64_t	fileSize;
+	int64_t		mtimeNs;
+
+	int32_t		streamIndex;
+	int32_t		codecId;
+	uint32_t	codecTag;
+	int32_t		pixelFormat;
+	int32_t		width;
+	int32_t		height;
+	int32_t		profile;
+	int32_t		level;
+	int32_t		colorRange;
+	int32_t		colorPrimaries;
+	int32_t		colorTrc;
+	int32_t		colorSpace;
+	int32_t		chromaLocation;
+	int32_t		fieldOrder;
+	int32_t		videoDelay;
+	int32_t		timeBase[2];
+	int32_t		avgFrameRate[2];
+	int32_t		realFrameRate[2];
+	int32_t		sampleAspect[2];
+	uint32_t	extradataSize;
+	int64_t		duration;
+	int64_t		startTime;
+	int64_t		formatDuration;
+	int64_t		bitRate;
+} ProbeRecord;
+
+/* Records are named by a hash of the canonical path; the path inside settles 
+ * collisions, size and mtime reject files that changed since. */
+static int 
+describe_file(const char* path, 
+	      ProbeRecord* pRecord, 
+	      char** ppRealPath, 
+	      char* cachePath, 
+	      size_t cachePathSize) 
+{
+	struct stat st;
+	if (stat(path, &st) == -1 || !S_ISREG(st.st_mode)) { return EXIT_FAILURE; }
+
+	*ppRealPath = realpath(path, nullptr);
+	if (!*ppRealPath) { return EXIT_FAILURE; }
+
+	*pRecord = (ProbeRecord) { };
+	pRecord->magic = PROBE_MAGIC;
+	pRecord->version = PROBE_VERSION;
+	pRecord->libavVersion = avcodec_version() ^ avformat_version();
+	pRecord->pathSize = (uint32_t) strlen(*ppRealPath);
+	pRecord->fileSize = (uint64_t) st.st_size;
+	pRecord->mtimeNs = (int64_t) st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (const char* p = *ppRealPath; *p; ++p) { hash = (hash ^ (uint8_t) *p) * 0x100000001b3ull; }
+
+	char name[32];
+	snprintf(name, sizeof(name), "%016" PRIx64 ".probe", hash);
+	if (get_cache_path("probe", name, cachePath, cachePathSize) != EXIT_SUCCESS) {
+		free(*ppRealPath);
+		*ppRealPath = nullptr;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static bool 
+is_record_valid(const uint8_t* pData, size_t size, const ProbeRecord* pKey, const char* realPath) 
+{
+	if (size < sizeof(ProbeRecord)) { return false; }
+
+	ProbeRecord record;
+	memcpy(&record, pData, sizeof(record));
+
+	return record.magic == pKey->magic && 
+		record.version == pKey->version && 
+		record.libavVersion == pKey->libavVersion && 
+		record.fileSize == pKey->fileSize && 
+		record.mtimeNs == pKey->mtimeNs && 
+		record.pathSize == pKey->pathSize && 
+		size == sizeof(record) + record.extradataSize + record.pathSize && 
+		memcmp(pData + sizeof(record) + record.extradataSize, realPath, record.pathSize) == 0;
+}
+
+static void 
+apply_record(AVFormatContext* pFormat, const ProbeRecord* pRecord, const uint8_t* pExtradata) 
+{
+	AVStream* pStream = pFormat->streams[pRecord->streamIndex];
+	AVCodecParameters* pParams = pStream->codecpar;
+
+	pParams->codec_type = AVMEDIA_TYPE_VIDEO;
+	pParams->codec_id = pRecord->codecId;
+	pParams->codec_tag = pRecord->codecTag;
+	pParams->format = pRecord->pixelFormat;
+	pParams->width = pRecord->width;
+	pParams->height = pRecord->height;
+	pParams->profile = pRecord->profile;
+	pParams->level = pRecord->level;
+	pParams->color_range = pRecord->colorRange;
+	pParams->color_primaries = pRecord->colorPrimaries;
+	pParams->color_trc = pRecord->colorTrc;
+	pParams->color_space = pRecord->colorSpace;
+	pParams->chroma_location = pRecord->chromaLocation;
+	pParams->field_order = pRecord->fieldOrder;
+	pParams->video_delay = pRecord->videoDelay;
+	pParams->bit_rate = pRecord->bitRate;
+	pParams->sample_aspect_ratio = (AVRational) { 
+		pRecord->sampleAspect[0], pRecord->sampleAspect[1] 
+	};
+
+	av_freep(&pParams->extradata);
+	pParams->extradata_size = 0;
+	if (pRecord->extradataSize && 
+		(pParams->extradata = av_mallocz(pRecord->extradataSize + AV_INPUT_BUFFER_PADDING_SIZE))) {
+		memcpy(pParams->extradata, pExtradata, pRecord->extradataSize);
+		pParams->extradata_size = (int) pRecord->extradataSize;
+	}
+
+	pStream->avg_frame_rate = (AVRational) { pRecord->avgFrameRate[0], pRecord->avgFrameRate[1] };
+	pStream->r_frame_rate = (AVRational) { pRecord->realFrameRate[0], pRecord->realFrameRate[1] };
+	if (pStream->duration == AV_NOPTS_VALUE) { pStream->duration = pRecord->duration; }
+	if (pStream->start_time == AV_NOPTS_VALUE) { pStream->start_time = pRecord->startTime; }
+	if (pFormat->duration == AV_NOPTS_VALUE) { pFormat->duration = pRecord->formatDuration; }
+}
+
+/* Streams the demuxer only creates while probing, or with another time base, 
+ * mean the record does not describe what was opened. */
+static bool 
+matches_streams(const AVFormatContext* pFormat, const ProbeRecord* pRecord) 
+{
+	if (pRecord->streamIndex < 0 || (unsigned) pRecord->streamIndex >= pFormat->nb_streams) {
+		return false;
+	}
+
+	const AVStream* pStream = pFormat->streams[pRecord->streamIndex];
+	if (pStream->codecpar->codec_type != AVMEDIA_TYPE_VIDEO && 
+		pStream->codecpar->codec_type != AVMEDIA_TYPE_UNKNOWN) {
+		return false;
+	}
+
+	return pStream->time_base.num == pRecord->timeBase[0] && 
+		pStream->time_base.den == pRecord->timeBase[1];
+}
+
+/* Configures the video stream from the last probe of this file, so the caller can 
+ * skip avformat_find_stream_info(). Fails when there is no usable record. */
+int 
+load_probe_info(AVFormatContext* pFormat, const char* path, int* pStreamIndex) 
+{
+	ProbeRecord key;
+	char* realPath;
+	char cachePath[4096];
+	if (describe_file(path, &key, &realPath, cachePath, sizeof(cachePath)) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+
+	uint8_t* pData = nullptr;
+	size_t size = 0;
+	if (read_cache_file(cachePath, &pData, &size) != EXIT_SUCCESS) {
+		free(pData);
+		free(realPath);
+		return EXIT_FAILURE;
+	}
+	if (!is_record_valid(pData, size, &key, realPath)) {
+		fputs("Probe cache: ignoring stale record.\n", stderr);
+		free(pData);
+		free(realPath);
+		return EXIT_FAILURE;
+	}
+	free(realPath);
+
+	ProbeRecord record;
+	memcpy(&record, pData, sizeof(record));
+	if (!matches_streams(pFormat, &record)) {
+		free(pData);
+		return EXIT_FAILURE;
+	}
+
+	apply_record(pFormat, &record, pData + sizeof(record));
+	*pStreamIndex = record.streamIndex;
+
+	free(pData);
+	return EXIT_SUCCESS;
+}
+
+void 
+save_probe_info(const AVFormatContext* pFormat, const char* path, int streamIndex) 
+{
+	ProbeRecord record;
+	char* realPath;
+	char cachePath[4096];
+	if (describe_file(path, &record, &realPath, cachePath, sizeof(cachePath)) != EXIT_SUCCESS) {
+		return;
+	}
+
+	const AVStream* pStream = pFormat->streams[streamIndex];
+	const AVCodecParameters* pParams = pStream->codecpar;
+	record.streamIndex = streamIndex;
+	record.codecId = pParams->codec_id;
+	record.codecTag = pParams->codec_tag;
+	record.pixelFormat = pParams->format;
+	record.width = pParams->width;
+	record.height = pParams->height;
+	record.profile = pParams->profile;
+	record.level = pParams->level;
+	record.colorRange = pParams->color_range;
+	record.colorPrimaries = pParams->color_primaries;
+	record.colorTrc = pParams->color_trc;
+	record.colorSpace = pParams->color_space;
+	record.chromaLocation = pParams->chroma_location;
+	record.fieldOrder = pParams->field_order;
+	record.videoDelay = pParams->video_delay;
+	record.timeBase[0] = pStream->time_base.num;
+	record.timeBase[1] = pStream->time_base.den;
+	record.avgFrameRate[0] = pStream->avg_frame_rate.num;
+	record.avgFrameRate[1] = pStream->avg_frame_rate.den;
+	record.realFrameRate[0] = pStream->r_frame_rate.num;
+	record.realFrameRate[1] = pStream->r_frame_rate.den;
+	record.sampleAspect[0] = pParams->sample_aspect_ratio.num;
+	record.sampleAspect[1] = pParams->sample_aspect_ratio.den;
+	record.extradataSize = pParams->extradata_size > 0 ? (uint32_t) pParams->extradata_size : 0;
+	record.duration = pStream->duration;
+	record.startTime = pStream->start_time;
+	record.formatDuration = pFormat->duration;
+	record.bitRate = pParams->bit_rate;
+
+	size_t size = sizeof(record) + record.extradataSize + record.pathSize;
+	uint8_t* pData = malloc(size);
+	if (pData) {
+		memcpy(pData, &record, sizeof(record));
+		if (record.extradataSize) {
+			memcpy(pData + sizeof(record), pParams->extradata, record.extradataSize);
+		}
+		memcpy(pData + sizeof(record) + record.extradataSize, realPath, record.pathSize);
+		if (write_cache_file(cachePath, pData, size) != EXIT_SUCCESS) {
+			fputs("Probe cache: failed to save the stream parameters.\n", stderr);
+		}
+	}
+
+	free(pData);
+	free(realPath);
+}
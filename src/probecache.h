@@ -0,0 +1,12 @@
+#ifndef	PROBECACHE_H
+#define	PROBECACHE_H
+
+#include <libavformat/avformat.h>
+
+int 
+load_probe_info(AVFormatContext* pFormat, const char* path, int* pStreamIndex);
+
+void 
+save_probe_info(const AVFormatContext* pFormat, const char* path, int streamIndex);
+
+#endif	/* PROBECACHE_H */
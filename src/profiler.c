@@ -0,0 +1,119 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "profiler.h"
+
+#define MAX_SPANS	64
+
+/* A timed startup step */
+typedef struct ProfileSpan {
+	const char*	name;
+	uint64_t	beginNs;
+	uint64_t	endNs;
+	int		depth;
+} ProfileSpan;
+static ProfileSpan spans[MAX_SPANS];
+static atomic_int spanCount;
+static atomic_uint_least64_t originNs;
+static thread_local int depth;
+
+static uint64_t 
+now_ns(void) 
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+/* Returns a handle for profile_end(), or -1 once the table is full. */
+int 
+profile_begin(const char* name) 
+{
+	uint64_t now = now_ns();
+	uint_least64_t unset = 0;
+	atomic_compare_exchange_strong(&originNs, &unset, now);
+
+	int span = atomic_fetch_add(&spanCount, 1);
+	if (span >= MAX_SPANS) { return -1; }
+
+	spans[span].name = name;
+	spans[span].beginNs = now;
+	spans[span].depth = depth++;
+
+	return span;
+}
+
+void 
+profile_end(int span) 
+{
+	if (span < 0) { return; }
+
+	spans[span].endNs = now_ns();
+	--depth;
+}
+
+static void 
+print_table(int count, uint64_t origin) 
+{
+	fputs("Startup profile:\n", stderr);
+	fprintf(stderr, "  %-40s %10s %10s\n", "step", "start ms", "took ms");
+	for (int i = 0; i < count; ++i) {
+		const ProfileSpan* pSpan = &spans[i];
+		if (!pSpan->endNs) { continue; }
+
+		fprintf(stderr, 
+			"  %*s%-*s %10.3f %10.3f\n", 
+			pSpan->depth * 2, "", 
+			40 - pSpan->depth * 2, pSpan->name, 
+			(pSpan->beginNs - origin) / 1e6, 
+			(pSpan->endNs - pSpan->beginNs) / 1e6);
+	}
+}
+
+static void 
+write_json(const char* path, int count, uint64_t origin) 
+{
+	FILE* file = fopen(path, "w");
+	if (!file) {
+		fprintf(stderr, "Profiler: failed to open %s.\n", path);
+		return;
+	}
+
+	fputs("{\"spans\":[", file);
+	bool first = true;
+	for (int i = 0; i < count; ++i) {
+		const ProfileSpan* pSpan = &spans[i];
+		if (!pSpan->endNs) { continue; }
+
+		fprintf(file, 
+			"%s\n  {\"name\":\"%s\",\"depth\":%d,\"start_us\":%.1f,\"duration_us\":%.1f}", 
+			first ? "" : ",", 
+			pSpan->name, 
+			pSpan->depth, 
+			(pSpan->beginNs - origin) / 1e3, 
+			(pSpan->endNs - pSpan->beginNs) / 1e3);
+		first = false;
+	}
+	fputs("\n]}\n", file);
+	fclose(file);
+}
+
+/* DEVIDEO_STARTUP_PROFILE=1 prints a table, DEVIDEO_STARTUP_PROFILE_JSON=<path> 
+ * writes the same spans as JSON. */
+void 
+profile_report(void) 
+{
+	int count = atomic_load(&spanCount);
+	if (count > MAX_SPANS) { count = MAX_SPANS; }
+	uint64_t origin = atomic_load(&originNs);
+
+	const char* table = getenv("DEVIDEO_STARTUP_PROFILE");
+	if (table && strcmp(table, "0") != 0) { print_table(count, origin); }
+
+	const char* json = getenv("DEVIDEO_STARTUP_PROFILE_JSON");
+	if (json && json[0]) { write_json(json, count, origin); }
+}
@@ -0,0 +1,13 @@
+#ifndef	PROFILER_H
+#define	PROFILER_H
+
+int 
+profile_begin(const char* name);
+
+void 
+profile_end(int span);
+
+void 
+profile_report(void);
+
+#endif	/* PROFILER_H */
@@ -0,0 +1,73 @@
+#include <stdlib.h>
+
+#include "queue.h"
+
+/* Capacity is rounded up to a power of two so indices wrap with a mask. */
+int 
+init_queue(FrameQueue* pQueue, uint32_t capacity) 
+{
+	uint32_t size = 1;
+	while (size < capacity) { size <<= 1; }
+
+	pQueue->slots = calloc(size, sizeof(void*));
+	if (!pQueue->slots) { return EXIT_FAILURE; }
+
+	pQueue->mask = size - 1;
+	atomic_init(&pQueue->head, 0);
+	atomic_init(&pQueue->tail, 0);
+
+	return EXIT_SUCCESS;
+}
+
+bool 
+queue_push(FrameQueue* pQueue, void* pItem) 
+{
+	unsigned tail = atomic_load_explicit(&pQueue->tail, memory_order_relaxed);
+	unsigned head = atomic_load_explicit(&pQueue->head, memory_order_acquire);
+	if (tail - head > pQueue->mask) { return false; }
+
+	pQueue->slots[tail & pQueue->mask] = pItem;
+	atomic_store_explicit(&pQueue->tail, tail + 1, memory_order_release);
+
+	return true;
+}
+
+void* 
+queue_peek(FrameQueue* pQueue) 
+{
+	unsigned head = atomic_load_explicit(&pQueue->head, memory_order_relaxed);
+	unsigned tail = atomic_load_explicit(&pQueue->tail, memory_order_acquire);
+	if (head == tail) { return nullptr; }
+
+	return pQueue->slots[head & pQueue->mask];
+}
+
+void* 
+queue_pop(FrameQueue* pQueue) 
+{
+	unsigned head = atomic_load_explicit(&pQueue->head, memory_order_relaxed);
+	unsigned tail = atomic_load_explicit(&pQueue->tail, memory_order_acquire);
+	if (head == tail) { return nullptr; }
+
+	void* pItem = pQueue->slots[head & pQueue->mask];
+	atomic_store_explicit(&pQueue->head, head + 1, memory_order_release);
+
+	return pItem;
+}
+
+uint32_t 
+queue_size(FrameQueue* pQueue) 
+{
+	unsigned tail = atomic_load_explicit(&pQueue->tail, memory_order_acquire);
+	unsigned head = atomic_load_explicit(&pQueue->head, memory_order_acquire);
+
+	return tail - head;
+}
+
+void 
+close_queue(FrameQueue* pQueue) 
+{
+	free(pQueue->slots);
+	pQueue->slots = nullptr;
+	pQueue->mask = 0;
+}
@@ -0,0 +1,34 @@
+#ifndef	QUEUE_H
+#define	QUEUE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/* Bounded single-producer/single-consumer ring. Exactly one thread may push 
+ * and exactly one thread may peek/pop; neither side ever takes a lock. */
+typedef struct FrameQueue {
+	void**			slots;
+	uint32_t		mask;
+	alignas(64) atomic_uint	head;	/* Next slot to pop, owned by the consumer. */
+	alignas(64) atomic_uint	tail;	/* Next slot to push, owned by the producer. */
+} FrameQueue;
+
+int 
+init_queue(FrameQueue* pQueue, uint32_t capacity);
+
+bool 
+queue_push(FrameQueue* pQueue, void* pItem);
+
+void* 
+queue_peek(FrameQueue* pQueue);
+
+void* 
+queue_pop(FrameQueue* pQueue);
+
+uint32_t 
+queue_size(FrameQueue* pQueue);
+
+void 
+close_queue(FrameQueue* pQueue);
+
+#endif	/* QUEUE_H */
@@ -0,0 +1,333 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <semaphore.h>
+#include <vulkan/vulkan.h>
+
+#include "buffers.h"
+#include "readback.h"
+
+#define NO_SLOT	UINT32_MAX
+
+/* FREE slots may be recorded into, PENDING ones wait for their frame's fence, READY
+ * ones belong to the consumer until it releases them. */
+typedef enum ReadbackState {
+	READBACK_FREE,
+	READBACK_PENDING,
+	READBACK_READY,
+} ReadbackState;
+
+typedef struct ReadbackSlot {
+	VkBuffer	buffer;
+	VkDeviceMemory	memory;
+	VkCommandBuffer	commandBuffer;
+	VkFence		fence;
+	atomic_int	state;
+	ReadbackFrame	frame;
+} ReadbackSlot;
+static ReadbackSlot slots[READBACK_SLOTS];
+
+/* Pending slots in submission order, which is the order their fences signal in */
+typedef struct PendingSlots {
+	uint32_t	head;
+	uint32_t	count;
+	uint32_t	data[READBACK_SLOTS];
+} PendingSlots;
+static PendingSlots pending;
+
+static VkDevice readbackDevice;
+static VkCommandPool commandPool;
+static VkExtent2D readbackExtent;
+/* Host cached memory is read much faster, but needs invalidating. */
+static bool cachedMemory;
+
+static sem_t freeSlots;
+static bool created;
+static uint32_t recordedSlot = NO_SLOT;
+static uint64_t frameSequence;
+static uint64_t droppedReadbacks;
+
+static ReadbackHandler readbackHandler;
+static void* pReadbackData;
+
+VkResult 
+create_readback_ring(VkPhysicalDevice physicalDevice, 
+		     VkDevice device, 
+		     uint32_t queueFamily, 
+		     VkExtent2D extent) 
+{
+	readbackDevice = device;
+	readbackExtent = extent;
+
+	VkCommandPoolCreateInfo poolInfo = { };
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	poolInfo.queueFamilyIndex = queueFamily;
+	if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+		fputs("Readback: failed to create the command pool.\n", stderr);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+	sem_init(&freeSlots, 0, READBACK_SLOTS);
+	created = true;
+
+	uint32_t typeIndex;
+	VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | 
+					   VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+	cachedMemory = find_memory_type(physicalDevice, 
+					~0u, 
+					properties, 
+					&typeIndex) == VK_SUCCESS;
+	if (!cachedMemory) {
+		properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | 
+			     VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	}
+
+	VkCommandBuffer commandBuffers[READBACK_SLOTS];
+	VkCommandBufferAllocateInfo allocInfo = { };
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = commandPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = READBACK_SLOTS;
+	if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers) != VK_SUCCESS) {
+		fputs("Readback: failed to allocate command buffers.\n", stderr);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	/* Tightly packed 4 bytes per pixel formats only. */
+	VkDeviceSize frameSize = (VkDeviceSize) extent.width * extent.height * 4;
+
+	for (uint32_t i = 0; i < READBACK_SLOTS; ++i) {
+		ReadbackSlot* pSlot = &slots[i];
+		pSlot->commandBuffer = commandBuffers[i];
+		atomic_store(&pSlot->state, READBACK_FREE);
+
+		if (create_buffer(physicalDevice, 
+				   device, 
+				   frameSize, 
+				   VK_BUFFER_USAGE_TRANSFER_DST_BIT, 
+				   properties, 
+				   &pSlot->buffer, 
+				   &pSlot->memory) != VK_SUCCESS) {
+			fputs("Readback: failed to create readback buffers.\n", stderr);
+			return VK_ERROR_INITIALIZATION_FAILED;
+		}
+
+		void* pMapped;
+		if (vkMapMemory(device, 
+				 pSlot->memory, 
+				 0, 
+				 VK_WHOLE_SIZE, 
+				 0, 
+				 &pMapped) != VK_SUCCESS) {
+			fputs("Readback: failed to map readback buffers.\n", stderr);
+			return VK_ERROR_INITIALIZATION_FAILED;
+		}
+
+		pSlot->frame.pPixels = pMapped;
+		pSlot->frame.width = extent.width;
+		pSlot->frame.height = extent.height;
+		pSlot->frame.stride = extent.width * 4;
+		pSlot->frame.slot = i;
+	}
+
+	return VK_SUCCESS;
+}
+
+static void 
+record_copy(VkCommandBuffer commandBuffer, VkImage image, VkBuffer buffer) 
+{
+	/* The render pass leaves the image in TRANSFER_SRC_OPTIMAL. */
+	VkBufferImageCopy region = { };
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent.width = readbackExtent.width;
+	region.imageExtent.height = readbackExtent.height;
+	region.imageExtent.depth = 1;
+
+	vkCmdCopyImageToBuffer(commandBuffer, 
+				image, 
+				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, 
+				buffer, 
+				1, 
+				&region);
+
+	VkBufferMemoryBarrier barrier = { };
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = buffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+
+	vkCmdPipelineBarrier(commandBuffer, 
+			      VK_PIPELINE_STAGE_TRANSFER_BIT, 
+			      VK_PIPELINE_STAGE_HOST_BIT, 
+			      0, 
+			      0, nullptr, 
+			      1, &barrier, 
+			      0, nullptr);
+}
+
+/* Records the copy of the frame about to be submitted into a free slot. Returns
+ * VK_NULL_HANDLE instead of waiting when the consumer holds every slot: the frame
+ * is then rendered but not read back. */
+VkCommandBuffer 
+record_readback(VkImage image) 
+{
+	uint64_t sequence = frameSequence++;
+	if (!created) { return VK_NULL_HANDLE; }
+
+	if (sem_trywait(&freeSlots) == -1) {
+		++droppedReadbacks;
+		return VK_NULL_HANDLE;
+	}
+
+	uint32_t index = 0;
+	while (atomic_load(&slots[index].state) != READBACK_FREE) { ++index; }
+	ReadbackSlot* pSlot = &slots[index];
+
+	VkCommandBufferBeginInfo beginInfo = { };
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	vkResetCommandBuffer(pSlot->commandBuffer, 0);
+	if (vkBeginCommandBuffer(pSlot->commandBuffer, &beginInfo) != VK_SUCCESS) {
+		sem_post(&freeSlots);
+		return VK_NULL_HANDLE;
+	}
+	record_copy(pSlot->commandBuffer, image, pSlot->buffer);
+	if (vkEndCommandBuffer(pSlot->commandBuffer) != VK_SUCCESS) {
+		sem_post(&freeSlots);
+		return VK_NULL_HANDLE;
+	}
+
+	pSlot->frame.sequence = sequence;
+	recordedSlot = index;
+
+	return pSlot->commandBuffer;
+}
+
+/* The command buffer from record_readback() was submitted, signalling fence. */
+void 
+submit_readback(VkFence fence) 
+{
+	if (recordedSlot == NO_SLOT) { return; }
+
+	ReadbackSlot* pSlot = &slots[recordedSlot];
+	pSlot->fence = fence;
+	atomic_store(&pSlot->state, READBACK_PENDING);
+
+	pending.data[(pending.head + pending.count) % READBACK_SLOTS] = recordedSlot;
+	++pending.count;
+	recordedSlot = NO_SLOT;
+}
+
+/* The command buffer from record_readback() was never submitted: its slot is free 
+ * again. */
+void 
+cancel_readback(void) 
+{
+	if (recordedSlot == NO_SLOT) { return; }
+
+	recordedSlot = NO_SLOT;
+	sem_post(&freeSlots);
+}
+
+/* Hands every finished copy to the handler without waiting on the GPU. Fences are
+ * reused by later frames, so this must run before a frame's fence is reset. */
+void 
+poll_readbacks(void) 
+{
+	while (pending.count) {
+		ReadbackSlot* pSlot = &slots[pending.data[pending.head]];
+		if (vkGetFenceStatus(readbackDevice, pSlot->fence) != VK_SUCCESS) { return; }
+
+		pending.head = (pending.head + 1) % READBACK_SLOTS;
+		--pending.count;
+
+		if (cachedMemory) {
+			VkMappedMemoryRange range = { };
+			range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+			range.memory = pSlot->memory;
+			range.offset = 0;
+			range.size = VK_WHOLE_SIZE;
+			vkInvalidateMappedMemoryRanges(readbackDevice, 1, &range);
+		}
+
+		atomic_store(&pSlot->state, READBACK_READY);
+		if (readbackHandler) {
+			readbackHandler(&pSlot->frame, pReadbackData);
+		} else {
+			readback_release(pSlot->frame.slot);
+		}
+	}
+}
+
+/* Gives a slot back for new copies; may be called from any thread. */
+void 
+readback_release(uint32_t slot) 
+{
+	atomic_store(&slots[slot].state, READBACK_FREE);
+	sem_post(&freeSlots);
+}
+
+/* For consumers that must see every frame: blocks until a slot is free, so the
+ * next frame is not dropped. Slots only stay taken while the consumer holds them. */
+void 
+wait_for_readback_slot(void) 
+{
+	if (!created) { return; }
+
+	while (sem_wait(&freeSlots) == -1) {
+		if (errno != EINTR) { return; }
+	}
+	sem_post(&freeSlots);
+}
+
+void 
+set_readback_handler(ReadbackHandler handler, void* pData) 
+{
+	readbackHandler = handler;
+	pReadbackData = pData;
+}
+
+/* Every frame handed out must have been released. */
+void 
+close_readback_ring(VkDevice device) 
+{
+	if (!created) { return; }
+
+	if (droppedReadbacks) {
+		fprintf(stderr, 
+			"Readback: %llu frames not read back, the consumer was behind.\n", 
+			(unsigned long long) droppedReadbacks);
+	}
+
+	for (uint32_t i = 0; i < READBACK_SLOTS; ++i) {
+		ReadbackSlot* pSlot = &slots[i];
+		if (pSlot->buffer == VK_NULL_HANDLE) { continue; }
+
+		vkUnmapMemory(device, pSlot->memory);
+		vkDestroyBuffer(device, pSlot->buffer, nullptr);
+		vkFreeMemory(device, pSlot->memory, nullptr);
+	}
+	vkDestroyCommandPool(device, commandPool, nullptr);
+	sem_destroy(&freeSlots);
+
+	for (uint32_t i = 0; i < READBACK_SLOTS; ++i) { slots[i] = (ReadbackSlot) { }; }
+	pending = (PendingSlots) { };
+	commandPool = VK_NULL_HANDLE;
+	recordedSlot = NO_SLOT;
+	frameSequence = 0;
+	droppedReadbacks = 0;
+	created = false;
+}
@@ -0,0 +1,56 @@
+#ifndef	READBACK_H
+#define	READBACK_H
+
+#include <stdint.h>
+
+#include <vulkan/vulkan.h>
+
+#include "devices.h"
+
+/* Host buffers a consumer may hold on to while new frames keep rendering */
+#define READBACK_SLOTS	(MAX_FRAMES_IN_FLIGHT + 4)
+
+/* A rendered frame in host memory, valid until readback_release(slot). */
+typedef struct ReadbackFrame {
+	const uint8_t*	pPixels;
+	uint32_t	width;
+	uint32_t	height;
+	uint32_t	stride;
+	uint32_t	slot;
+	uint64_t	sequence;	/* Index of the rendered frame it was copied from */
+} ReadbackFrame;
+
+/* Called on the render thread once the copy of a frame has landed. */
+typedef void (*ReadbackHandler)(const ReadbackFrame* pFrame, void* pData);
+
+VkResult 
+create_readback_ring(VkPhysicalDevice physicalDevice, 
+		     VkDevice device, 
+		     uint32_t queueFamily, 
+		     VkExtent2D extent);
+
+VkCommandBuffer 
+record_readback(VkImage image);
+
+void 
+submit_readback(VkFence fence);
+
+void 
+cancel_readback(void);
+
+void 
+poll_readbacks(void);
+
+void 
+readback_release(uint32_t slot);
+
+void 
+wait_for_readback_slot(void);
+
+void 
+set_readback_handler(ReadbackHandler handler, void* pData);
+
+void 
+close_readback_ring(VkDevice device);
+
+#endif	/* READBACK_H */
@@ -1,14 +1,19 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <threads.h>
 
 #define VK_USE_PLATFORM_WAYLAND_KHR
 #include <vulkan/vulkan.h>
 #include <vulkan/vulkan_wayland.h>
 #include <wayland-client.h>
 
+#include "decoder.h"
 #include "devices.h"
+#include "profiler.h"
 #include "renderer.h"
+#include "scheduler.h"
 #include "validation.h"
+#include "video.h"
 
 #ifdef NDEBUG
 	const bool enableValidationLayers = false;
@@ -22,11 +27,20 @@ static const char* instanceExtensions[] = {
 	"VK_KHR_wayland_surface", 
 	"VK_EXT_debug_utils", 
 };
+static const char* headlessExtensions[] = {
+	"VK_EXT_debug_utils", 
+};
 
 VkSurfaceKHR surface;
 
+/* Instance creation and device probing, overlapped with the Wayland handshake */
+static thrd_t probeThread;
+static bool probing;
+
+static bool playingVideo;
+
 VkResult 
-create_instance(const char* appName) 
+create_instance(const char* appName, bool headless) 
 {
 	if (enableValidationLayers && !check_validation_layers_support()) {
 		fputs("Renderer: validation layers requested, but not available!\n", stderr);
@@ -39,14 +53,22 @@ create_instance(const char* appName)
 	appInfo.applicationVersion = VK_MAKE_VERSION(0, 1, 0);
 	appInfo.pEngineName = "No Engine";
 	appInfo.engineVersion = VK_MAKE_VERSION(0, 1, 0);
-	appInfo.apiVersion = VK_API_VERSION_1_0;
+	/* 1.1 for vkGetPhysicalDeviceProperties2 and external memory. */
+	appInfo.apiVersion = VK_API_VERSION_1_1;
 
 	VkInstanceCreateInfo createInfo = { };
 	createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 	createInfo.pApplicationInfo = &appInfo;
 
-	createInfo.enabledExtensionCount = sizeof(instanceExtensions) / sizeof(const char*);
-	createInfo.ppEnabledExtensionNames = instanceExtensions;
+	if (headless) {
+		/* No surface extensions, so no display server is needed at all. */
+		createInfo.enabledExtensionCount = enableValidationLayers ? 
+			sizeof(headlessExtensions) / sizeof(const char*) : 0;
+		createInfo.ppEnabledExtensionNames = headlessExtensions;
+	} else {
+		createInfo.enabledExtensionCount = sizeof(instanceExtensions) / sizeof(const char*);
+		createInfo.ppEnabledExtensionNames = instanceExtensions;
+	}
 
 	VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo;
 	if (enableValidationLayers) {
@@ -89,33 +111,193 @@ create_surface(VkInstance instance,
 	return VK_SUCCESS;
 }
 
+static int 
+probe_renderer(void* pArg) 
+{
+	const char* appName = pArg;
+	int span = profile_begin("probe_renderer");
+
+	int step = profile_begin("create_instance");
+	if (create_instance(appName, false) != VK_SUCCESS) { return EXIT_FAILURE; }
+	if (enableValidationLayers) { setup_debug_messenger(instance); }
+	profile_end(step);
+
+	step = profile_begin("probe_physical_devices");
+	VkResult ret = probe_physical_devices(instance);
+	profile_end(step);
+	if (ret != VK_SUCCESS) { return EXIT_FAILURE; }
+
+	profile_end(span);
+	return EXIT_SUCCESS;
+}
+
+/* Starts creating the instance in the background; init_renderer() joins it. */
+int 
+start_renderer(const char* appName) 
+{
+	if (thrd_create(&probeThread, probe_renderer, (void*) appName) != thrd_success) {
+		fputs("Renderer: failed to start the probe thread.\n", stderr);
+		return EXIT_FAILURE;
+	}
+	probing = true;
+
+	return EXIT_SUCCESS;
+}
+
+int 
+join_renderer(void) 
+{
+	if (!probing) { return EXIT_FAILURE; }
+
+	int result = EXIT_FAILURE;
+	thrd_join(probeThread, &result);
+	probing = false;
+
+	return result;
+}
+
+/* Joins a probe whose renderer will never be initialized and destroys the 
+ * instance it created. */
+void 
+cancel_renderer(void) 
+{
+	if (!probing) { return; }
+
+	join_renderer();
+	if (instance == VK_NULL_HANDLE) { return; }
+
+	if (enableValidationLayers) { close_debug_messenger(instance); }
+	vkDestroyInstance(instance, nullptr);
+	instance = VK_NULL_HANDLE;
+}
+
 int 
 init_renderer(const char* appName, 
 	      struct wl_display* pDisplay, 
-	      struct wl_surface* pSurface) 
+	      struct wl_surface* pSurface, 
+	      uint32_t width, 
+	      uint32_t height) 
 {
-	if (create_instance(appName) != VK_SUCCESS) { return EXIT_FAILURE; }
-	if (enableValidationLayers) { setup_debug_messenger(instance); }
+	int span = profile_begin("init_renderer");
+
+	int step;
+	if (probing) {
+		step = profile_begin("join_renderer");
+		int ret = join_renderer();
+		profile_end(step);
+		if (ret != EXIT_SUCCESS) { return EXIT_FAILURE; }
+	} else {
+		step = profile_begin("create_instance");
+		if (create_instance(appName, false) != VK_SUCCESS) { return EXIT_FAILURE; }
+		if (enableValidationLayers) { setup_debug_messenger(instance); }
+		profile_end(step);
+	}
 
+	step = profile_begin("create_surface");
 	if (create_surface(instance, pDisplay, pSurface) != VK_SUCCESS) { 
 		return EXIT_FAILURE; 
 	}
-	if (setup_devices(instance, surface, 800, 600) != VK_SUCCESS) { return EXIT_FAILURE; }
+	profile_end(step);
 
+	if (setup_devices(instance, surface, width, height) != VK_SUCCESS) { 
+		return EXIT_FAILURE; 
+	}
+
+	profile_end(span);
 	return EXIT_SUCCESS;
 }
 
-void 
+int 
+init_renderer_headless(const char* appName, 
+		       uint32_t width, 
+		       uint32_t height, 
+		       bool readback) 
+{
+	int span = profile_begin("init_renderer_headless");
+
+	int step = profile_begin("create_instance");
+	if (create_instance(appName, true) != VK_SUCCESS) { return EXIT_FAILURE; }
+	if (enableValidationLayers) { setup_debug_messenger(instance); }
+	profile_end(step);
+
+	if (setup_headless_devices(instance, width, height, readback) != VK_SUCCESS) { 
+		return EXIT_FAILURE; 
+	}
+
+	profile_end(span);
+	return EXIT_SUCCESS;
+}
+
+int 
+resize_renderer(uint32_t width, uint32_t height) 
+{
+	if (recreate_swapChain(width, height) != VK_SUCCESS) { return EXIT_FAILURE; }
+
+	return EXIT_SUCCESS;
+}
+
+static int 
+use_video_frame(AVFrame* pFrame) 
+{
+	if (set_video_frame(pFrame) != EXIT_SUCCESS) {
+		release_frame(pFrame);
+		return EXIT_FAILURE;
+	}
+
+	/* Pre-recorded command buffers cannot pick up new frames. */
+	if (!playingVideo) { set_record_mode(RECORD_PER_FRAME); }
+	playingVideo = true;
+
+	return EXIT_SUCCESS;
+}
+
+int 
 render_surface(void) 
 {
-	draw_frame();
+	/* A frame that cannot be shown leaves the previous one on screen. */
+	AVFrame* pFrame = schedule_frame();
+	if (pFrame) { use_video_frame(pFrame); }
+
+	if (draw_frame() != VK_SUCCESS) { return EXIT_FAILURE; }
+
+	return EXIT_SUCCESS;
+}
+
+/* Renders exactly this frame, for paths that consume every frame in order. */
+int 
+render_frame(AVFrame* pFrame) 
+{
+	if (use_video_frame(pFrame) != EXIT_SUCCESS) { return EXIT_FAILURE; }
+	if (draw_frame() != VK_SUCCESS) { return EXIT_FAILURE; }
+
+	return EXIT_SUCCESS;
+}
+
+void 
+set_frame_readback(ReadbackHandler handler, void* pData) 
+{
+	set_readback_handler(handler, pData);
+}
+
+/* Must be called before the renderer is initialized. */
+void 
+set_video_scale(uint32_t width, uint32_t height, ScaleFilter filter) 
+{
+	set_scale_target(width, height, filter);
+}
+
+void 
+finish_rendering(void) 
+{
+	finish_frames();
 }
 
 void 
 close_renderer(void) 
 {
+	/* Hands the frames still held by the video slots back to the decoder. */
 	close_devices();
-	vkDestroySurfaceKHR(instance, surface, nullptr);
+	if (surface != VK_NULL_HANDLE) { vkDestroySurfaceKHR(instance, surface, nullptr); }
 
 	if (enableValidationLayers) { close_debug_messenger(instance); }
 	vkDestroyInstance(instance, nullptr);
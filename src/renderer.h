@@ -3,14 +3,51 @@
 
 #include <wayland-client.h>
 
+#include <libavutil/frame.h>
+
+#include "readback.h"
+#include "scaler.h"
+
+int 
+start_renderer(const char* appName);
+
+int 
+join_renderer(void);
+
+void 
+cancel_renderer(void);
+
 int 
 init_renderer(const char* appName, 
 	      struct wl_display* pDisplay, 
-	      struct wl_surface* pSurface);
+	      struct wl_surface* pSurface, 
+	      uint32_t width, 
+	      uint32_t height);
 
-void 
+int 
+init_renderer_headless(const char* appName, 
+		       uint32_t width, 
+		       uint32_t height, 
+		       bool readback);
+
+int 
+resize_renderer(uint32_t width, uint32_t height);
+
+int 
 render_surface(void);
 
+int 
+render_frame(AVFrame* pFrame);
+
+void 
+set_frame_readback(ReadbackHandler handler, void* pData);
+
+void 
+set_video_scale(uint32_t width, uint32_t height, ScaleFilter filter);
+
+void 
+finish_rendering(void);
+
 void 
 close_renderer(void);
 
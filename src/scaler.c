@@ -0,0 +1,826 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vulkan/vulkan.h>
+
+#include "buffers.h"
+#include "devices.h"
+#include "scaler.h"
+
+#define SCALE_GROUP_SIZE	8
+#define PI			3.14159265358979323846
+/* Source/destination pairs whose weights stay uploaded, e.g. across resolution
+ * switches of an adaptive stream */
+#define MAX_WEIGHT_TABLES	4
+
+/* SPIR-V generated at build time by glslc -mfmt=num, once per direction */
+static const uint32_t horizontalShaderCode[] = {
+#include "scale_h.spv.inc"
+};
+static const uint32_t verticalShaderCode[] = {
+#include "scale_v.spv.inc"
+};
+
+/* Push constants of scale.comp */
+typedef struct ScaleConstants {
+	float		yuvToRgb[16];
+	float		bitScale;
+	uint32_t	planar;
+	int32_t		size[2];	/* Output of the pass */
+	int32_t		taps;
+	int32_t		sourceLength;	/* Source pixels along the filtered direction */
+} ScaleConstants;
+
+/* Weights for one (source, destination, filter) triple. Each direction holds, per
+ * output pixel, the first source pixel followed by taps float weights. */
+typedef struct WeightTable {
+	VkExtent2D	source;
+	VkExtent2D	destination;
+	ScaleFilter	filter;
+	uint32_t	taps[2];	/* Horizontal, vertical */
+	VkDeviceSize	offsets[2];
+	VkDeviceSize	sizes[2];
+	VkBuffer	buffer;
+	VkDeviceMemory	memory;
+	uint64_t	lastUse;
+} WeightTable;
+
+typedef struct WeightTables {
+	uint32_t	count;
+	WeightTable	data[MAX_WEIGHT_TABLES];
+} WeightTables;
+static WeightTables tables;
+static uint64_t tableClock;
+
+typedef struct ScaleImage {
+	VkImage		image;
+	VkDeviceMemory	memory;
+	VkImageView	view;
+} ScaleImage;
+
+/* Images of one frame in flight, only touched after its fence signalled */
+typedef struct ScaleSlot {
+	VkExtent2D		source;
+	ScaleImage		intermediate;	/* Output width, source height, still YCbCr */
+	ScaleImage		output;
+	VkDescriptorSet		passSets[2];
+	VkDescriptorSet		outputSet;	/* Sampled by the graphics pipeline */
+	VkImageView		planeViews[VIDEO_PLANES];
+	const WeightTable*	pTable;
+} ScaleSlot;
+static ScaleSlot slots[MAX_FRAMES_IN_FLIGHT];
+
+typedef struct ScaleFilterName {
+	const char*	name;
+	ScaleFilter	filter;
+} ScaleFilterName;
+
+static const ScaleFilterName filterNames[] = {
+	{ "bilinear", SCALE_BILINEAR }, 
+	{ "bicubic", SCALE_BICUBIC }, 
+	{ "lanczos", SCALE_LANCZOS3 }, 
+};
+
+static VkExtent2D target;
+static ScaleFilter targetFilter;
+
+static VkPhysicalDevice scalerPhysicalDevice;
+static VkDevice scalerDevice;
+static VkSampler planeSampler;
+static VkDescriptorSetLayout passSetLayout;
+static VkPipelineLayout pipelineLayout;
+static VkPipeline pipelines[2];
+static VkDescriptorPool descriptorPool;
+static VkMemoryPropertyFlags weightMemory;
+static bool created;
+
+int 
+parse_scale_filter(const char* name, ScaleFilter* pFilter) 
+{
+	for (size_t i = 0; i < sizeof(filterNames) / sizeof(ScaleFilterName); ++i) {
+		if (strcmp(name, filterNames[i].name) == 0) {
+			*pFilter = filterNames[i].filter;
+			return EXIT_SUCCESS;
+		}
+	}
+
+	return EXIT_FAILURE;
+}
+
+/* Video frames are resampled to width x height before they are drawn. */
+void 
+set_scale_target(uint32_t width, uint32_t height, ScaleFilter filter) 
+{
+	target.width = width;
+	target.height = height;
+	targetFilter = filter;
+}
+
+bool 
+scaler_enabled(void) 
+{
+	return target.width && target.height;
+}
+
+static double 
+filter_radius(ScaleFilter filter) 
+{
+	switch (filter) {
+	case SCALE_BICUBIC:
+		return 2.0;
+	case SCALE_LANCZOS3:
+		return 3.0;
+	default:
+		return 1.0;
+	}
+}
+
+static double 
+sinc(double x) 
+{
+	if (fabs(x) < 1e-9) { return 1.0; }
+
+	return sin(PI * x) / (PI * x);
+}
+
+static double 
+filter_kernel(ScaleFilter filter, double x) 
+{
+	x = fabs(x);
+	switch (filter) {
+	case SCALE_BICUBIC:
+		if (x < 1.0) { return 1.5 * x * x * x - 2.5 * x * x + 1.0; }
+		if (x < 2.0) { return -0.5 * x * x * x + 2.5 * x * x - 4.0 * x + 2.0; }
+		return 0.0;
+	case SCALE_LANCZOS3:
+		return x < 3.0 ? sinc(x) * sinc(x / 3.0) : 0.0;
+	default:
+		return x < 1.0 ? 1.0 - x : 0.0;
+	}
+}
+
+/* Writes (taps + 1) floats per output pixel. When downscaling, the kernel is
+ * stretched over the source pixels each output pixel covers. */
+static float* 
+compute_weights(uint32_t sourceLength, 
+		uint32_t destinationLength, 
+		ScaleFilter filter, 
+		uint32_t* pTaps) 
+{
+	double ratio = (double) sourceLength / destinationLength;
+	double stretch = ratio > 1.0 ? ratio : 1.0;
+	double support = filter_radius(filter) * stretch;
+	uint32_t taps = (uint32_t) ceil(2.0 * support);
+
+	float* pWeights = malloc((size_t) destinationLength * (taps + 1) * sizeof(float));
+	if (!pWeights) { return nullptr; }
+
+	for (uint32_t i = 0; i < destinationLength; ++i) {
+		float* pEntry = &pWeights[(size_t) i * (taps + 1)];
+		double center = (i + 0.5) * ratio - 0.5;
+		int32_t first = (int32_t) floor(center - support) + 1;
+		memcpy(pEntry, &first, sizeof(first));
+
+		double sum = 0.0;
+		for (uint32_t t = 0; t < taps; ++t) {
+			double weight = filter_kernel(filter, (first + (int32_t) t - center) / stretch);
+			pEntry[1 + t] = (float) weight;
+			sum += weight;
+		}
+		/* Normalized, so flat areas keep their level. */
+		for (uint32_t t = 0; t < taps; ++t) { pEntry[1 + t] = (float) (pEntry[1 + t] / sum); }
+	}
+
+	*pTaps = taps;
+	return pWeights;
+}
+
+static void 
+destroy_weight_table(WeightTable* pTable) 
+{
+	vkDestroyBuffer(scalerDevice, pTable->buffer, nullptr);
+	vkFreeMemory(scalerDevice, pTable->memory, nullptr);
+	*pTable = (WeightTable) { };
+}
+
+/* Packs both passes' weights into one storage buffer. */
+static VkResult 
+upload_weight_table(WeightTable* pTable, float* const pWeights[2]) 
+{
+	uint32_t lengths[2] = { target.width, target.height };
+	VkDeviceSize size = 0;
+	for (size_t i = 0; i < 2; ++i) {
+		pTable->offsets[i] = size;
+		pTable->sizes[i] = (VkDeviceSize) lengths[i] * (pTable->taps[i] + 1) * sizeof(float);
+		/* Storage buffer offsets must be aligned, 256 bytes covers every device. */
+		size += (pTable->sizes[i] + 255) & ~(VkDeviceSize) 255;
+	}
+
+	if (create_buffer(scalerPhysicalDevice, 
+			   scalerDevice, 
+			   size, 
+			   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, 
+			   weightMemory, 
+			   &pTable->buffer, 
+			   &pTable->memory) != VK_SUCCESS) {
+		fputs("Scaler: failed to create the weight buffer.\n", stderr);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	uint8_t* pMapped;
+	if (vkMapMemory(scalerDevice, 
+			 pTable->memory, 
+			 0, 
+			 VK_WHOLE_SIZE, 
+			 0, 
+			 (void**) &pMapped) != VK_SUCCESS) {
+		fputs("Scaler: failed to map the weight buffer.\n", stderr);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+	for (size_t i = 0; i < 2; ++i) {
+		memcpy(pMapped + pTable->offsets[i], pWeights[i], pTable->sizes[i]);
+	}
+	vkUnmapMemory(scalerDevice, pTable->memory);
+
+	return VK_SUCCESS;
+}
+
+static VkResult 
+create_weight_table(WeightTable* pTable, VkExtent2D source) 
+{
+	pTable->source = source;
+	pTable->destination = target;
+	pTable->filter = targetFilter;
+
+	float* pWeights[2];
+	pWeights[0] = compute_weights(source.width, target.width, targetFilter, &pTable->taps[0]);
+	pWeights[1] = compute_weights(source.height, target.height, targetFilter, &pTable->taps[1]);
+	if (!pWeights[0] || !pWeights[1]) {
+		free(pWeights[0]);
+		free(pWeights[1]);
+		*pTable = (WeightTable) { };
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	VkResult ret = upload_weight_table(pTable, pWeights);
+	free(pWeights[0]);
+	free(pWeights[1]);
+	if (ret != VK_SUCCESS) { destroy_weight_table(pTable); }
+
+	return ret;
+}
+
+/* The weights for scaling source to the target, computed on first use only. */
+static const WeightTable* 
+find_weight_table(VkExtent2D source) 
+{
+	WeightTable* pTable = nullptr;
+	for (uint32_t i = 0; i < tables.count && !pTable; ++i) {
+		WeightTable* pCandidate = &tables.data[i];
+		if (pCandidate->source.width == source.width && 
+			pCandidate->source.height == source.height && 
+			pCandidate->destination.width == target.width && 
+			pCandidate->destination.height == target.height && 
+			pCandidate->filter == targetFilter) {
+			pTable = pCandidate;
+		}
+	}
+
+	if (!pTable) {
+		if (tables.count < MAX_WEIGHT_TABLES) {
+			pTable = &tables.data[tables.count++];
+		} else {
+			/* Evict the least recently used; other frames may still read it. */
+			pTable = &tables.data[0];
+			for (uint32_t i = 1; i < tables.count; ++i) {
+				if (tables.data[i].lastUse < pTable->lastUse) { pTable = &tables.data[i]; }
+			}
+			vkDeviceWaitIdle(scalerDevice);
+			for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+				if (slots[i].pTable == pTable) { slots[i].pTable = nullptr; }
+			}
+			destroy_weight_table(pTable);
+		}
+
+		/* A failed entry is left zeroed, it matches no source and is evicted first. */
+		if (create_weight_table(pTable, source) != VK_SUCCESS) { return nullptr; }
+	}
+
+	pTable->lastUse = ++tableClock;
+	return pTable;
+}
+
+static void 
+destroy_scale_image(ScaleImage* pImage) 
+{
+	vkDestroyImageView(scalerDevice, pImage->view, nullptr);
+	vkDestroyImage(scalerDevice, pImage->image, nullptr);
+	vkFreeMemory(scalerDevice, pImage->memory, nullptr);
+	*pImage = (ScaleImage) { };
+}
+
+static VkResult 
+create_scale_image(VkExtent2D extent, 
+		   VkFormat format, 
+		   VkImageUsageFlags usage, 
+		   ScaleImage* pImage) 
+{
+	if (create_image(scalerPhysicalDevice, 
+			  scalerDevice, 
+			  extent, 
+			  format, 
+			  usage, 
+			  &pImage->image, 
+			  &pImage->memory) != VK_SUCCESS) {
+		fputs("Scaler: failed to create scaler images.\n", stderr);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	VkImageViewCreateInfo viewInfo = { };
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = pImage->image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = format;
+	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewInfo.subresourceRange.baseMipLevel = 0;
+	viewInfo.subresourceRange.levelCount = 1;
+	viewInfo.subresourceRange.baseArrayLayer = 0;
+	viewInfo.subresourceRange.layerCount = 1;
+
+	if (vkCreateImageView(scalerDevice, &viewInfo, nullptr, &pImage->view) != VK_SUCCESS) {
+		fputs("Scaler: failed to create scaler image views.\n", stderr);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	return VK_SUCCESS;
+}
+
+static void 
+destroy_slot_images(ScaleSlot* pSlot) 
+{
+	destroy_scale_image(&pSlot->intermediate);
+	destroy_scale_image(&pSlot->output);
+	pSlot->source = (VkExtent2D) { };
+	pSlot->pTable = nullptr;
+	memset(pSlot->planeViews, 0, sizeof(pSlot->planeViews));
+}
+
+static VkResult 
+create_slot_images(ScaleSlot* pSlot, VkExtent2D source) 
+{
+	VkExtent2D intermediateExtent = { target.width, source.height };
+	VkResult ret = create_scale_image(intermediateExtent, 
+					  VK_FORMAT_R16G16B16A16_SFLOAT, 
+					  VK_IMAGE_USAGE_STORAGE_BIT, 
+					  &pSlot->intermediate);
+	if (ret != VK_SUCCESS) { return ret; }
+
+	ret = create_scale_image(target, 
+				 VK_FORMAT_R8G8B8A8_UNORM, 
+				 VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, 
+				 &pSlot->output);
+	if (ret != VK_SUCCESS) { return ret; }
+
+	/* The graphics pipeline samples the output through all of its plane bindings. */
+	VkDescriptorImageInfo outputInfos[VIDEO_PLANES];
+	for (size_t p = 0; p < VIDEO_PLANES; ++p) {
+		outputInfos[p].sampler = VK_NULL_HANDLE;
+		outputInfos[p].imageView = pSlot->output.view;
+		outputInfos[p].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	}
+
+	VkWriteDescriptorSet write = { };
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = pSlot->outputSet;
+	write.dstBinding = 0;
+	write.dstArrayElement = 0;
+	write.descriptorCount = VIDEO_PLANES;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	write.pImageInfo = outputInfos;
+	vkUpdateDescriptorSets(scalerDevice, 1, &write, 0, nullptr);
+
+	pSlot->source = source;
+	return VK_SUCCESS;
+}
+
+/* Horizontal pass: planes into the intermediate image. Vertical pass: intermediate
+ * into the output image. */
+static void 
+write_pass_descriptors(ScaleSlot* pSlot, const VkImageView* pPlaneViews) 
+{
+	VkDescriptorImageInfo planeInfos[VIDEO_PLANES];
+	for (size_t p = 0; p < VIDEO_PLANES; ++p) {
+		planeInfos[p].sampler = VK_NULL_HANDLE;
+		planeInfos[p].imageView = pPlaneViews[p];
+		planeInfos[p].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	}
+
+	VkDescriptorImageInfo intermediateInfo = { };
+	intermediateInfo.imageView = pSlot->intermediate.view;
+	intermediateInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	VkDescriptorImageInfo outputInfo = { };
+	outputInfo.imageView = pSlot->output.view;
+	outputInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	VkDescriptorBufferInfo weightInfos[2];
+	for (size_t i = 0; i < 2; ++i) {
+		weightInfos[i].buffer = pSlot->pTable->buffer;
+		weightInfos[i].offset = pSlot->pTable->offsets[i];
+		weightInfos[i].range = pSlot->pTable->sizes[i];
+	}
+
+	VkWriteDescriptorSet writes[6];
+	for (size_t i = 0; i < 6; ++i) {
+		writes[i] = (VkWriteDescriptorSet) { };
+		writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[i].dstArrayElement = 0;
+		writes[i].descriptorCount = 1;
+	}
+
+	writes[0].dstSet = pSlot->passSets[0];
+	writes[0].dstBinding = 0;
+	writes[0].descriptorCount = VIDEO_PLANES;
+	writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	writes[0].pImageInfo = planeInfos;
+
+	writes[1].dstSet = pSlot->passSets[0];
+	writes[1].dstBinding = 2;
+	writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	writes[1].pImageInfo = &intermediateInfo;
+
+	writes[2].dstSet = pSlot->passSets[0];
+	writes[2].dstBinding = 3;
+	writes[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	writes[2].pBufferInfo = &weightInfos[0];
+
+	writes[3].dstSet = pSlot->passSets[1];
+	writes[3].dstBinding = 1;
+	writes[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	writes[3].pImageInfo = &intermediateInfo;
+
+	writes[4].dstSet = pSlot->passSets[1];
+	writes[4].dstBinding = 2;
+	writes[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	writes[4].pImageInfo = &outputInfo;
+
+	writes[5].dstSet = pSlot->passSets[1];
+	writes[5].dstBinding = 3;
+	writes[5].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	writes[5].pBufferInfo = &weightInfos[1];
+
+	vkUpdateDescriptorSets(scalerDevice, 6, writes, 0, nullptr);
+	memcpy(pSlot->planeViews, pPlaneViews, sizeof(pSlot->planeViews));
+}
+
+static VkResult 
+create_pass_layout(VkDevice device) 
+{
+	VkSamplerCreateInfo samplerInfo = { };
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.maxLod = 0.0f;
+	samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+
+	if (vkCreateSampler(device, &samplerInfo, nullptr, &planeSampler) != VK_SUCCESS) {
+		fputs("Scaler: failed to create the plane sampler.\n", stderr);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	VkSampler samplers[VIDEO_PLANES];
+	for (size_t i = 0; i < VIDEO_PLANES; ++i) { samplers[i] = planeSampler; }
+
+	/* Planes, source image, destination image, weights */
+	VkDescriptorSetLayoutBinding bindings[4];
+	VkDescriptorType types[4] = {
+		VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 
+		VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 
+		VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 
+	};
+	for (uint32_t i = 0; i < 4; ++i) {
+		bindings[i] = (VkDescriptorSetLayoutBinding) { };
+		bindings[i].binding = i;
+		bindings[i].descriptorType = types[i];
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+	bindings[0].descriptorCount = VIDEO_PLANES;
+	bindings[0].pImmutableSamplers = samplers;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = { };
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = 4;
+	layoutInfo.pBindings = bindings;
+
+	if (vkCreateDescriptorSetLayout(device, 
+					 &layoutInfo, 
+					 nullptr, 
+					 &passSetLayout) != VK_SUCCESS) {
+		fputs("Scaler: failed to create descriptor set layout.\n", stderr);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	VkPushConstantRange pushConstantRange = { };
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(ScaleConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = { };
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &passSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(device, 
+				    &pipelineLayoutInfo, 
+				    nullptr, 
+				    &pipelineLayout) != VK_SUCCESS) {
+		fputs("Scaler: failed to create pipeline layout.\n", stderr);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	return VK_SUCCESS;
+}
+
+static VkResult 
+create_descriptor_sets(VkDevice device, VkDescriptorSetLayout outputLayout) 
+{
+	/* Two passes and the graphics set per frame in flight */
+	VkDescriptorPoolSize poolSizes[3];
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[0].descriptorCount = 2 * VIDEO_PLANES * MAX_FRAMES_IN_FLIGHT;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	poolSizes[1].descriptorCount = 3 * MAX_FRAMES_IN_FLIGHT;
+	poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[2].descriptorCount = 2 * MAX_FRAMES_IN_FLIGHT;
+
+	VkDescriptorPoolCreateInfo poolInfo = { };
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = 3 * MAX_FRAMES_IN_FLIGHT;
+	poolInfo.poolSizeCount = 3;
+	poolInfo.pPoolSizes = poolSizes;
+
+	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
+		fputs("Scaler: failed to create descriptor pool.\n", stderr);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+		VkDescriptorSetLayout setLayouts[3] = { passSetLayout, passSetLayout, outputLayout };
+		VkDescriptorSet descriptorSets[3];
+
+		VkDescriptorSetAllocateInfo allocInfo = { };
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = descriptorPool;
+		allocInfo.descriptorSetCount = 3;
+		allocInfo.pSetLayouts = setLayouts;
+
+		if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets) != VK_SUCCESS) {
+			fputs("Scaler: failed to allocate descriptor sets.\n", stderr);
+			return VK_ERROR_INITIALIZATION_FAILED;
+		}
+
+		slots[i].passSets[0] = descriptorSets[0];
+		slots[i].passSets[1] = descriptorSets[1];
+		slots[i].outputSet = descriptorSets[2];
+	}
+
+	return VK_SUCCESS;
+}
+
+/* Needs the graphics queue to run compute work, which it does on every device that
+ * has one. outputLayout is the graphics pipeline's plane set layout. */
+VkResult 
+create_scaler(VkPhysicalDevice physicalDevice, 
+	      VkDevice device, 
+	      uint32_t queueFamily, 
+	      VkDescriptorSetLayout outputLayout) 
+{
+	scalerPhysicalDevice = physicalDevice;
+	scalerDevice = device;
+
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+	VkQueueFamilyProperties* pFamilies = malloc(familyCount * sizeof(VkQueueFamilyProperties));
+	if (!pFamilies) { return VK_ERROR_INITIALIZATION_FAILED; }
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, pFamilies);
+	bool compute = queueFamily < familyCount && 
+		       (pFamilies[queueFamily].queueFlags & VK_QUEUE_COMPUTE_BIT);
+	free(pFamilies);
+	if (!compute) {
+		fputs("Scaler: the graphics queue cannot run compute shaders.\n", stderr);
+		return VK_ERROR_FEATURE_NOT_PRESENT;
+	}
+
+	/* Weights are read by every invocation; keep them in VRAM when it is mappable. */
+	uint32_t typeIndex;
+	weightMemory = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | 
+		       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | 
+		       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	if (find_memory_type(physicalDevice, ~0u, weightMemory, &typeIndex) != VK_SUCCESS) {
+		weightMemory = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | 
+			       VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	}
+
+	created = true;
+	VkResult ret = create_pass_layout(device);
+	if (ret != VK_SUCCESS) { return ret; }
+
+	ret = create_compute_pipeline(device, 
+				      "scale_h.spv", 
+				      horizontalShaderCode, 
+				      sizeof(horizontalShaderCode), 
+				      pipelineLayout, 
+				      &pipelines[0]);
+	if (ret != VK_SUCCESS) { return ret; }
+
+	ret = create_compute_pipeline(device, 
+				      "scale_v.spv", 
+				      verticalShaderCode, 
+				      sizeof(verticalShaderCode), 
+				      pipelineLayout, 
+				      &pipelines[1]);
+	if (ret != VK_SUCCESS) { return ret; }
+
+	return create_descriptor_sets(device, outputLayout);
+}
+
+static void 
+record_image_barrier(VkCommandBuffer commandBuffer, 
+		     VkImage image, 
+		     VkImageLayout oldLayout, 
+		     VkImageLayout newLayout, 
+		     VkAccessFlags srcAccess, 
+		     VkAccessFlags dstAccess, 
+		     VkPipelineStageFlags srcStage, 
+		     VkPipelineStageFlags dstStage) 
+{
+	VkImageMemoryBarrier barrier = { };
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcAccessMask = srcAccess;
+	barrier.dstAccessMask = dstAccess;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.layerCount = 1;
+
+	vkCmdPipelineBarrier(commandBuffer, 
+			      srcStage, 
+			      dstStage, 
+			      0, 
+			      0, nullptr, 
+			      0, nullptr, 
+			      1, &barrier);
+}
+
+/* Resamples the uploaded planes of a slot to the target size. Must be recorded
+ * outside the render pass, after the planes reached SHADER_READ_ONLY_OPTIMAL. */
+VkResult 
+record_scale(VkCommandBuffer commandBuffer, 
+	     uint32_t slot, 
+	     const VkImageView* pPlaneViews, 
+	     VkExtent2D source, 
+	     const ColorConversion* pConversion) 
+{
+	if (!created) { return VK_ERROR_INITIALIZATION_FAILED; }
+	ScaleSlot* pSlot = &slots[slot];
+
+	VkResult ret;
+	if (pSlot->source.width != source.width || pSlot->source.height != source.height) {
+		destroy_slot_images(pSlot);
+		ret = create_slot_images(pSlot, source);
+		if (ret != VK_SUCCESS) {
+			destroy_slot_images(pSlot);
+			return ret;
+		}
+	}
+
+	const WeightTable* pTable = find_weight_table(source);
+	if (!pTable) { return VK_ERROR_INITIALIZATION_FAILED; }
+	if (pTable != pSlot->pTable || 
+		memcmp(pSlot->planeViews, pPlaneViews, sizeof(pSlot->planeViews)) != 0) {
+		pSlot->pTable = pTable;
+		write_pass_descriptors(pSlot, pPlaneViews);
+	}
+
+	ScaleConstants constants = { };
+	memcpy(constants.yuvToRgb, pConversion->yuvToRgb, sizeof(constants.yuvToRgb));
+	constants.bitScale = pConversion->bitScale;
+	constants.planar = pConversion->planar;
+
+	/* Both images are overwritten entirely. */
+	record_image_barrier(commandBuffer, 
+			     pSlot->intermediate.image, 
+			     VK_IMAGE_LAYOUT_UNDEFINED, 
+			     VK_IMAGE_LAYOUT_GENERAL, 
+			     0, 
+			     VK_ACCESS_SHADER_WRITE_BIT, 
+			     VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 
+			     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+	record_image_barrier(commandBuffer, 
+			     pSlot->output.image, 
+			     VK_IMAGE_LAYOUT_UNDEFINED, 
+			     VK_IMAGE_LAYOUT_GENERAL, 
+			     0, 
+			     VK_ACCESS_SHADER_WRITE_BIT, 
+			     VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 
+			     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+	uint32_t sourceLengths[2] = { source.width, source.height };
+	VkExtent2D passSizes[2] = { { target.width, source.height }, target };
+	for (size_t i = 0; i < 2; ++i) {
+		constants.size[0] = (int32_t) passSizes[i].width;
+		constants.size[1] = (int32_t) passSizes[i].height;
+		constants.taps = (int32_t) pTable->taps[i];
+		constants.sourceLength = (int32_t) sourceLengths[i];
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines[i]);
+		vkCmdBindDescriptorSets(commandBuffer, 
+					VK_PIPELINE_BIND_POINT_COMPUTE, 
+					pipelineLayout, 
+					0, 
+					1, 
+					&pSlot->passSets[i], 
+					0, 
+					nullptr);
+		vkCmdPushConstants(commandBuffer, 
+				   pipelineLayout, 
+				   VK_SHADER_STAGE_COMPUTE_BIT, 
+				   0, 
+				   sizeof(ScaleConstants), 
+				   &constants);
+		vkCmdDispatch(commandBuffer, 
+			      (passSizes[i].width + SCALE_GROUP_SIZE - 1) / SCALE_GROUP_SIZE, 
+			      (passSizes[i].height + SCALE_GROUP_SIZE - 1) / SCALE_GROUP_SIZE, 
+			      1);
+
+		if (i == 0) {
+			record_image_barrier(commandBuffer, 
+					     pSlot->intermediate.image, 
+					     VK_IMAGE_LAYOUT_GENERAL, 
+					     VK_IMAGE_LAYOUT_GENERAL, 
+					     VK_ACCESS_SHADER_WRITE_BIT, 
+					     VK_ACCESS_SHADER_READ_BIT, 
+					     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 
+					     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+		}
+	}
+
+	record_image_barrier(commandBuffer, 
+			     pSlot->output.image, 
+			     VK_IMAGE_LAYOUT_GENERAL, 
+			     VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 
+			     VK_ACCESS_SHADER_WRITE_BIT, 
+			     VK_ACCESS_SHADER_READ_BIT, 
+			     VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 
+			     VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+	return VK_SUCCESS;
+}
+
+VkDescriptorSet 
+get_scaled_descriptor_set(uint32_t slot) 
+{
+	return slots[slot].outputSet;
+}
+
+void 
+close_scaler(VkDevice device) 
+{
+	if (!created) { return; }
+
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+		destroy_slot_images(&slots[i]);
+		slots[i] = (ScaleSlot) { };
+	}
+	for (uint32_t i = 0; i < tables.count; ++i) { destroy_weight_table(&tables.data[i]); }
+	tables.count = 0;
+
+	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+	for (size_t i = 0; i < 2; ++i) {
+		vkDestroyPipeline(device, pipelines[i], nullptr);
+		pipelines[i] = VK_NULL_HANDLE;
+	}
+	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, passSetLayout, nullptr);
+	vkDestroySampler(device, planeSampler, nullptr);
+
+	descriptorPool = VK_NULL_HANDLE;
+	pipelineLayout = VK_NULL_HANDLE;
+	passSetLayout = VK_NULL_HANDLE;
+	planeSampler = VK_NULL_HANDLE;
+	created = false;
+}
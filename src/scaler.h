@@ -0,0 +1,44 @@
+#ifndef	SCALER_H
+#define	SCALER_H
+
+#include <stdint.h>
+
+#include <vulkan/vulkan.h>
+
+#include "pipeline.h"
+
+typedef enum ScaleFilter {
+	SCALE_BILINEAR,
+	SCALE_BICUBIC,		/* Catmull-Rom */
+	SCALE_LANCZOS3,
+} ScaleFilter;
+
+int 
+parse_scale_filter(const char* name, ScaleFilter* pFilter);
+
+void 
+set_scale_target(uint32_t width, uint32_t height, ScaleFilter filter);
+
+bool 
+scaler_enabled(void);
+
+VkResult 
+create_scaler(VkPhysicalDevice physicalDevice, 
+	      VkDevice device, 
+	      uint32_t queueFamily, 
+	      VkDescriptorSetLayout outputLayout);
+
+VkResult 
+record_scale(VkCommandBuffer commandBuffer, 
+	     uint32_t slot, 
+	     const VkImageView* pPlaneViews, 
+	     VkExtent2D source, 
+	     const ColorConversion* pConversion);
+
+VkDescriptorSet 
+get_scaled_descriptor_set(uint32_t slot);
+
+void 
+close_scaler(VkDevice device);
+
+#endif	/* SCALER_H */
@@ -0,0 +1,163 @@
+#include <stdint.h>
+#include <time.h>
+
+#include <libavutil/avutil.h>
+#include <libavutil/mathematics.h>
+
+#include "client.h"
+#include "decoder.h"
+#include "scheduler.h"
+
+#define NS_PER_SECOND		1000000000ll
+#define DEFAULT_REFRESH_NS	16666667ll
+/* A timestamp jump this large is a discontinuity, not a gap in the stream. */
+#define MAX_PTS_GAP_NS		NS_PER_SECOND
+/* A frame this late means the source stalled: restart the clock instead of 
+ * dropping every frame after it. */
+#define MAX_LATENESS_NS		100000000ll
+
+/* Media time is mapped onto the presentation clock by one anchor: the frame with 
+ * media time originMediaNs is due on the vblank at originClockNs. */
+typedef struct MediaClock {
+	bool anchored;
+	int64_t originMediaNs;
+	int64_t originClockNs;
+	int64_t lastMediaNs;
+} MediaClock;
+static MediaClock mediaClock;
+
+static uint64_t droppedFrames;
+static uint64_t repeatedFrames;
+
+static int64_t 
+clock_now(void) 
+{
+	struct timespec now;
+	clock_gettime(get_presentation_clock(), &now);
+
+	return (int64_t) now.tv_sec * NS_PER_SECOND + now.tv_nsec;
+}
+
+/* When the frame rendered now should reach the screen */
+static int64_t 
+predict_vblank(int64_t* pRefreshNs) 
+{
+	int64_t now = clock_now();
+
+	FrameTiming timing;
+	if (!get_frame_timing(&timing) || !timing.refreshNs) {
+		*pRefreshNs = DEFAULT_REFRESH_NS;
+		return now + DEFAULT_REFRESH_NS;
+	}
+
+	int64_t refreshNs = timing.refreshNs;
+	int64_t lastNs = (int64_t) timing.presentNs;
+	int64_t cycles = (now > lastNs) ? (now - lastNs) / refreshNs + 1 : 1;
+
+	*pRefreshNs = refreshNs;
+	return lastNs + cycles * refreshNs;
+}
+
+/* Media time of the frame expected after the last one shown, at the nominal rate */
+static int64_t 
+next_media_time(void) 
+{
+	AVRational frameRate = get_frame_rate();
+	if (!frameRate.num || !frameRate.den) { frameRate = (AVRational) { 25, 1 }; }
+
+	return mediaClock.lastMediaNs + av_rescale(NS_PER_SECOND, frameRate.den, frameRate.num);
+}
+
+static int64_t 
+media_time(const AVFrame* pFrame) 
+{
+	int64_t pts = pFrame->best_effort_timestamp;
+	if (pts == AV_NOPTS_VALUE) { pts = pFrame->pts; }
+	if (pts != AV_NOPTS_VALUE) {
+		return av_rescale_q(pts, get_time_base(), (AVRational) { 1, NS_PER_SECOND });
+	}
+
+	/* Untimed frames follow the previous one. */
+	return next_media_time();
+}
+
+/* Picks the newest decoded frame due by the next vblank. Older frames it skips 
+ * are dropped without ever being uploaded; nullptr means repeat the frame on 
+ * screen because nothing new is due yet. */
+AVFrame* 
+schedule_frame(void) 
+{
+	int64_t refreshNs;
+	int64_t vblankNs = predict_vblank(&refreshNs);
+
+	AVFrame* pChosen = nullptr;
+	int64_t chosenDueNs = 0;
+	AVFrame* pNext;
+	while ((pNext = peek_frame())) {
+		int64_t mediaNs = media_time(pNext);
+		if (mediaClock.anchored && 
+			(mediaNs < mediaClock.lastMediaNs || 
+			 mediaNs - mediaClock.lastMediaNs > MAX_PTS_GAP_NS)) {
+			mediaClock.anchored = false;
+		}
+		if (!mediaClock.anchored) {
+			mediaClock.originMediaNs = mediaNs;
+			mediaClock.originClockNs = vblankNs;
+			mediaClock.anchored = true;
+		}
+
+		int64_t dueNs = mediaClock.originClockNs + (mediaNs - mediaClock.originMediaNs);
+		if (dueNs > vblankNs + refreshNs / 2) { break; }
+
+		acquire_frame();
+		if (pChosen) {
+			release_frame(pChosen);
+			++droppedFrames;
+		}
+		pChosen = pNext;
+		chosenDueNs = dueNs;
+		mediaClock.lastMediaNs = mediaNs;
+	}
+
+	if (!pChosen) {
+		/* Only a repeat if the next frame was due and the decoder had none ready; 
+		 * redraws between frames, or after the last one, are not. */
+		int64_t nextDueNs = mediaClock.originClockNs + 
+				    (next_media_time() - mediaClock.originMediaNs);
+		if (!pNext && mediaClock.anchored && !decoder_finished() && 
+			nextDueNs <= vblankNs + refreshNs / 2) {
+			++repeatedFrames;
+		}
+		return nullptr;
+	}
+
+	int64_t latenessNs = vblankNs - chosenDueNs;
+	if (latenessNs > MAX_LATENESS_NS) { mediaClock.originClockNs += latenessNs; }
+
+	return pChosen;
+}
+
+void 
+get_scheduler_stats(uint64_t* pDropped, uint64_t* pRepeated) 
+{
+	*pDropped = droppedFrames;
+	*pRepeated = repeatedFrames;
+}
+
+void 
+reset_scheduler(void) 
+{
+	mediaClock = (MediaClock) { };
+}
+
+/* Seeks from the frame on screen; the first frame after the seek anchors the clock. */
+void 
+seek_relative(int64_t offsetNs) 
+{
+	int64_t targetNs = mediaClock.lastMediaNs + offsetNs;
+	if (targetNs < 0) { targetNs = 0; }
+
+	request_seek(targetNs);
+	mediaClock = (MediaClock) { };
+	mediaClock.lastMediaNs = targetNs;
+}
@@ -0,0 +1,20 @@
+#ifndef	SCHEDULER_H
+#define	SCHEDULER_H
+
+#include <stdint.h>
+
+#include <libavutil/frame.h>
+
+AVFrame* 
+schedule_frame(void);
+
+void 
+get_scheduler_stats(uint64_t* pDropped, uint64_t* pRepeated);
+
+void 
+reset_scheduler(void);
+
+void 
+seek_relative(int64_t offsetNs);
+
+#endif	/* SCHEDULER_H */
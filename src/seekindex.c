@@ -0,0 +1,334 @@
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include <fcntl.h>
+#include <libavformat/avformat.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "mmapio.h"
+#include "seekindex.h"
+
+#define INDEX_MAGIC	0x58444e49u	/* "INDX" */
+#define INDEX_VERSION	2
+/* Bytes hashed at each end of the file to tell apart files of equal size and mtime */
+#define HASH_BLOCK_SIZE	65536
+
+/* Sidecar file layout: the header, then count KeyFrames sorted by pts. */
+typedef struct IndexHeader {
+	uint32_t	magic;
+	uint32_t	version;
+	uint64_t	fileSize;
+	int64_t		mtimeNs;
+	uint64_t	contentHash;
+	int32_t		streamIndex;
+	uint32_t	count;
+} IndexHeader;
+
+typedef struct KeyFrameArray {
+	uint32_t	count;
+	uint32_t	capacity;
+	KeyFrame*	data;
+} KeyFrameArray;
+
+/* Written once by whoever builds the index, read-only after indexReady is set. */
+static KeyFrameArray keyFrames;
+static atomic_bool indexReady;
+
+static IndexHeader fileKey;
+static char indexPath[4096];
+static char* pSourcePath;
+
+static thrd_t indexThread;
+static bool indexing;
+static atomic_bool cancelIndex;
+
+static uint64_t 
+hash_bytes(uint64_t hash, const uint8_t* pData, size_t size) 
+{
+	for (size_t i = 0; i < size; ++i) { hash = (hash ^ pData[i]) * 0x100000001b3ull; }
+
+	return hash;
+}
+
+/* Size, mtime and an FNV-1a hash of the head and tail identify the file. */
+static int 
+identify_file(const char* path, IndexHeader* pKey) 
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) { return EXIT_FAILURE; }
+
+	struct stat st;
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	uint8_t* pBlock = malloc(HASH_BLOCK_SIZE);
+	if (!pBlock) {
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	uint64_t hash = 0xcbf29ce484222325ull;
+	off_t tail = st.st_size > HASH_BLOCK_SIZE ? st.st_size - HASH_BLOCK_SIZE : 0;
+	off_t offsets[] = { 0, tail };
+	for (size_t i = 0; i < sizeof(offsets) / sizeof(off_t); ++i) {
+		ssize_t bytes = pread(fd, pBlock, HASH_BLOCK_SIZE, offsets[i]);
+		if (bytes > 0) { hash = hash_bytes(hash, pBlock, (size_t) bytes); }
+	}
+	free(pBlock);
+	close(fd);
+
+	*pKey = (IndexHeader) { };
+	pKey->magic = INDEX_MAGIC;
+	pKey->version = INDEX_VERSION;
+	pKey->fileSize = (uint64_t) st.st_size;
+	pKey->mtimeNs = (int64_t) st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+	pKey->contentHash = hash;
+
+	return EXIT_SUCCESS;
+}
+
+static int 
+append_keyframe(int64_t pts, int64_t pos) 
+{
+	if (keyFrames.count == keyFrames.capacity) {
+		uint32_t capacity = keyFrames.capacity ? keyFrames.capacity * 2 : 256;
+		KeyFrame* pData = realloc(keyFrames.data, capacity * sizeof(KeyFrame));
+		if (!pData) { return EXIT_FAILURE; }
+
+		keyFrames.data = pData;
+		keyFrames.capacity = capacity;
+	}
+
+	KeyFrame* pKey = &keyFrames.data[keyFrames.count++];
+	*pKey = (KeyFrame) { };
+	pKey->pts = pts;
+	pKey->pos = pos;
+
+	return EXIT_SUCCESS;
+}
+
+static int 
+compare_keyframes(const void* pA, const void* pB) 
+{
+	int64_t a = ((const KeyFrame*) pA)->pts;
+	int64_t b = ((const KeyFrame*) pB)->pts;
+
+	return (a > b) - (a < b);
+}
+
+static int 
+load_index(void) 
+{
+	uint8_t* pData = nullptr;
+	size_t size = 0;
+	if (read_cache_file(indexPath, &pData, &size) != EXIT_SUCCESS) { return EXIT_FAILURE; }
+
+	IndexHeader header;
+	bool valid = size >= sizeof(header);
+	if (valid) {
+		memcpy(&header, pData, sizeof(header));
+		valid = header.magic == fileKey.magic && 
+			header.version == fileKey.version && 
+			header.fileSize == fileKey.fileSize && 
+			header.mtimeNs == fileKey.mtimeNs && 
+			header.contentHash == fileKey.contentHash && 
+			header.streamIndex == fileKey.streamIndex && 
+			header.count > 0 && 
+			size == sizeof(header) + (size_t) header.count * sizeof(KeyFrame);
+	}
+	if (valid && (keyFrames.data = malloc(header.count * sizeof(KeyFrame)))) {
+		memcpy(keyFrames.data, pData + sizeof(header), header.count * sizeof(KeyFrame));
+		keyFrames.count = keyFrames.capacity = header.count;
+	}
+	free(pData);
+
+	if (!keyFrames.data) {
+		if (!valid) { fputs("Seek index: ignoring stale index cache.\n", stderr); }
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static void 
+save_index(void) 
+{
+	IndexHeader header = fileKey;
+	header.count = keyFrames.count;
+
+	size_t size = sizeof(header) + (size_t) keyFrames.count * sizeof(KeyFrame);
+	uint8_t* pData = malloc(size);
+	if (!pData) { return; }
+
+	memcpy(pData, &header, sizeof(header));
+	memcpy(pData + sizeof(header), keyFrames.data, keyFrames.count * sizeof(KeyFrame));
+	if (write_cache_file(indexPath, pData, size) != EXIT_SUCCESS) {
+		fputs("Seek index: failed to save the index cache.\n", stderr);
+	}
+	free(pData);
+}
+
+/* Whether read_header indexed the whole stream. The generic index fills up as 
+ * packets are read, so after probing it covers only the first seconds of the file, 
+ * and only if the probe cache did not skip probing. */
+bool 
+has_demuxer_index(const AVFormatContext* pContext, int streamIndex) 
+{
+	return !(pContext->iformat->flags & AVFMT_GENERIC_INDEX) && 
+		avformat_index_get_entries_count(pContext->streams[streamIndex]) > 0;
+}
+
+/* Containers with a sample table (MP4, MOV) already index every packet. */
+static int 
+copy_demuxer_index(AVStream* pStream) 
+{
+	int count = avformat_index_get_entries_count(pStream);
+	KeyFrame* pLast = nullptr;
+	for (int i = 0; i < count; ++i) {
+		const AVIndexEntry* pEntry = avformat_index_get_entry(pStream, i);
+		if (pEntry->flags & AVINDEX_KEYFRAME) {
+			if (append_keyframe(pEntry->timestamp, pEntry->pos) != EXIT_SUCCESS) {
+				return EXIT_FAILURE;
+			}
+			pLast = &keyFrames.data[keyFrames.count - 1];
+		}
+		if (pLast) { ++pLast->gopSize; }
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/* Everything else is read packet by packet, without decoding. */
+static int 
+scan_packets(AVFormatContext* pContext, int streamIndex) 
+{
+	AVPacket* pPacket = av_packet_alloc();
+	if (!pPacket) { return EXIT_FAILURE; }
+
+	int ret = EXIT_SUCCESS;
+	while (!atomic_load(&cancelIndex) && av_read_frame(pContext, pPacket) >= 0) {
+		if (pPacket->stream_index == streamIndex) {
+			int64_t pts = pPacket->pts != AV_NOPTS_VALUE ? pPacket->pts : pPacket->dts;
+			if ((pPacket->flags & AV_PKT_FLAG_KEY) && pts != AV_NOPTS_VALUE) {
+				ret = append_keyframe(pts, pPacket->pos);
+			}
+			if (keyFrames.count) { ++keyFrames.data[keyFrames.count - 1].gopSize; }
+		}
+		av_packet_unref(pPacket);
+		if (ret != EXIT_SUCCESS) { break; }
+	}
+	av_packet_free(&pPacket);
+
+	if (atomic_load(&cancelIndex)) { return EXIT_FAILURE; }
+
+	return ret;
+}
+
+static int 
+build_index(void* pData) 
+{
+	(void) pData;
+
+	AVFormatContext* pContext = nullptr;
+	if (open_mapped_input(&pContext, pSourcePath) < 0 || 
+		avformat_find_stream_info(pContext, nullptr) < 0 || 
+		fileKey.streamIndex >= (int) pContext->nb_streams) {
+		fputs("Seek index: failed to open the input.\n", stderr);
+		close_mapped_input(&pContext);
+		return EXIT_FAILURE;
+	}
+
+	int ret = has_demuxer_index(pContext, fileKey.streamIndex) ? 
+		copy_demuxer_index(pContext->streams[fileKey.streamIndex]) : 
+		scan_packets(pContext, fileKey.streamIndex);
+	close_mapped_input(&pContext);
+
+	if (ret != EXIT_SUCCESS || !keyFrames.count) {
+		if (!atomic_load(&cancelIndex)) { fputs("Seek index: no keyframes found.\n", stderr); }
+		return EXIT_FAILURE;
+	}
+
+	/* Decode order is not presentation order with B-frames in between. */
+	qsort(keyFrames.data, keyFrames.count, sizeof(KeyFrame), compare_keyframes);
+	if (indexPath[0]) { save_index(); }
+	atomic_store(&indexReady, true);
+
+	return EXIT_SUCCESS;
+}
+
+/* Loads the index saved for this file, or builds it in the background. Seeks made
+ * before it is ready fall back to the demuxer's own seeking. */
+int 
+open_seek_index(const char* path, int streamIndex) 
+{
+	if (identify_file(path, &fileKey) != EXIT_SUCCESS) { return EXIT_FAILURE; }
+	fileKey.streamIndex = streamIndex;
+
+	char name[64];
+	snprintf(name, 
+		 sizeof(name), 
+		 "%016" PRIx64 "-%" PRIx64 "-%d.idx", 
+		 fileKey.contentHash, 
+		 fileKey.fileSize, 
+		 streamIndex);
+	if (get_cache_path("seekindex", name, indexPath, sizeof(indexPath)) != EXIT_SUCCESS) {
+		indexPath[0] = '\0';
+	} else if (load_index() == EXIT_SUCCESS) {
+		atomic_store(&indexReady, true);
+		return EXIT_SUCCESS;
+	}
+
+	pSourcePath = strdup(path);
+	if (!pSourcePath) { return EXIT_FAILURE; }
+
+	atomic_store(&cancelIndex, false);
+	if (thrd_create(&indexThread, build_index, nullptr) != thrd_success) {
+		fputs("Seek index: failed to start the index thread.\n", stderr);
+		return EXIT_FAILURE;
+	}
+	indexing = true;
+
+	return EXIT_SUCCESS;
+}
+
+/* The last keyframe at or before pts, nullptr while no index is available */
+const KeyFrame* 
+find_keyframe(int64_t pts) 
+{
+	if (!atomic_load(&indexReady) || pts < keyFrames.data[0].pts) { return nullptr; }
+
+	uint32_t low = 0;
+	uint32_t high = keyFrames.count;
+	while (high - low > 1) {
+		uint32_t mid = low + (high - low) / 2;
+		if (keyFrames.data[mid].pts <= pts) { low = mid; } else { high = mid; }
+	}
+
+	return &keyFrames.data[low];
+}
+
+void 
+close_seek_index(void) 
+{
+	if (indexing) {
+		atomic_store(&cancelIndex, true);
+		thrd_join(indexThread, nullptr);
+		indexing = false;
+	}
+
+	atomic_store(&indexReady, false);
+	free(keyFrames.data);
+	keyFrames = (KeyFrameArray) { };
+	free(pSourcePath);
+	pSourcePath = nullptr;
+	indexPath[0] = '\0';
+}
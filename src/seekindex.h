@@ -0,0 +1,28 @@
+#ifndef	SEEKINDEX_H
+#define	SEEKINDEX_H
+
+#include <stdint.h>
+
+#include <libavformat/avformat.h>
+
+/* A keyframe of the indexed stream, in stream time base */
+typedef struct KeyFrame {
+	int64_t		pts;
+	int64_t		pos;		/* Byte offset of its packet, -1 if unknown */
+	uint32_t	gopSize;	/* Frames up to the next keyframe */
+	uint32_t	reserved;
+} KeyFrame;
+
+bool 
+has_demuxer_index(const AVFormatContext* pContext, int streamIndex);
+
+int 
+open_seek_index(const char* path, int streamIndex);
+
+const KeyFrame* 
+find_keyframe(int64_t pts);
+
+void 
+close_seek_index(void);
+
+#endif	/* SEEKINDEX_H */
@@ -1,10 +1,34 @@
 #version 450
 
-layout(location = 0) in vec3 fragColor;
+layout(binding = 0) uniform sampler2D planes[3];
+
+layout(push_constant) uniform ColorConversion {
+	mat4	yuvToRgb;	/* Range expansion, YCbCr matrix and offsets */
+	float	bitScale;	/* Rescales LSB-aligned high bit depth samples */
+	uint	planar;		/* Cb and Cr in separate planes */
+	uint	rgb;		/* planes[0] is already RGB, scaled by the compute pass */
+} conversion;
+
+layout(location = 0) in vec2 fragUV;
 
 layout(location = 0) out vec4 outColor;
 
 void main() 
 {
-	outColor = vec4(fragColor, 1.0);
+	if (conversion.rgb != 0) {
+		outColor = vec4(texture(planes[0], fragUV).rgb, 1.0);
+		return;
+	}
+
+	vec3 yuv;
+	yuv.x = texture(planes[0], fragUV).r;
+	if (conversion.planar != 0) {
+		yuv.y = texture(planes[1], fragUV).r;
+		yuv.z = texture(planes[2], fragUV).r;
+	} else {
+		yuv.yz = texture(planes[1], fragUV).rg;
+	}
+
+	vec3 rgb = (conversion.yuvToRgb * vec4(yuv * conversion.bitScale, 1.0)).rgb;
+	outColor = vec4(clamp(rgb, 0.0, 1.0), 1.0);
 }
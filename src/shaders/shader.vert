@@ -1,21 +1,10 @@
 #version 450
 
-layout(location = 0) out vec3 fragColor;
-
-vec2 positions[3] = vec2[](
-	vec2(0.0, -0.5), 
-	vec2(0.5, 0.5), 
-	vec2(-0.5, 0.5) 
-);
-
-vec3 colors[3] = vec3[](
-	vec3(1.0, 0.0, 0.0), 
-	vec3(0.0, 1.0, 0.0), 
-	vec3(0.0, 0.0, 1.0) 
-);
+layout(location = 0) out vec2 fragUV;
 
+/* One triangle covering the whole viewport, UVs in [0, 1] over the visible part */
 void main() 
 {
-	gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-	fragColor = colors[gl_VertexIndex];
+	fragUV = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+	gl_Position = vec4(fragUV * 2.0 - 1.0, 0.0, 1.0);
 }
@@ -0,0 +1,381 @@
+/* memfd_create() and file sealing */
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <libavutil/frame.h>
+#include <libswscale/swscale.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+#include "convert.h"
+#include "decoder.h"
+#include "scheduler.h"
+#include "shm.h"
+
+#define SHM_BUFFERS		3
+#define MAX_DAMAGE_RECTS	16
+
+typedef struct ShmBuffer {
+	struct wl_buffer*	pBuffer;
+	uint8_t*		pPixels;
+	bool			busy;	/* Read by the compositor until wl_buffer.release */
+} ShmBuffer;
+
+/* All buffers live in one memfd, one frame after the other. */
+typedef struct ShmPool {
+	uint8_t*	pMapped;
+	size_t		size;
+	uint32_t	width;
+	uint32_t	height;
+	uint32_t	stride;
+	ShmBuffer	buffers[SHM_BUFFERS];
+} ShmPool;
+static ShmPool pool;
+
+static struct wl_shm* pShmGlobal;
+static struct wl_surface* pShmSurface;
+static uint32_t windowWidth;
+static uint32_t windowHeight;
+
+/* Held until the next frame replaces it, so a resize can draw it again. */
+static AVFrame* pCurrentFrame;
+/* Damage is computed against the last committed buffer. */
+static ShmBuffer* pPresented;
+static bool contentChanged;
+
+/* Formats convert.c does not handle */
+static struct SwsContext* pSwsContext;
+static bool reportedFormat;
+
+static void 
+wl_buffer_release(void* pData, struct wl_buffer* pBuffer) 
+{
+	ShmBuffer* pShmBuffer = pData;
+	pShmBuffer->busy = false;
+}
+
+static const struct wl_buffer_listener 
+wl_buffer_listener = {
+	.release = wl_buffer_release, 
+};
+
+/* Buffers may be destroyed while the compositor still holds them, as long as their
+ * storage is never written again; the old mapping is dropped with them. */
+static void 
+destroy_pool(void) 
+{
+	for (uint32_t i = 0; i < SHM_BUFFERS; ++i) {
+		if (pool.buffers[i].pBuffer) { wl_buffer_destroy(pool.buffers[i].pBuffer); }
+	}
+	if (pool.pMapped) { munmap(pool.pMapped, pool.size); }
+
+	pool = (ShmPool) { };
+	pPresented = nullptr;
+}
+
+static int 
+create_pool(uint32_t width, uint32_t height) 
+{
+	uint32_t stride = width * 4;
+	size_t frameSize = (size_t) stride * height;
+	size_t size = frameSize * SHM_BUFFERS;
+	if (size > INT32_MAX) {
+		fputs("Shm: the frame is too large for a shm pool.\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	int fd = memfd_create("devideo-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd == -1) {
+		perror("Shm: failed to create the pool file");
+		return EXIT_FAILURE;
+	}
+	if (ftruncate(fd, (off_t) size) == -1) {
+		perror("Shm: failed to size the pool file");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	/* A pool that cannot shrink cannot make the compositor fault on it. */
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL);
+
+	void* pMapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (pMapped == MAP_FAILED) {
+		perror("Shm: failed to map the pool");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	/* The buffers keep the pool alive on the compositor side. */
+	struct wl_shm_pool* pShmPool = wl_shm_create_pool(pShmGlobal, fd, (int32_t) size);
+	close(fd);
+
+	pool.pMapped = pMapped;
+	pool.size = size;
+	pool.width = width;
+	pool.height = height;
+	pool.stride = stride;
+	for (uint32_t i = 0; i < SHM_BUFFERS; ++i) {
+		ShmBuffer* pBuffer = &pool.buffers[i];
+		pBuffer->pPixels = pool.pMapped + frameSize * i;
+		pBuffer->pBuffer = wl_shm_pool_create_buffer(pShmPool, 
+							     (int32_t) (frameSize * i), 
+							     (int32_t) width, 
+							     (int32_t) height, 
+							     (int32_t) stride, 
+							     WL_SHM_FORMAT_XRGB8888);
+		wl_buffer_add_listener(pBuffer->pBuffer, &wl_buffer_listener, pBuffer);
+	}
+	wl_shm_pool_destroy(pShmPool);
+
+	return EXIT_SUCCESS;
+}
+
+/* The surface takes the size of its buffers, as nothing scales them. A video
+ * that does not fit the window is shown at half size. */
+static void 
+get_buffer_size(uint32_t* pWidth, uint32_t* pHeight, bool* pHalf) 
+{
+	if (!pCurrentFrame) {
+		*pWidth = windowWidth;
+		*pHeight = windowHeight;
+		*pHalf = false;
+		return;
+	}
+
+	uint32_t width = (uint32_t) pCurrentFrame->width;
+	uint32_t height = (uint32_t) pCurrentFrame->height;
+	*pHalf = (width > windowWidth || height > windowHeight) && width >= 2 && height >= 2;
+	*pWidth = *pHalf ? width / 2 : width;
+	*pHeight = *pHalf ? height / 2 : height;
+}
+
+static ShmBuffer* 
+find_free_buffer(void) 
+{
+	for (uint32_t i = 0; i < SHM_BUFFERS; ++i) {
+		ShmBuffer* pBuffer = &pool.buffers[i];
+		if (!pBuffer->busy && pBuffer != pPresented) { return pBuffer; }
+	}
+
+	return nullptr;
+}
+
+static int 
+scale_frame(const AVFrame* pFrame, uint8_t* pPixels) 
+{
+	pSwsContext = sws_getCachedContext(pSwsContext, 
+					   pFrame->width, 
+					   pFrame->height, 
+					   pFrame->format, 
+					   (int) pool.width, 
+					   (int) pool.height, 
+					   AV_PIX_FMT_BGRA, 
+					   SWS_BILINEAR, 
+					   nullptr, 
+					   nullptr, 
+					   nullptr);
+	if (!pSwsContext) {
+		if (!reportedFormat) { fputs("Shm: cannot convert the video format.\n", stderr); }
+		reportedFormat = true;
+		return EXIT_FAILURE;
+	}
+
+	uint8_t* planes[4] = { pPixels };
+	int strides[4] = { (int) pool.stride };
+	sws_scale(pSwsContext, 
+		  (const uint8_t* const*) pFrame->data, 
+		  pFrame->linesize, 
+		  0, 
+		  pFrame->height, 
+		  planes, 
+		  strides);
+
+	return EXIT_SUCCESS;
+}
+
+static int 
+draw_buffer(ShmBuffer* pBuffer, bool half) 
+{
+	if (!pCurrentFrame) {
+		memset(pBuffer->pPixels, 0, (size_t) pool.stride * pool.height);
+		return EXIT_SUCCESS;
+	}
+
+	/* XRGB8888 is little endian: blue comes first in memory. */
+	if (is_convertible(pCurrentFrame->format)) {
+		return convert_frame(pCurrentFrame, pBuffer->pPixels, pool.stride, PIXEL_BGRA, half);
+	}
+
+	return scale_frame(pCurrentFrame, pBuffer->pPixels);
+}
+
+/* First and last differing pixels of a row that is known to differ */
+static void 
+get_row_changes(const uint8_t* pRow, 
+		const uint8_t* pPrevious, 
+		uint32_t* pLeft, 
+		uint32_t* pRight) 
+{
+	uint32_t left = 0;
+	while (left < *pLeft && memcmp(pRow + left * 4, pPrevious + left * 4, 4) == 0) { ++left; }
+
+	uint32_t right = pool.width;
+	while (right > *pRight && memcmp(pRow + (right - 1) * 4, pPrevious + (right - 1) * 4, 4) == 0) {
+		--right;
+	}
+
+	*pLeft = left;
+	*pRight = right;
+}
+
+static void 
+damage(int32_t x, int32_t y, int32_t width, int32_t height) 
+{
+	/* Surface and buffer coordinates are the same: no scale, no transform. */
+	if (wl_surface_get_version(pShmSurface) >= WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION) {
+		wl_surface_damage_buffer(pShmSurface, x, y, width, height);
+	} else {
+		wl_surface_damage(pShmSurface, x, y, width, height);
+	}
+}
+
+/* Compositors upload shm buffers by damage, so only rows that differ from the last
+ * commit are sent, as bands trimmed to their changed columns. Past MAX_DAMAGE_RECTS
+ * bands the last one grows over the rest. Returns false if nothing changed. */
+static bool 
+damage_changes(const ShmBuffer* pBuffer) 
+{
+	if (!pPresented) {
+		damage(0, 0, INT32_MAX, INT32_MAX);
+		return true;
+	}
+
+	typedef struct Band {
+		uint32_t	top;
+		uint32_t	bottom;
+		uint32_t	left;
+		uint32_t	right;
+	} Band;
+	Band bands[MAX_DAMAGE_RECTS];
+	uint32_t count = 0;
+
+	size_t rowSize = (size_t) pool.width * 4;
+	for (uint32_t y = 0; y < pool.height; ++y) {
+		const uint8_t* pRow = pBuffer->pPixels + (size_t) y * pool.stride;
+		const uint8_t* pPrevious = pPresented->pPixels + (size_t) y * pool.stride;
+		if (memcmp(pRow, pPrevious, rowSize) == 0) { continue; }
+
+		Band* pBand = count ? &bands[count - 1] : nullptr;
+		if (!pBand || (pBand->bottom != y && count < MAX_DAMAGE_RECTS)) {
+			pBand = &bands[count++];
+			*pBand = (Band) { y, y, pool.width, 0 };
+		}
+		get_row_changes(pRow, pPrevious, &pBand->left, &pBand->right);
+		pBand->bottom = y + 1;
+	}
+
+	for (uint32_t i = 0; i < count; ++i) {
+		damage((int32_t) bands[i].left, 
+		       (int32_t) bands[i].top, 
+		       (int32_t) (bands[i].right - bands[i].left), 
+		       (int32_t) (bands[i].bottom - bands[i].top));
+	}
+
+	return count > 0;
+}
+
+int 
+init_shm_presenter(struct wl_shm* pShm, 
+		   struct wl_surface* pSurface, 
+		   uint32_t width, 
+		   uint32_t height) 
+{
+	if (!pShm) {
+		fputs("Shm: the compositor does not offer wl_shm.\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	pShmGlobal = pShm;
+	pShmSurface = pSurface;
+	windowWidth = width;
+	windowHeight = height;
+	contentChanged = true;
+
+	return EXIT_SUCCESS;
+}
+
+void 
+resize_shm_presenter(uint32_t width, uint32_t height) 
+{
+	windowWidth = width;
+	windowHeight = height;
+	contentChanged = true;
+}
+
+/* Always commits, so that the frame callback requested for this frame fires; a new
+ * buffer is attached only when there is something new to show and a buffer the
+ * compositor has released. */
+int 
+present_shm_frame(void) 
+{
+	AVFrame* pFrame = schedule_frame();
+	if (pFrame) {
+		if (pCurrentFrame) { release_frame(pCurrentFrame); }
+		pCurrentFrame = pFrame;
+		contentChanged = true;
+	}
+
+	if (contentChanged) {
+		uint32_t width, height;
+		bool half;
+		get_buffer_size(&width, &height, &half);
+		if (width != pool.width || height != pool.height) {
+			destroy_pool();
+			if (create_pool(width, height) != EXIT_SUCCESS) { return EXIT_FAILURE; }
+		}
+
+		ShmBuffer* pBuffer = find_free_buffer();
+		if (pBuffer) {
+			if (draw_buffer(pBuffer, half) != EXIT_SUCCESS) {
+				/* The previous picture stays attached; the frame is kept for the
+				 * next redraw, and handed back when a newer one replaces it. */
+				contentChanged = false;
+				wl_surface_commit(pShmSurface);
+				return EXIT_FAILURE;
+			}
+
+			/* A repeated picture keeps the current buffer attached. */
+			if (damage_changes(pBuffer)) {
+				wl_surface_attach(pShmSurface, pBuffer->pBuffer, 0, 0);
+				pBuffer->busy = true;
+				pPresented = pBuffer;
+			}
+			contentChanged = false;
+		}
+	}
+
+	wl_surface_commit(pShmSurface);
+
+	return EXIT_SUCCESS;
+}
+
+/* Hands the held frame back to the decoder. */
+void 
+close_shm_presenter(void) 
+{
+	if (pCurrentFrame) {
+		release_frame(pCurrentFrame);
+		pCurrentFrame = nullptr;
+	}
+	destroy_pool();
+
+	sws_freeContext(pSwsContext);
+	pSwsContext = nullptr;
+	pShmGlobal = nullptr;
+	pShmSurface = nullptr;
+}
@@ -0,0 +1,23 @@
+#ifndef	SHM_H
+#define	SHM_H
+
+#include <stdint.h>
+
+#include <wayland-client.h>
+
+int 
+init_shm_presenter(struct wl_shm* pShm, 
+		   struct wl_surface* pSurface, 
+		   uint32_t width, 
+		   uint32_t height);
+
+void 
+resize_shm_presenter(uint32_t width, uint32_t height);
+
+int 
+present_shm_frame(void);
+
+void 
+close_shm_presenter(void);
+
+#endif	/* SHM_H */
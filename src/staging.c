@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vulkan/vulkan.h>
+
+#include "buffers.h"
+#include "staging.h"
+
+/* One host-visible buffer, mapped for its whole lifetime and split into a region 
+ * per frame in flight. A region is only written after the fence of the frame 
+ * that last read it has signalled, so the ring needs no locking of its own. */
+typedef struct StagingRing {
+	VkBuffer buffer;
+	VkDeviceMemory memory;
+	uint8_t* pMapped;
+	VkDeviceSize slotSize;
+	uint32_t slotCount;
+} StagingRing;
+static StagingRing ring;
+
+VkResult 
+create_staging_ring(VkPhysicalDevice physicalDevice, 
+		    VkDevice device, 
+		    VkDeviceSize slotSize, 
+		    uint32_t slotCount) 
+{
+	/* Keeps every region aligned for any texel size a copy may use. */
+	slotSize = (slotSize + 255) & ~(VkDeviceSize) 255;
+
+	if (create_buffer(physicalDevice, 
+			   device, 
+			   slotSize * slotCount, 
+			   VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
+			   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | 
+			   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
+			   &ring.buffer, 
+			   &ring.memory) != VK_SUCCESS) {
+		fputs("Staging: failed to create the staging ring.\n", stderr);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	void* pMapped;
+	if (vkMapMemory(device, ring.memory, 0, VK_WHOLE_SIZE, 0, &pMapped) != VK_SUCCESS) {
+		fputs("Staging: failed to map the staging ring.\n", stderr);
+		close_staging_ring(device);
+		return VK_ERROR_MEMORY_MAP_FAILED;
+	}
+	ring.pMapped = pMapped;
+	ring.slotSize = slotSize;
+	ring.slotCount = slotCount;
+
+	return VK_SUCCESS;
+}
+
+VkBuffer 
+get_staging_buffer(void) 
+{
+	return ring.buffer;
+}
+
+VkDeviceSize 
+get_staging_capacity(void) 
+{
+	return ring.slotSize;
+}
+
+uint8_t* 
+map_staging_slot(uint32_t slot, VkDeviceSize* pOffset) 
+{
+	if (!ring.pMapped || slot >= ring.slotCount) { return nullptr; }
+
+	*pOffset = ring.slotSize * slot;
+	return ring.pMapped + *pOffset;
+}
+
+void 
+close_staging_ring(VkDevice device) 
+{
+	if (ring.pMapped) { vkUnmapMemory(device, ring.memory); }
+	vkDestroyBuffer(device, ring.buffer, nullptr);
+	vkFreeMemory(device, ring.memory, nullptr);
+	ring = (StagingRing) { };
+}
@@ -0,0 +1,26 @@
+#ifndef	STAGING_H
+#define	STAGING_H
+
+#include <stdint.h>
+
+#include <vulkan/vulkan.h>
+
+VkResult 
+create_staging_ring(VkPhysicalDevice physicalDevice, 
+		    VkDevice device, 
+		    VkDeviceSize slotSize, 
+		    uint32_t slotCount);
+
+VkBuffer 
+get_staging_buffer(void);
+
+VkDeviceSize 
+get_staging_capacity(void);
+
+uint8_t* 
+map_staging_slot(uint32_t slot, VkDeviceSize* pOffset);
+
+void 
+close_staging_ring(VkDevice device);
+
+#endif	/* STAGING_H */
@@ -0,0 +1,618 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <vulkan/vulkan.h>
+
+#include "buffers.h"
+#include "decoder.h"
+#include "devices.h"
+#include "framepool.h"
+#include "hostimport.h"
+#include "pipeline.h"
+#include "scaler.h"
+#include "staging.h"
+#include "video.h"
+
+/* How a decoder pixel format maps onto sampled planes */
+typedef struct PlaneLayout {
+	enum AVPixelFormat	pixelFormat;
+	uint32_t		planeCount;
+	VkFormat		formats[VIDEO_PLANES];
+	uint32_t		bytesPerPixel[VIDEO_PLANES];
+	uint32_t		depth;		/* Bits spanned by a sample once bitScale is applied */
+	float			bitScale;
+} PlaneLayout;
+
+static const PlaneLayout planeLayouts[] = {
+	{ AV_PIX_FMT_NV12, 2, 
+	  { VK_FORMAT_R8_UNORM, VK_FORMAT_R8G8_UNORM }, { 1, 2 }, 8, 1.0f }, 
+	{ AV_PIX_FMT_P010LE, 2, 
+	  { VK_FORMAT_R16_UNORM, VK_FORMAT_R16G16_UNORM }, { 2, 4 }, 16, 1.0f }, 
+	{ AV_PIX_FMT_YUV420P, 3, 
+	  { VK_FORMAT_R8_UNORM, VK_FORMAT_R8_UNORM, VK_FORMAT_R8_UNORM }, { 1, 1, 1 }, 8, 1.0f }, 
+	{ AV_PIX_FMT_YUVJ420P, 3, 
+	  { VK_FORMAT_R8_UNORM, VK_FORMAT_R8_UNORM, VK_FORMAT_R8_UNORM }, { 1, 1, 1 }, 8, 1.0f }, 
+	{ AV_PIX_FMT_YUV420P10LE, 3, 
+	  { VK_FORMAT_R16_UNORM, VK_FORMAT_R16_UNORM, VK_FORMAT_R16_UNORM }, { 2, 2, 2 }, 
+	  10, 65535.0f / 1023.0f }, 
+};
+
+/* Geometry of the frames currently coming from the decoder */
+typedef struct VideoFormat {
+	const PlaneLayout*	pLayout;
+	uint32_t		width;
+	uint32_t		height;
+	VkExtent2D		extents[VIDEO_PLANES];
+	int			rowSizes[VIDEO_PLANES];
+	VkDeviceSize		offsets[VIDEO_PLANES];	/* Plane offsets in a staging slot */
+	VkDeviceSize		size;
+} VideoFormat;
+static VideoFormat format;
+static uint64_t formatSerial;
+static enum AVPixelFormat rejectedFormat = AV_PIX_FMT_NONE;
+
+/* Decoded frames still needed: the one on screen, and older ones a frame in flight 
+ * copies from. Each goes back to the decoder once its last user is done. */
+#define MAX_HELD_FRAMES	(MAX_FRAMES_IN_FLIGHT + 1)
+typedef struct HeldFrame {
+	AVFrame* pFrame;
+	uint32_t users;
+} HeldFrame;
+static HeldFrame heldFrames[MAX_HELD_FRAMES];
+static HeldFrame* pCurrent;
+static uint64_t frameSerial;
+
+typedef struct PlaneImage {
+	VkImage image;
+	VkDeviceMemory memory;
+	VkImageView view;
+} PlaneImage;
+
+/* Planes sampled by one frame in flight, only touched after its fence signalled */
+typedef struct VideoSlot {
+	PlaneImage planes[VIDEO_PLANES];
+	VkDescriptorSet descriptorSet;
+	ColorConversion conversion;
+	HeldFrame* pSource;	/* Imported frame the last upload reads from */
+	bool scaled;		/* Drawn from the scaler output instead of the planes */
+	uint64_t formatSerial;	/* Zero while the slot has no planes */
+	uint64_t frameSerial;	/* Zero until a frame was uploaded */
+} VideoSlot;
+static VideoSlot slots[MAX_FRAMES_IN_FLIGHT];
+
+static VkPhysicalDevice videoPhysicalDevice;
+static VkDevice videoDevice;
+static VkDescriptorPool descriptorPool;
+
+VkResult 
+create_video_resources(VkPhysicalDevice physicalDevice, 
+		       VkDevice device, 
+		       VkDescriptorSetLayout setLayout) 
+{
+	videoPhysicalDevice = physicalDevice;
+	videoDevice = device;
+
+	VkDescriptorPoolSize poolSize = { };
+	poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSize.descriptorCount = VIDEO_PLANES * MAX_FRAMES_IN_FLIGHT;
+
+	VkDescriptorPoolCreateInfo poolInfo = { };
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = MAX_FRAMES_IN_FLIGHT;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+
+	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
+		fputs("Video: failed to create descriptor pool.\n", stderr);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	VkDescriptorSetLayout setLayouts[MAX_FRAMES_IN_FLIGHT];
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) { setLayouts[i] = setLayout; }
+
+	VkDescriptorSetAllocateInfo allocInfo = { };
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+	allocInfo.pSetLayouts = setLayouts;
+
+	VkDescriptorSet descriptorSets[MAX_FRAMES_IN_FLIGHT];
+	if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets) != VK_SUCCESS) {
+		fputs("Video: failed to allocate descriptor sets.\n", stderr);
+		return VK_ERROR_INITIALIZATION_FAILED;
+	}
+
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+		slots[i].descriptorSet = descriptorSets[i];
+	}
+
+	return VK_SUCCESS;
+}
+
+const PlaneLayout* 
+find_plane_layout(enum AVPixelFormat pixelFormat) 
+{
+	const PlaneLayout* pLayout = nullptr;
+	for (size_t i = 0; i < sizeof(planeLayouts) / sizeof(PlaneLayout) && !pLayout; ++i) {
+		if (planeLayouts[i].pixelFormat == pixelFormat) { pLayout = &planeLayouts[i]; }
+	}
+	if (!pLayout) { return nullptr; }
+
+	/* Linear filtering of 16 bit formats is optional. */
+	for (uint32_t p = 0; p < pLayout->planeCount; ++p) {
+		VkFormatProperties properties;
+		vkGetPhysicalDeviceFormatProperties(videoPhysicalDevice, 
+						    pLayout->formats[p], 
+						    &properties);
+		if (!(properties.optimalTilingFeatures & 
+			VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
+			return nullptr;
+		}
+	}
+
+	return pLayout;
+}
+
+void 
+compute_conversion(const AVFrame* pFrame, 
+		   const PlaneLayout* pLayout, 
+		   ColorConversion* pConversion) 
+{
+	float kr, kb;
+	switch (pFrame->colorspace) {
+	case AVCOL_SPC_BT2020_NCL:
+	case AVCOL_SPC_BT2020_CL:
+		kr = 0.2627f;
+		kb = 0.0593f;
+		break;
+	case AVCOL_SPC_BT709:
+		kr = 0.2126f;
+		kb = 0.0722f;
+		break;
+	case AVCOL_SPC_BT470BG:
+	case AVCOL_SPC_SMPTE170M:
+		kr = 0.299f;
+		kb = 0.114f;
+		break;
+	default:
+		/* Untagged streams: HD is almost always BT.709, SD BT.601. */
+		kr = (pFrame->height >= 720) ? 0.2126f : 0.299f;
+		kb = (pFrame->height >= 720) ? 0.0722f : 0.114f;
+		break;
+	}
+	float kg = 1.0f - kr - kb;
+
+	/* R'G'B' from Y' in [0, 1] and Cb, Cr in [-0.5, 0.5], rows R, G, B */
+	const float matrix[3][3] = {
+		{ 1.0f, 0.0f, 2.0f * (1.0f - kr) }, 
+		{ 1.0f, -2.0f * kb * (1.0f - kb) / kg, -2.0f * kr * (1.0f - kr) / kg }, 
+		{ 1.0f, 2.0f * (1.0f - kb), 0.0f }, 
+	};
+
+	/* Samples reach the shader as code / (2^depth - 1). */
+	float max = (float) ((1u << pLayout->depth) - 1);
+	uint32_t shift = pLayout->depth - 8;
+	float scale[3], offset[3];
+	offset[1] = offset[2] = (float) (128u << shift) / max;
+	if (pFrame->color_range == AVCOL_RANGE_JPEG || pLayout->pixelFormat == AV_PIX_FMT_YUVJ420P) {
+		scale[0] = scale[1] = scale[2] = 1.0f;
+		offset[0] = 0.0f;
+	} else {
+		scale[0] = max / (float) (219u << shift);
+		scale[1] = scale[2] = max / (float) (224u << shift);
+		offset[0] = (float) (16u << shift) / max;
+	}
+
+	float* m = pConversion->yuvToRgb;
+	memset(m, 0, sizeof(pConversion->yuvToRgb));
+	for (size_t row = 0; row < 3; ++row) {
+		for (size_t column = 0; column < 3; ++column) {
+			float coefficient = matrix[row][column] * scale[column];
+			m[column * 4 + row] = coefficient;
+			m[12 + row] -= coefficient * offset[column];
+		}
+	}
+	m[15] = 1.0f;
+
+	pConversion->bitScale = pLayout->bitScale;
+	pConversion->planar = (pLayout->planeCount == 3);
+	pConversion->rgb = 0;
+}
+
+static HeldFrame* 
+hold_frame(AVFrame* pFrame) 
+{
+	for (size_t i = 0; i < MAX_HELD_FRAMES; ++i) {
+		if (heldFrames[i].users) { continue; }
+
+		heldFrames[i].pFrame = pFrame;
+		heldFrames[i].users = 1;
+		return &heldFrames[i];
+	}
+
+	return nullptr;
+}
+
+static void 
+drop_frame(HeldFrame** ppHeld) 
+{
+	HeldFrame* pHeld = *ppHeld;
+	if (!pHeld) { return; }
+
+	if (--pHeld->users == 0) {
+		release_frame(pHeld->pFrame);
+		pHeld->pFrame = nullptr;
+	}
+	*ppHeld = nullptr;
+}
+
+/* Takes ownership of the frame on success. */
+int 
+set_video_frame(AVFrame* pFrame) 
+{
+	if (!format.pLayout || 
+		format.pLayout->pixelFormat != pFrame->format || 
+		format.width != (uint32_t) pFrame->width || 
+		format.height != (uint32_t) pFrame->height) {
+		const PlaneLayout* pLayout = find_plane_layout(pFrame->format);
+		if (!pLayout) {
+			if (rejectedFormat != pFrame->format) {
+				fprintf(stderr, 
+					"Video: unsupported pixel format %s.\n", 
+					av_get_pix_fmt_name(pFrame->format));
+				rejectedFormat = pFrame->format;
+			}
+			return EXIT_FAILURE;
+		}
+
+		format.pLayout = pLayout;
+		format.width = pFrame->width;
+		format.height = pFrame->height;
+		format.size = 0;
+		for (uint32_t p = 0; p < pLayout->planeCount; ++p) {
+			/* Every supported format is 4:2:0. */
+			uint32_t shift = (p == 0) ? 0 : 1;
+			format.extents[p].width = (format.width + shift) >> shift;
+			format.extents[p].height = (format.height + shift) >> shift;
+
+			format.rowSizes[p] = format.extents[p].width * pLayout->bytesPerPixel[p];
+			format.offsets[p] = format.size;
+			VkDeviceSize planeSize = (VkDeviceSize) format.rowSizes[p] * 
+						 format.extents[p].height;
+			format.size += (planeSize + 15) & ~(VkDeviceSize) 15;
+		}
+		++formatSerial;
+	}
+
+	drop_frame(&pCurrent);
+	pCurrent = hold_frame(pFrame);
+	if (!pCurrent) { return EXIT_FAILURE; }
+	++frameSerial;
+
+	return EXIT_SUCCESS;
+}
+
+void 
+destroy_slot_planes(VideoSlot* pSlot) 
+{
+	for (size_t p = 0; p < VIDEO_PLANES; ++p) {
+		PlaneImage* pPlane = &pSlot->planes[p];
+		vkDestroyImageView(videoDevice, pPlane->view, nullptr);
+		vkDestroyImage(videoDevice, pPlane->image, nullptr);
+		vkFreeMemory(videoDevice, pPlane->memory, nullptr);
+		*pPlane = (PlaneImage) { };
+	}
+
+	drop_frame(&pSlot->pSource);
+	pSlot->scaled = false;
+	pSlot->formatSerial = 0;
+	pSlot->frameSerial = 0;
+}
+
+VkResult 
+create_slot_planes(VideoSlot* pSlot) 
+{
+	const PlaneLayout* pLayout = format.pLayout;
+	VkDescriptorImageInfo imageInfos[VIDEO_PLANES];
+
+	for (uint32_t p = 0; p < pLayout->planeCount; ++p) {
+		PlaneImage* pPlane = &pSlot->planes[p];
+
+		if (create_image(videoPhysicalDevice, 
+				  videoDevice, 
+				  format.extents[p], 
+				  pLayout->formats[p], 
+				  VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, 
+				  &pPlane->image, 
+				  &pPlane->memory) != VK_SUCCESS) {
+			fputs("Video: failed to create plane images.\n", stderr);
+			return VK_ERROR_INITIALIZATION_FAILED;
+		}
+
+		VkImageViewCreateInfo viewInfo = { };
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = pPlane->image;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = pLayout->formats[p];
+		viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		viewInfo.subresourceRange.baseMipLevel = 0;
+		viewInfo.subresourceRange.levelCount = 1;
+		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.layerCount = 1;
+
+		if (vkCreateImageView(videoDevice, &viewInfo, nullptr, &pPlane->view) != VK_SUCCESS) {
+			fputs("Video: failed to create plane image views.\n", stderr);
+			return VK_ERROR_INITIALIZATION_FAILED;
+		}
+
+		imageInfos[p].sampler = VK_NULL_HANDLE;
+		imageInfos[p].imageView = pPlane->view;
+		imageInfos[p].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	}
+
+	/* Semi-planar formats leave the third binding to the interleaved chroma plane. */
+	for (uint32_t p = pLayout->planeCount; p < VIDEO_PLANES; ++p) {
+		imageInfos[p] = imageInfos[pLayout->planeCount - 1];
+	}
+
+	VkWriteDescriptorSet write = { };
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = pSlot->descriptorSet;
+	write.dstBinding = 0;
+	write.dstArrayElement = 0;
+	write.descriptorCount = VIDEO_PLANES;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	write.pImageInfo = imageInfos;
+	vkUpdateDescriptorSets(videoDevice, 1, &write, 0, nullptr);
+
+	pSlot->formatSerial = formatSerial;
+	return VK_SUCCESS;
+}
+
+VkResult 
+reserve_staging(void) 
+{
+	if (format.size <= get_staging_capacity()) { return VK_SUCCESS; }
+
+	/* Only when the stream grows: other slots may still be reading the ring. */
+	if (get_staging_buffer() != VK_NULL_HANDLE) {
+		vkDeviceWaitIdle(videoDevice);
+		close_staging_ring(videoDevice);
+	}
+
+	return create_staging_ring(videoPhysicalDevice, 
+				   videoDevice, 
+				   format.size, 
+				   MAX_FRAMES_IN_FLIGHT);
+}
+
+void 
+copy_frame_to_staging(uint8_t* pStaging, const AVFrame* pFrame) 
+{
+	uint8_t* dstData[4] = { };
+	int dstLinesizes[4] = { };
+	for (uint32_t p = 0; p < format.pLayout->planeCount; ++p) {
+		dstData[p] = pStaging + format.offsets[p];
+		dstLinesizes[p] = format.rowSizes[p];
+	}
+
+	av_image_copy(dstData, 
+		      dstLinesizes, 
+		      (const uint8_t**) pFrame->data, 
+		      pFrame->linesize, 
+		      pFrame->format, 
+		      pFrame->width, 
+		      pFrame->height);
+}
+
+/* Lets the copy read the decoder's buffer directly when the whole frame lives in 
+ * one frame pool buffer. Imports are cached by address until the device goes 
+ * away, so any other allocation, which may be freed and reused sooner, is staged. */
+VkBuffer 
+import_frame(const AVFrame* pFrame, VkDeviceSize* pOffsets, uint32_t* pRowLengths) 
+{
+	const AVBufferRef* pBuffer = pFrame->buf[0];
+	if (!host_import_enabled() || !pBuffer || pFrame->buf[1] || !is_pooled_buffer(pBuffer)) {
+		return VK_NULL_HANDLE;
+	}
+
+	for (uint32_t p = 0; p < format.pLayout->planeCount; ++p) {
+		uint32_t bytesPerPixel = format.pLayout->bytesPerPixel[p];
+		if (pFrame->data[p] < pBuffer->data || 
+			pFrame->data[p] >= pBuffer->data + pBuffer->size || 
+			pFrame->linesize[p] <= 0 || pFrame->linesize[p] % bytesPerPixel) {
+			return VK_NULL_HANDLE;
+		}
+
+		pOffsets[p] = pFrame->data[p] - pBuffer->data;
+		pRowLengths[p] = pFrame->linesize[p] / bytesPerPixel;
+		if (pOffsets[p] % bytesPerPixel) { return VK_NULL_HANDLE; }
+	}
+
+	return import_host_buffer(pBuffer->data, pBuffer->size);
+}
+
+void 
+record_plane_barriers(VkCommandBuffer commandBuffer, VideoSlot* pSlot, bool toTransfer) 
+{
+	VkImageMemoryBarrier barriers[VIDEO_PLANES];
+	uint32_t planeCount = format.pLayout->planeCount;
+
+	for (uint32_t p = 0; p < planeCount; ++p) {
+		VkImageMemoryBarrier* pBarrier = &barriers[p];
+		*pBarrier = (VkImageMemoryBarrier) { };
+		pBarrier->sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		pBarrier->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		pBarrier->dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		pBarrier->image = pSlot->planes[p].image;
+		pBarrier->subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		pBarrier->subresourceRange.levelCount = 1;
+		pBarrier->subresourceRange.layerCount = 1;
+
+		if (toTransfer) {
+			/* The previous contents are overwritten entirely. */
+			pBarrier->oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			pBarrier->newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			pBarrier->srcAccessMask = 0;
+			pBarrier->dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		} else {
+			pBarrier->oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			pBarrier->newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			pBarrier->srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			pBarrier->dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		}
+	}
+
+	/* Planes are sampled by the fragment shader, or by the scaler. */
+	vkCmdPipelineBarrier(commandBuffer, 
+			      toTransfer ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : 
+					   VK_PIPELINE_STAGE_TRANSFER_BIT, 
+			      toTransfer ? VK_PIPELINE_STAGE_TRANSFER_BIT : 
+					   VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | 
+					   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 
+			      0, 
+			      0, nullptr, 
+			      0, nullptr, 
+			      planeCount, barriers);
+}
+
+/* Must be recorded outside the render pass. */
+VkResult 
+record_video_upload(VkCommandBuffer commandBuffer, uint32_t slot) 
+{
+	VideoSlot* pSlot = &slots[slot];
+	if (!pCurrent || pSlot->frameSerial == frameSerial) { return VK_SUCCESS; }
+	const AVFrame* pFrame = pCurrent->pFrame;
+
+	VkResult ret;
+	if (pSlot->formatSerial != formatSerial) {
+		destroy_slot_planes(pSlot);
+		ret = create_slot_planes(pSlot);
+		if (ret != VK_SUCCESS) {
+			destroy_slot_planes(pSlot);
+			return ret;
+		}
+	}
+
+	/* The previous upload from this slot has completed. */
+	drop_frame(&pSlot->pSource);
+
+	VkDeviceSize offsets[VIDEO_PLANES];
+	uint32_t rowLengths[VIDEO_PLANES];
+	VkBuffer source = import_frame(pFrame, offsets, rowLengths);
+	if (source != VK_NULL_HANDLE) {
+		/* The decoder gets the frame back once this slot's fence signals. */
+		pSlot->pSource = pCurrent;
+		++pCurrent->users;
+	}
+
+	if (source == VK_NULL_HANDLE) {
+		ret = reserve_staging();
+		if (ret != VK_SUCCESS) { return ret; }
+
+		VkDeviceSize slotOffset;
+		copy_frame_to_staging(map_staging_slot(slot, &slotOffset), pFrame);
+
+		source = get_staging_buffer();
+		for (uint32_t p = 0; p < format.pLayout->planeCount; ++p) {
+			offsets[p] = slotOffset + format.offsets[p];
+			rowLengths[p] = 0;
+		}
+	}
+
+	record_plane_barriers(commandBuffer, pSlot, true);
+	for (uint32_t p = 0; p < format.pLayout->planeCount; ++p) {
+		VkBufferImageCopy region = { };
+		region.bufferOffset = offsets[p];
+		region.bufferRowLength = rowLengths[p];
+		region.bufferImageHeight = 0;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = 0;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageExtent.width = format.extents[p].width;
+		region.imageExtent.height = format.extents[p].height;
+		region.imageExtent.depth = 1;
+
+		vkCmdCopyBufferToImage(commandBuffer, 
+				       source, 
+				       pSlot->planes[p].image, 
+				       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 
+				       1, 
+				       &region);
+	}
+	record_plane_barriers(commandBuffer, pSlot, false);
+
+	compute_conversion(pFrame, format.pLayout, &pSlot->conversion);
+	pSlot->frameSerial = frameSerial;
+
+	/* Without the scaler, the frame is drawn at its own size. */
+	pSlot->scaled = false;
+	if (scaler_enabled()) {
+		VkImageView planeViews[VIDEO_PLANES];
+		for (uint32_t p = 0; p < VIDEO_PLANES; ++p) {
+			uint32_t plane = p < format.pLayout->planeCount ? p : format.pLayout->planeCount - 1;
+			planeViews[p] = pSlot->planes[plane].view;
+		}
+
+		VkExtent2D source = { format.width, format.height };
+		pSlot->scaled = record_scale(commandBuffer, 
+					     slot, 
+					     planeViews, 
+					     source, 
+					     &pSlot->conversion) == VK_SUCCESS;
+	}
+
+	return VK_SUCCESS;
+}
+
+bool 
+bind_video_frame(VkCommandBuffer commandBuffer, VkPipelineLayout layout, uint32_t slot) 
+{
+	VideoSlot* pSlot = &slots[slot];
+	if (!pSlot->frameSerial) { return false; }
+
+	VkDescriptorSet descriptorSet = pSlot->descriptorSet;
+	ColorConversion conversion = pSlot->conversion;
+	if (pSlot->scaled) {
+		descriptorSet = get_scaled_descriptor_set(slot);
+		conversion.rgb = 1;
+	}
+
+	vkCmdBindDescriptorSets(commandBuffer, 
+				VK_PIPELINE_BIND_POINT_GRAPHICS, 
+				layout, 
+				0, 
+				1, 
+				&descriptorSet, 
+				0, 
+				nullptr);
+	vkCmdPushConstants(commandBuffer, 
+			   layout, 
+			   VK_SHADER_STAGE_FRAGMENT_BIT, 
+			   0, 
+			   sizeof(ColorConversion), 
+			   &conversion);
+
+	return true;
+}
+
+void 
+close_video_resources(VkDevice device) 
+{
+	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+		destroy_slot_planes(&slots[i]);
+		slots[i].descriptorSet = VK_NULL_HANDLE;
+	}
+	close_staging_ring(device);
+	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+	descriptorPool = VK_NULL_HANDLE;
+
+	format = (VideoFormat) { };
+	formatSerial = 0;
+	drop_frame(&pCurrent);
+	frameSerial = 0;
+}
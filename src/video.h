@@ -0,0 +1,24 @@
+#ifndef	VIDEO_H
+#define	VIDEO_H
+
+#include <libavutil/frame.h>
+#include <vulkan/vulkan.h>
+
+VkResult 
+create_video_resources(VkPhysicalDevice physicalDevice, 
+		       VkDevice device, 
+		       VkDescriptorSetLayout setLayout);
+
+int 
+set_video_frame(AVFrame* pFrame);
+
+VkResult 
+record_video_upload(VkCommandBuffer commandBuffer, uint32_t slot);
+
+bool 
+bind_video_frame(VkCommandBuffer commandBuffer, VkPipelineLayout layout, uint32_t slot);
+
+void 
+close_video_resources(VkDevice device);
+
+#endif	/* VIDEO_H */
@@ -0,0 +1,486 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <libavutil/error.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "y4m.h"
+
+#define Y4M_MAGIC		"YUV4MPEG2"
+#define FRAME_MAGIC		"FRAME"
+#define MAX_HEADER_SIZE		1024
+/* Pipe reads are this large; frame payloads bypass the buffer entirely. */
+#define READ_BUFFER_SIZE	(4 * 1024 * 1024)
+
+static size_t 
+get_plane_size(const Y4MFormat* pFormat, uint32_t plane, size_t* pLineSize) 
+{
+	size_t bytesPerSample = pFormat->pixelFormat == AV_PIX_FMT_YUV420P10LE ? 2 : 1;
+	size_t width = plane ? (pFormat->width + 1) / 2 : pFormat->width;
+	size_t height = plane ? (pFormat->height + 1) / 2 : pFormat->height;
+
+	*pLineSize = width * bytesPerSample;
+	return *pLineSize * height;
+}
+
+/* Y4M stores the three planes back to back without padding. */
+static void 
+set_planes(const Y4MFormat* pFormat, AVFrame* pFrame, uint8_t* pData) 
+{
+	for (uint32_t p = 0; p < 3; ++p) {
+		size_t lineSize;
+		size_t planeSize = get_plane_size(pFormat, p, &lineSize);
+		pFrame->data[p] = pData;
+		pFrame->linesize[p] = (int) lineSize;
+		pData += planeSize;
+	}
+
+	pFrame->format = pFormat->pixelFormat;
+	pFrame->width = (int) pFormat->width;
+	pFrame->height = (int) pFormat->height;
+	pFrame->color_range = pFormat->fullRange ? AVCOL_RANGE_JPEG : AVCOL_RANGE_MPEG;
+}
+
+static int 
+parse_header(Y4MFormat* pFormat, char* line) 
+{
+	if (strncmp(line, Y4M_MAGIC " ", sizeof(Y4M_MAGIC)) != 0) {
+		fputs("Y4M: not a YUV4MPEG2 stream.\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	*pFormat = (Y4MFormat) { };
+	pFormat->frameRate = (AVRational) { 25, 1 };
+	const char* colorspace = "420jpeg";
+
+	char* pSave = nullptr;
+	for (char* pToken = strtok_r(line + sizeof(Y4M_MAGIC), " ", &pSave);
+		pToken;
+		pToken = strtok_r(nullptr, " ", &pSave)) {
+		switch (pToken[0]) {
+		case 'W':
+			pFormat->width = (uint32_t) strtoul(pToken + 1, nullptr, 10);
+			break;
+		case 'H':
+			pFormat->height = (uint32_t) strtoul(pToken + 1, nullptr, 10);
+			break;
+		case 'F':
+			if (sscanf(pToken + 1, 
+				   "%d:%d", 
+				   &pFormat->frameRate.num, 
+				   &pFormat->frameRate.den) != 2) {
+				pFormat->frameRate = (AVRational) { };
+			}
+			break;
+		case 'C':
+			colorspace = pToken + 1;
+			break;
+		case 'X':
+			if (strcmp(pToken + 1, "COLORRANGE=FULL") == 0) { pFormat->fullRange = true; }
+			break;
+		default:
+			/* Interlacing and pixel aspect do not change how frames are shown. */
+			break;
+		}
+	}
+
+	/* The 4:2:0 variants only differ in chroma siting. */
+	if (strcmp(colorspace, "420p10") == 0) {
+		pFormat->pixelFormat = AV_PIX_FMT_YUV420P10LE;
+	} else if (strcmp(colorspace, "420jpeg") == 0 || strcmp(colorspace, "420paldv") == 0 || 
+		strcmp(colorspace, "420mpeg2") == 0 || strcmp(colorspace, "420") == 0) {
+		pFormat->pixelFormat = AV_PIX_FMT_YUV420P;
+	} else {
+		fprintf(stderr, "Y4M: unsupported colorspace C%s.\n", colorspace);
+		return EXIT_FAILURE;
+	}
+
+	if (!pFormat->width || !pFormat->height || 
+		pFormat->frameRate.num <= 0 || pFormat->frameRate.den <= 0) {
+		fputs("Y4M: invalid stream header.\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	size_t lineSize;
+	for (uint32_t p = 0; p < 3; ++p) { pFormat->frameSize += get_plane_size(pFormat, p, &lineSize); }
+
+	return EXIT_SUCCESS;
+}
+
+bool 
+is_y4m_path(const char* path) 
+{
+	size_t len = strlen(path);
+	return strcmp(path, "-") == 0 || (len > 4 && strcmp(path + len - 4, ".y4m") == 0);
+}
+
+/* Moves the unread bytes to the front of the buffer and reads more behind them. */
+static ssize_t 
+fill_buffer(Y4MReader* pReader) 
+{
+	size_t pending = pReader->bufferFill - pReader->bufferPos;
+	memmove(pReader->pBuffer, pReader->pBuffer + pReader->bufferPos, pending);
+	pReader->bufferPos = 0;
+	pReader->bufferFill = pending;
+
+	ssize_t bytes;
+	do {
+		bytes = read(pReader->fd, 
+			     pReader->pBuffer + pending, 
+			     READ_BUFFER_SIZE - pending);
+	} while (bytes == -1 && errno == EINTR);
+	if (bytes > 0) { pReader->bufferFill += (size_t) bytes; }
+
+	return bytes;
+}
+
+/* Reads one header line from a pipe into line, without its newline. */
+static int 
+read_line(Y4MReader* pReader, char* line) 
+{
+	for (;;) {
+		const uint8_t* pStart = pReader->pBuffer + pReader->bufferPos;
+		size_t pending = pReader->bufferFill - pReader->bufferPos;
+		const uint8_t* pEnd = memchr(pStart, '\n', pending);
+		if (pEnd) {
+			size_t len = (size_t) (pEnd - pStart);
+			if (len >= MAX_HEADER_SIZE) { return AVERROR_INVALIDDATA; }
+
+			memcpy(line, pStart, len);
+			line[len] = '\0';
+			pReader->bufferPos += len + 1;
+			return 0;
+		}
+		if (pending >= MAX_HEADER_SIZE) { return AVERROR_INVALIDDATA; }
+
+		ssize_t bytes = fill_buffer(pReader);
+		if (bytes == 0) { return AVERROR_EOF; }
+		if (bytes < 0) { return AVERROR(errno); }
+	}
+}
+
+static int 
+read_fully(int fd, uint8_t* pData, size_t size) 
+{
+	while (size) {
+		ssize_t bytes = read(fd, pData, size);
+		if (bytes == -1 && errno == EINTR) { continue; }
+		if (bytes == 0) { return AVERROR_EOF; }
+		if (bytes < 0) { return AVERROR(errno); }
+
+		pData += bytes;
+		size -= (size_t) bytes;
+	}
+
+	return 0;
+}
+
+/* Finds the header line at offset in the mapping, returning the offset after it. */
+static size_t 
+skip_mapped_line(const Y4MReader* pReader, size_t offset) 
+{
+	size_t remaining = pReader->mapSize - offset;
+	if (remaining > MAX_HEADER_SIZE) { remaining = MAX_HEADER_SIZE; }
+
+	const uint8_t* pEnd = memchr(pReader->pMap + offset, '\n', remaining);
+	return pEnd ? (size_t) (pEnd - pReader->pMap) + 1 : 0;
+}
+
+int 
+open_y4m_reader(Y4MReader* pReader, const char* path) 
+{
+	*pReader = (Y4MReader) { };
+	pReader->fd = strcmp(path, "-") == 0 ? 
+		fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0) : 
+		open(path, O_RDONLY | O_CLOEXEC);
+	if (pReader->fd == -1) {
+		perror("Y4M: failed to open the input");
+		return EXIT_FAILURE;
+	}
+
+	/* Regular files are mapped whole, frames are then handed out in place. */
+	struct stat st;
+	if (fstat(pReader->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void* pMap = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, pReader->fd, 0);
+		if (pMap != MAP_FAILED) {
+			posix_madvise(pMap, (size_t) st.st_size, POSIX_MADV_SEQUENTIAL);
+			pReader->pMap = pMap;
+			pReader->mapSize = (size_t) st.st_size;
+		}
+	}
+
+	char line[MAX_HEADER_SIZE];
+	if (pReader->pMap) {
+		pReader->dataStart = skip_mapped_line(pReader, 0);
+		size_t len = pReader->dataStart ? pReader->dataStart - 1 : 0;
+		memcpy(line, pReader->pMap, len);
+		line[len] = '\0';
+		pReader->pos = pReader->dataStart;
+	} else {
+		pReader->pBuffer = malloc(READ_BUFFER_SIZE);
+		if (!pReader->pBuffer || read_line(pReader, line) != 0) { line[0] = '\0'; }
+	}
+
+	if (parse_header(&pReader->format, line) != EXIT_SUCCESS) {
+		close_y4m_reader(pReader);
+		return EXIT_FAILURE;
+	}
+
+	if (!pReader->pMap) {
+		pReader->pFramePool = av_buffer_pool_init(pReader->format.frameSize, nullptr);
+		if (!pReader->pFramePool) {
+			fputs("Y4M: failed to allocate the frame pool.\n", stderr);
+			close_y4m_reader(pReader);
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static void 
+keep_mapping(void* pOpaque, uint8_t* pData) 
+{
+	(void) pOpaque;
+	(void) pData;
+	/* The mapping lives until close_y4m_reader(). */
+}
+
+static int 
+read_mapped_frame(Y4MReader* pReader, AVBufferRef** ppBuffer) 
+{
+	if (pReader->pos >= pReader->mapSize) { return AVERROR_EOF; }
+	/* Too short for even the FRAME marker: the file was cut off. */
+	if (pReader->mapSize - pReader->pos < strlen(FRAME_MAGIC)) { return AVERROR_EOF; }
+
+	size_t start = skip_mapped_line(pReader, pReader->pos);
+	if (!start || memcmp(pReader->pMap + pReader->pos, FRAME_MAGIC, strlen(FRAME_MAGIC)) != 0) {
+		return AVERROR_INVALIDDATA;
+	}
+	/* A truncated last frame is not shown. */
+	if (pReader->mapSize - start < pReader->format.frameSize) { return AVERROR_EOF; }
+
+	*ppBuffer = av_buffer_create((uint8_t*) pReader->pMap + start,
+				     pReader->format.frameSize, 
+				     keep_mapping, 
+				     nullptr, 
+				     AV_BUFFER_FLAG_READONLY);
+	if (!*ppBuffer) { return AVERROR(ENOMEM); }
+	pReader->pos = start + pReader->format.frameSize;
+
+	return 0;
+}
+
+static int 
+read_piped_frame(Y4MReader* pReader, AVBufferRef** ppBuffer) 
+{
+	char line[MAX_HEADER_SIZE];
+	int ret = read_line(pReader, line);
+	if (ret < 0) { return ret; }
+	if (strncmp(line, FRAME_MAGIC, strlen(FRAME_MAGIC)) != 0) { return AVERROR_INVALIDDATA; }
+
+	*ppBuffer = av_buffer_pool_get(pReader->pFramePool);
+	if (!*ppBuffer) { return AVERROR(ENOMEM); }
+
+	/* Whatever the last fill read past the header, then the rest in one read. */
+	size_t size = pReader->format.frameSize;
+	size_t buffered = pReader->bufferFill - pReader->bufferPos;
+	if (buffered > size) { buffered = size; }
+	memcpy((*ppBuffer)->data, pReader->pBuffer + pReader->bufferPos, buffered);
+	pReader->bufferPos += buffered;
+
+	ret = read_fully(pReader->fd, (*ppBuffer)->data + buffered, size - buffered);
+	if (ret < 0) { av_buffer_unref(ppBuffer); }
+
+	return ret;
+}
+
+/* Fills pFrame with the next frame: 0 on success, AVERROR_EOF at the end. */
+int 
+read_y4m_frame(Y4MReader* pReader, AVFrame* pFrame) 
+{
+	AVBufferRef* pBuffer = nullptr;
+	int ret = pReader->pMap ? 
+		read_mapped_frame(pReader, &pBuffer) : 
+		read_piped_frame(pReader, &pBuffer);
+	if (ret < 0) { return ret; }
+
+	pFrame->buf[0] = pBuffer;
+	set_planes(&pReader->format, pFrame, pBuffer->data);
+	pFrame->pts = pReader->frameIndex;
+	pFrame->best_effort_timestamp = pReader->frameIndex;
+	pFrame->duration = 1;
+	++pReader->frameIndex;
+
+	return 0;
+}
+
+/* Only mapped files whose FRAME headers all match the first one can seek. */
+int 
+seek_y4m(Y4MReader* pReader, int64_t frameIndex) 
+{
+	if (!pReader->pMap || pReader->dataStart >= pReader->mapSize || frameIndex < 0) {
+		return EXIT_FAILURE;
+	}
+
+	size_t frameStart = skip_mapped_line(pReader, pReader->dataStart);
+	if (!frameStart) { return EXIT_FAILURE; }
+
+	size_t stride = frameStart - pReader->dataStart + pReader->format.frameSize;
+	size_t frameCount = (pReader->mapSize - pReader->dataStart) / stride;
+	if ((uint64_t) frameIndex > frameCount) { frameIndex = (int64_t) frameCount; }
+
+	size_t pos = pReader->dataStart + (size_t) frameIndex * stride;
+	if (pos < pReader->mapSize && 
+		memcmp(pReader->pMap + pos, FRAME_MAGIC, strlen(FRAME_MAGIC)) != 0) {
+		return EXIT_FAILURE;
+	}
+
+	pReader->pos = pos;
+	pReader->frameIndex = frameIndex;
+	return EXIT_SUCCESS;
+}
+
+/* Frames read from a mapping must have been released. */
+void 
+close_y4m_reader(Y4MReader* pReader) 
+{
+	if (pReader->pMap) { munmap((void*) pReader->pMap, pReader->mapSize); }
+	av_buffer_pool_uninit(&pReader->pFramePool);
+	free(pReader->pBuffer);
+	if (pReader->fd != -1) { close(pReader->fd); }
+
+	*pReader = (Y4MReader) { };
+	pReader->fd = -1;
+}
+
+static int 
+write_fully(int fd, const uint8_t* pData, size_t size) 
+{
+	while (size) {
+		ssize_t bytes = write(fd, pData, size);
+		if (bytes == -1 && errno == EINTR) { continue; }
+		if (bytes < 0) { return EXIT_FAILURE; }
+
+		pData += bytes;
+		size -= (size_t) bytes;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int 
+open_y4m_writer(Y4MWriter* pWriter, const char* path, const Y4MFormat* pFormat) 
+{
+	*pWriter = (Y4MWriter) { };
+	pWriter->fd = -1;
+	pWriter->format = *pFormat;
+
+	const char* colorspace;
+	switch (pFormat->pixelFormat) {
+	case AV_PIX_FMT_YUV420P:
+		colorspace = "420jpeg";
+		break;
+	case AV_PIX_FMT_YUV420P10LE:
+		colorspace = "420p10";
+		break;
+	default:
+		fputs("Y4M: only 4:2:0 frames can be written.\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	size_t lineSize;
+	pWriter->format.frameSize = 0;
+	for (uint32_t p = 0; p < 3; ++p) {
+		pWriter->format.frameSize += get_plane_size(pFormat, p, &lineSize);
+	}
+
+	pWriter->headerSize = strlen(FRAME_MAGIC "\n");
+	pWriter->pBuffer = malloc(pWriter->headerSize + pWriter->format.frameSize);
+	if (!pWriter->pBuffer) {
+		fputs("Y4M: failed to allocate the frame buffer.\n", stderr);
+		return EXIT_FAILURE;
+	}
+	memcpy(pWriter->pBuffer, FRAME_MAGIC "\n", pWriter->headerSize);
+
+	pWriter->fd = strcmp(path, "-") == 0 ? 
+		fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0) : 
+		open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (pWriter->fd == -1) {
+		perror("Y4M: failed to open the output");
+		free(pWriter->pBuffer);
+		pWriter->pBuffer = nullptr;
+		return EXIT_FAILURE;
+	}
+
+	char header[MAX_HEADER_SIZE];
+	int len = snprintf(header, 
+			   sizeof(header), 
+			   Y4M_MAGIC " W%u H%u F%d:%d Ip A1:1 C%s%s\n", 
+			   pFormat->width, 
+			   pFormat->height, 
+			   pFormat->frameRate.num, 
+			   pFormat->frameRate.den, 
+			   colorspace, 
+			   pFormat->fullRange ? " XCOLORRANGE=FULL" : "");
+	if (write_fully(pWriter->fd, (const uint8_t*) header, (size_t) len) != EXIT_SUCCESS) {
+		perror("Y4M: failed to write the stream header");
+		close_y4m_writer(pWriter);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/* Packs the planes behind the FRAME marker and writes the record in one go. */
+int 
+write_y4m_frame(Y4MWriter* pWriter, const AVFrame* pFrame) 
+{
+	if (pFrame->format != pWriter->format.pixelFormat || 
+		pFrame->width != (int) pWriter->format.width || 
+		pFrame->height != (int) pWriter->format.height) {
+		fputs("Y4M: frame does not match the stream header.\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	uint8_t* pDst = pWriter->pBuffer + pWriter->headerSize;
+	for (uint32_t p = 0; p < 3; ++p) {
+		size_t lineSize;
+		size_t planeSize = get_plane_size(&pWriter->format, p, &lineSize);
+		size_t rows = planeSize / lineSize;
+		for (size_t y = 0; y < rows; ++y) {
+			memcpy(pDst + y * lineSize, pFrame->data[p] + y * pFrame->linesize[p], lineSize);
+		}
+		pDst += planeSize;
+	}
+
+	if (write_fully(pWriter->fd, 
+			pWriter->pBuffer, 
+			pWriter->headerSize + pWriter->format.frameSize) != EXIT_SUCCESS) {
+		perror("Y4M: failed to write a frame");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int 
+close_y4m_writer(Y4MWriter* pWriter) 
+{
+	int ret = EXIT_SUCCESS;
+	if (pWriter->fd != -1 && close(pWriter->fd) == -1) {
+		perror("Y4M: failed to close the output");
+		ret = EXIT_FAILURE;
+	}
+	free(pWriter->pBuffer);
+
+	*pWriter = (Y4MWriter) { };
+	pWriter->fd = -1;
+	return ret;
+}
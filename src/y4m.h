@@ -0,0 +1,72 @@
+#ifndef	Y4M_H
+#define	Y4M_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+#include <libavutil/rational.h>
+
+/* Stream parameters from the YUV4MPEG2 header */
+typedef struct Y4MFormat {
+	uint32_t		width;
+	uint32_t		height;
+	AVRational		frameRate;
+	enum AVPixelFormat	pixelFormat;
+	bool			fullRange;
+	size_t			frameSize;	/* Payload bytes per frame, planes packed */
+} Y4MFormat;
+
+/* Reads frames either straight out of a mapping of the whole file, or from a pipe */
+typedef struct Y4MReader {
+	Y4MFormat	format;
+	int		fd;
+	int64_t		frameIndex;
+
+	/* Mapped files */
+	const uint8_t*	pMap;
+	size_t		mapSize;
+	size_t		dataStart;	/* First FRAME marker */
+	size_t		pos;
+
+	/* Pipes */
+	uint8_t*	pBuffer;
+	size_t		bufferPos;
+	size_t		bufferFill;
+	AVBufferPool*	pFramePool;
+} Y4MReader;
+
+typedef struct Y4MWriter {
+	Y4MFormat	format;
+	int		fd;
+	uint8_t*	pBuffer;	/* One whole FRAME record, written with one call */
+	size_t		headerSize;
+} Y4MWriter;
+
+bool 
+is_y4m_path(const char* path);
+
+int 
+open_y4m_reader(Y4MReader* pReader, const char* path);
+
+int 
+read_y4m_frame(Y4MReader* pReader, AVFrame* pFrame);
+
+int 
+seek_y4m(Y4MReader* pReader, int64_t frameIndex);
+
+void 
+close_y4m_reader(Y4MReader* pReader);
+
+int 
+open_y4m_writer(Y4MWriter* pWriter, const char* path, const Y4MFormat* pFormat);
+
+int 
+write_y4m_frame(Y4MWriter* pWriter, const AVFrame* pFrame);
+
+int 
+close_y4m_writer(Y4MWriter* pWriter);
+
+#endif	/* Y4M_H */
@@ -0,0 +1,265 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "convert.h"
+
+#define MAX_WIDTH	199
+/* Bytes past the output row that no kernel may write */
+#define GUARD_SIZE	64
+#define GUARD_BYTE	0xA5
+#define MAX_REPORTS	16
+
+typedef enum Pattern {
+	PATTERN_RANDOM,
+	PATTERN_BLACK,		/* Zero luma, chroma at either extreme */
+	PATTERN_WHITE,		/* Full luma, chroma at either extreme */
+	PATTERN_COUNT,
+} Pattern;
+
+static const char* patternNames[PATTERN_COUNT] = { "random", "black", "white" };
+static const char* formatNames[] = { "NV12", "I420", "P010" };
+
+typedef struct Kernel {
+	const char*		name;
+	ConvertRowKernel	convert;
+} Kernel;
+
+/* Offset, scale and RGB order coefficients of the matrices convert.c builds */
+typedef struct Matrix {
+	const char*	name;
+	int16_t		yOffset;
+	int16_t		yScale;
+	int16_t		red;
+	int16_t		greenU;
+	int16_t		greenV;
+	int16_t		blue;
+} Matrix;
+
+static const Matrix matrices[] = {
+	{ "BT.709 limited", 1024, 9539, 14686, -1747, -4366, 17305 }, 
+	{ "BT.601 full", 0, 8192, 11485, -2819, -5850, 14516 }, 
+	{ "BT.2020 limited", 1024, 9539, 13752, -1535, -5328, 17545 }, 
+};
+
+/* Input planes of one output row, each allocated to its exact size */
+typedef struct RowInput {
+	uint8_t*	pLuma[2];
+	uint8_t*	pChroma[2];
+	size_t		lumaSize;
+	size_t		chromaSize;
+} RowInput;
+
+static Kernel kernels[3];
+static uint32_t kernelCount;
+static uint64_t checkedRows;
+static uint64_t failures;
+static uint32_t randomState = 0x2545F491u;
+
+static uint8_t 
+next_random(void) 
+{
+	randomState ^= randomState << 13;
+	randomState ^= randomState >> 17;
+	randomState ^= randomState << 5;
+	return (uint8_t) (randomState >> 24);
+}
+
+/* The vector kernels this CPU can run */
+static uint32_t 
+find_kernels(Kernel* pKernels) 
+{
+	uint32_t count = 0;
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.1")) {
+		pKernels[count++] = (Kernel) { "sse4.1", convert_row_sse41 };
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		pKernels[count++] = (Kernel) { "avx2", convert_row_avx2 };
+	}
+	if (__builtin_cpu_supports("avx512bw")) {
+		pKernels[count++] = (Kernel) { "avx512", convert_row_avx512 };
+	}
+#endif
+	(void) pKernels;
+
+	return count;
+}
+
+static void 
+fill_plane(uint8_t* pPlane, size_t size, Pattern pattern, bool luma) 
+{
+	for (size_t i = 0; i < size; ++i) {
+		switch (pattern) {
+		case PATTERN_RANDOM:
+			pPlane[i] = next_random();
+			break;
+		case PATTERN_BLACK:
+		case PATTERN_WHITE:
+			if (luma) {
+				pPlane[i] = pattern == PATTERN_WHITE ? 0xFF : 0x00;
+			} else {
+				pPlane[i] = (next_random() & 1) ? 0xFF : 0x00;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+static void 
+free_row_input(RowInput* pInput) 
+{
+	for (size_t i = 0; i < 2; ++i) {
+		free(pInput->pLuma[i]);
+		free(pInput->pChroma[i]);
+	}
+	*pInput = (RowInput) { };
+}
+
+static int 
+create_row_input(ConvertFormat format, bool half, uint32_t width, Pattern pattern, RowInput* pInput) 
+{
+	size_t sampleSize = format == CONVERT_P010 ? 2 : 1;
+	size_t chromaWidth = half ? width : (width + 1) / 2;
+
+	*pInput = (RowInput) { };
+	pInput->lumaSize = (half ? 2 * width : width) * sampleSize;
+	pInput->chromaSize = format == CONVERT_I420 ? chromaWidth : 2 * chromaWidth * sampleSize;
+
+	uint32_t lumaRows = half ? 2 : 1;
+	uint32_t chromaPlanes = format == CONVERT_I420 ? 2 : 1;
+	for (uint32_t i = 0; i < lumaRows; ++i) {
+		pInput->pLuma[i] = malloc(pInput->lumaSize);
+		if (!pInput->pLuma[i]) { return EXIT_FAILURE; }
+		fill_plane(pInput->pLuma[i], pInput->lumaSize, pattern, true);
+	}
+	for (uint32_t i = 0; i < chromaPlanes; ++i) {
+		pInput->pChroma[i] = malloc(pInput->chromaSize);
+		if (!pInput->pChroma[i]) { return EXIT_FAILURE; }
+		fill_plane(pInput->pChroma[i], pInput->chromaSize, pattern, false);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static ConvertCoefficients 
+get_coefficients(const Matrix* pMatrix, bool swapChroma) 
+{
+	ConvertCoefficients coefficients = { };
+	coefficients.yOffset = pMatrix->yOffset;
+	coefficients.yScale = pMatrix->yScale;
+	coefficients.greenU = pMatrix->greenU;
+	coefficients.greenV = pMatrix->greenV;
+	coefficients.swapChroma = swapChroma;
+	coefficients.first = swapChroma ? pMatrix->blue : pMatrix->red;
+	coefficients.last = swapChroma ? pMatrix->red : pMatrix->blue;
+
+	return coefficients;
+}
+
+static bool 
+is_guard_intact(const uint8_t* pOutput, uint32_t width) 
+{
+	for (size_t i = 0; i < GUARD_SIZE; ++i) {
+		if (pOutput[(size_t) width * 4 + i] != GUARD_BYTE) { return false; }
+	}
+
+	return true;
+}
+
+/* Every kernel against the scalar reference on one row, for each matrix and both
+ * byte orders. Returns the number of mismatching conversions. */
+static uint64_t 
+check_row(ConvertRow* pRow, Pattern pattern) 
+{
+	uint8_t expected[MAX_WIDTH * 4];
+	uint8_t output[MAX_WIDTH * 4 + GUARD_SIZE];
+	uint64_t failed = 0;
+
+	for (size_t m = 0; m < sizeof(matrices) / sizeof(Matrix); ++m) {
+		for (int swap = 0; swap < 2; ++swap) {
+			ConvertCoefficients coefficients = get_coefficients(&matrices[m], swap);
+
+			pRow->pOutput = expected;
+			convert_row_scalar(pRow, &coefficients);
+
+			for (uint32_t k = 0; k < kernelCount; ++k) {
+				memset(output, GUARD_BYTE, sizeof(output));
+				pRow->pOutput = output;
+				kernels[k].convert(pRow, &coefficients);
+				++checkedRows;
+
+				bool guarded = is_guard_intact(output, pRow->width);
+				size_t size = (size_t) pRow->width * 4;
+				if (guarded && memcmp(output, expected, size) == 0) { continue; }
+				if (++failed + failures > MAX_REPORTS) { continue; }
+
+				fprintf(stderr, 
+					"convert_test: %s, %s %s, %s%s, width %u, %s input: ", 
+					kernels[k].name, 
+					formatNames[pRow->format], 
+					swap ? "BGRA" : "RGBA", 
+					matrices[m].name, 
+					pRow->half ? " halved" : "", 
+					pRow->width, 
+					patternNames[pattern]);
+				if (!guarded) {
+					fputs("wrote past the row.\n", stderr);
+					continue;
+				}
+
+				uint32_t x = 0;
+				while (memcmp(output + x * 4, expected + x * 4, 4) == 0) { ++x; }
+				fprintf(stderr, "differs from scalar at pixel %u.\n", x);
+			}
+		}
+	}
+
+	return failed;
+}
+
+int 
+main(void) 
+{
+	kernelCount = find_kernels(kernels);
+	if (!kernelCount) {
+		puts("convert_test: no vector kernels on this CPU, nothing to compare.");
+		return EXIT_SUCCESS;
+	}
+
+	for (ConvertFormat format = CONVERT_NV12; format <= CONVERT_P010; ++format) {
+		for (uint32_t r = 0; r < 2 * MAX_WIDTH * PATTERN_COUNT; ++r) {
+			bool half = r / (MAX_WIDTH * PATTERN_COUNT);
+			uint32_t width = r / PATTERN_COUNT % MAX_WIDTH + 1;
+			Pattern pattern = r % PATTERN_COUNT;
+
+			RowInput input;
+			if (create_row_input(format, half, width, pattern, &input) != EXIT_SUCCESS) {
+				fputs("convert_test: out of memory.\n", stderr);
+				free_row_input(&input);
+				return EXIT_FAILURE;
+			}
+
+			ConvertRow row = { };
+			row.format = format;
+			row.half = half;
+			row.width = width;
+			memcpy(row.pLuma, input.pLuma, sizeof(row.pLuma));
+			memcpy(row.pChroma, input.pChroma, sizeof(row.pChroma));
+			failures += check_row(&row, pattern);
+
+			free_row_input(&input);
+		}
+	}
+
+	printf("convert_test: %u kernels, %llu rows, %llu mismatches.\n", 
+	       kernelCount, 
+	       (unsigned long long) checkedRows, 
+	       (unsigned long long) failures);
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}